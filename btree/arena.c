@@ -39,7 +39,7 @@ static bool arena_grow(struct arena *a, size_t min_size)
         return false;
     }
 
-    a->cap = new_cap;
+    __atomic_store_n(&a->cap, new_cap, __ATOMIC_RELEASE);
 
     return true;
 }
@@ -84,6 +84,23 @@ sysconf_failed:
     return (arena_t) { 0 };
 }
 
+// Bump the size atomically and only serialize the rare calls that have to
+// grow the mapping. Growing never moves the data so other threads can keep
+// using what they have.
+static void* arena_alloc_shared(arena_t *a, size_t size)
+{
+    size_t offset = __atomic_fetch_add(&a->size, size, __ATOMIC_RELAXED);
+    if (offset + size > __atomic_load_n(&a->cap, __ATOMIC_ACQUIRE)) {
+        while (__atomic_test_and_set(&a->grow_lock, __ATOMIC_ACQUIRE))
+            /* spin */;
+        bool ok = offset + size <= a->cap || arena_grow(a, offset + size);
+        __atomic_clear(&a->grow_lock, __ATOMIC_RELEASE);
+        if (!ok)
+            return NULL;
+    }
+    return a->data + offset;
+}
+
 void* arena_alloc(arena_t *a, size_t size)
 {
     // align
@@ -91,9 +108,13 @@ void* arena_alloc(arena_t *a, size_t size)
         size = (size + KNOB_ALIGNMENT - 1) & ~(KNOB_ALIGNMENT - 1);
     }
 
+    if (a->flags & ARENA_SHARED) {
+        return arena_alloc_shared(a, size);
+    }
+
     void *p = a->data + a->size;
     if (a->size + size > a->cap) {
-        if (!arena_grow(a, a->size))
+        if (!arena_grow(a, a->size + size))
             return NULL;
     }
     a->size += size;
@@ -10,6 +10,7 @@
 enum arena_flags {
     ARENA_GROW      = 1 << 0,
     ARENA_DONTALIGN = 1 << 1,
+    ARENA_SHARED    = 1 << 2, // arena_alloc may be called from several threads
 };
 
 typedef struct arena {
@@ -17,6 +18,7 @@ typedef struct arena {
     size_t size;
     size_t cap;
     char   flags;
+    char   grow_lock;
 } arena_t;
 
 /**
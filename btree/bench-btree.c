@@ -0,0 +1,960 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "btree.h"
+#include "btree-be.h"
+#include "btree-file.h"
+#include "btree-packed.h"
+#include "btree-static.h"
+#include "btree-str.h"
+#include "btree-wal.h"
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+#define likely(expr) __builtin_expect(expr, 1)
+
+Key random_key(uint64_t n) {
+    const Key PRIME = 0x9e3779b97f4a7c15ULL;  // a 64-bit odd constant (golden ratio scaled)
+    n = (n ^ (n >> 30)) * PRIME;
+    n = (n ^ (n >> 27)) * PRIME;
+    n = n ^ (n >> 31);
+    return (Key)n;
+}
+
+static double seconds_since(struct timespec start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static int cmp_key(const void* a, const void* b)
+{
+    const Key x = *(const Key*)a;
+    const Key y = *(const Key*)b;
+    return (x > y) - (x < y);
+}
+
+/* Searches a pool of full, randomly filled nodes with every kernel the CPU
+ * supports. The pool is larger than L2 so this includes the load of the
+ * node, like a descent does. */
+static void bench_search_kernels(void)
+{
+    const size_t node_pool = 1 << 16;
+    const size_t searches  = 1 << 24;
+
+    struct arena a = arena_new();
+    BTree_node* nodes = arena_alloc(&a, node_pool * sizeof *nodes);
+    if (unlikely(!nodes)) {
+        abort();
+    }
+    for (size_t i = 0; i < node_pool; i++) {
+        nodes[i].degree = MAX_KEY;
+        nodes[i].is_leaf = true;
+        for (size_t j = 0; j < MAX_KEY; j++) {
+            nodes[i].keys[j] = random_key(i * MAX_KEY + j);
+        }
+        qsort(nodes[i].keys, MAX_KEY, sizeof nodes[i].keys[0], cmp_key);
+    }
+
+    printf("node search (%zu searches over %zu nodes):\n", searches, node_pool);
+    const size_t selected = BTree_search_kernel_selected();
+    for (size_t i = 0; i < BTree_search_kernel_count(); i++) {
+        const char* name = BTree_search_kernel_name(i);
+        if (!BTree_search_kernel_select(i)) {
+            printf("  %-8s unsupported\n", name);
+            continue;
+        }
+
+        for (size_t n = 0; n < node_pool; n += 97) {
+            const Key k = random_key(~n);
+            size_t expect = 0;
+            while (expect < MAX_KEY && nodes[n].keys[expect] < k) {
+                expect++;
+            }
+            if (BTree_keys_lower_bound(nodes[n].keys, MAX_KEY, k) != expect
+             || BTree_keys_lower_bound(nodes[n].keys, MAX_KEY, nodes[n].keys[n % MAX_KEY]) != n % MAX_KEY) {
+                fprintf(stderr, "fatal: %s search kernel disagrees with scalar\n", name);
+                abort();
+            }
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t sum = 0;
+        for (size_t n = 0; n < searches; n++) {
+            sum += BTree_keys_lower_bound(nodes[random_key(n) % node_pool].keys, MAX_KEY, random_key(~n));
+        }
+        volatile size_t sink = sum;
+        (void)sink;
+        const double elapsed = seconds_since(start);
+        printf("  %-8s %6.1lf Msearch/s%s\n", name, (double)searches / elapsed / 1e6,
+               i == selected ? " (selected)" : "");
+    }
+    BTree_search_kernel_select(selected);
+
+    arena_delete(&a);
+}
+
+static void bench_find(const BTree* btree, uint64_t inserted)
+{
+    const uint64_t lookups = 1 << 22;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t found = 0;
+    for (uint64_t n = 0; n < lookups; n++) {
+        /* every other lookup is a miss */
+        const uint64_t i = random_key(~n) % inserted;
+        found += BTree_find(btree, random_key(n & 1 ? i : i + inserted));
+    }
+    const double elapsed = seconds_since(start);
+    printf("find throughput:   %.2lf Mfind/s (%zu/%"PRIu64" found)\n",
+           (double)lookups / elapsed / 1e6, found, lookups);
+
+    /* the same lookups, batched */
+    Key*  keys = malloc(lookups * sizeof *keys);
+    bool* hits = malloc(lookups * sizeof *hits);
+    if (unlikely(!keys || !hits)) {
+        abort();
+    }
+    for (uint64_t n = 0; n < lookups; n++) {
+        const uint64_t i = random_key(~n) % inserted;
+        keys[n] = random_key(n & 1 ? i : i + inserted);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const size_t batch_found = BTree_find_batch(btree, keys, lookups, hits);
+    const double batch_elapsed = seconds_since(start);
+    printf("batched find:      %.2lf Mfind/s (%zu/%"PRIu64" found, %.2lfx)\n",
+           (double)lookups / batch_elapsed / 1e6, batch_found, lookups, elapsed / batch_elapsed);
+    free(keys);
+    free(hits);
+}
+
+/* Same lookups as bench_find, against a static snapshot of the tree, one
+ * at a time and batched */
+static void bench_static(const BTree* btree, const struct arena* a, uint64_t inserted)
+{
+    struct arena sa = arena_new();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const BTree_static* s = BTree_static_new(&sa, btree);
+    const double build_time = seconds_since(start);
+    printf("static snapshot:   %.2lf s, height: %zu, %.1lf bytes/key (tree: %.1lf bytes/key)\n",
+           build_time, s->height, (double)BTree_static_size(s) / (double)s->n,
+           (double)a->size / (double)s->n);
+
+    const uint64_t lookups = 1 << 22;
+    Key*  keys  = malloc(lookups * sizeof *keys);
+    bool* found = malloc(lookups * sizeof *found);
+    if (unlikely(!keys || !found)) {
+        abort();
+    }
+    for (uint64_t n = 0; n < lookups; n++) {
+        const uint64_t i = random_key(~n) % inserted;
+        keys[n] = random_key(n & 1 ? i : i + inserted);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t hits = 0;
+    for (uint64_t n = 0; n < lookups; n++) {
+        hits += BTree_find(btree, keys[n]);
+    }
+    const double tree_time = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t static_hits = 0;
+    for (uint64_t n = 0; n < lookups; n++) {
+        static_hits += BTree_static_find(s, keys[n]);
+    }
+    const double static_time = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const size_t batch_hits = BTree_static_find_batch(s, keys, lookups, found);
+    const double batch_time = seconds_since(start);
+
+    if (hits != static_hits || hits != batch_hits) {
+        fprintf(stderr, "fatal: static snapshot disagrees with the tree\n");
+        abort();
+    }
+    printf("  BTree_find:      %6.2lf Mfind/s\n", (double)lookups / tree_time / 1e6);
+    printf("  static find:     %6.2lf Mfind/s (%.2lfx)\n", (double)lookups / static_time / 1e6, tree_time / static_time);
+    printf("  static batch:    %6.2lf Mfind/s (%.2lfx)\n", (double)lookups / batch_time / 1e6, tree_time / batch_time);
+
+    free(keys);
+    free(found);
+    arena_delete(&sa);
+}
+
+/* Write the tree out and search the mapped index in place. The first
+ * lookup after open pays for the page faults on the path to the leaf. */
+static void bench_file(const BTree* btree, uint64_t inserted)
+{
+    const char* path = "/tmp/btree-bench.idx";
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (BTree_file_write(btree, path) == -1) {
+        perror("BTree_file_write");
+        return;
+    }
+    const double write_time = seconds_since(start);
+
+    BTree_file f;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (BTree_file_open(&f, path) == -1) {
+        perror("BTree_file_open");
+        unlink(path);
+        return;
+    }
+    const double open_time = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BTree_file_find(&f, random_key(0));
+    const double first_time = seconds_since(start);
+
+    const uint64_t lookups = 1 << 22;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t found = 0;
+    for (uint64_t n = 0; n < lookups; n++) {
+        const uint64_t i = random_key(~n) % inserted;
+        found += BTree_file_find(&f, random_key(n & 1 ? i : i + inserted));
+    }
+    const double elapsed = seconds_since(start);
+
+    printf("index file:        %.1lf MiB, write %.2lf s, open %.1lf us, first find %.1lf us\n",
+           (double)f.size / (1024*1024), write_time, open_time * 1e6, first_time * 1e6);
+    printf("index find:        %.2lf Mfind/s (%zu/%"PRIu64" found)\n",
+           (double)lookups / elapsed / 1e6, found, lookups);
+
+    BTree_file_close(&f);
+    unlink(path);
+}
+
+/* Scans of increasing length from random start keys, forward then backward */
+static void bench_range_scans(const BTree* btree)
+{
+    const size_t lengths[] = { 10 * 1000, 100 * 1000, 1000 * 1000 };
+    const size_t total     = 1 << 24;
+
+    printf("range scans:\n");
+    for (size_t l = 0; l < sizeof lengths / sizeof *lengths; l++) {
+        for (int backward = 0; backward <= 1; backward++) {
+            BTree_cursor c;
+            size_t visited = 0;
+            Key    sum     = 0;
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (uint64_t n = 0; visited < total; n++) {
+                bool ok = BTree_lower_bound(btree, random_key(~n), &c);
+                for (size_t i = 0; ok && i < lengths[l]; i++) {
+                    sum += BTree_cursor_key(&c);
+                    ok = backward ? BTree_prev(&c) : BTree_next(&c);
+                    visited++;
+                }
+            }
+            volatile Key sink = sum;
+            (void)sink;
+            const double elapsed = seconds_since(start);
+            printf("  %7zu keys %-8s %6.1lf Mkey/s\n", lengths[l], backward ? "backward" : "forward",
+                   (double)visited / elapsed / 1e6);
+        }
+    }
+}
+
+/* 50/50 insert/remove with a constant number of live keys. Freed nodes are
+ * recycled so the arena should stay flat from round to round. */
+static void bench_churn(BTree* btree, const struct arena* a, uint64_t inserted)
+{
+    const uint64_t round_ops = 1 << 21;
+
+    printf("churn (insert new key, remove oldest):\n");
+    for (uint64_t round = 0; round < 4; round++) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t n = round * round_ops; n < (round + 1) * round_ops; n++) {
+            BTree_insert(btree, random_key(inserted + n));
+            BTree_remove(btree, random_key(n));
+        }
+        const double elapsed = seconds_since(start);
+        printf("  round %"PRIu64": %5.2lf Mop/s, arena allocated: %zu, nodes: %zu\n", round,
+               2 * (double)round_ops / elapsed / 1e6, a->size, btree->node_count);
+    }
+}
+
+static void print_tree_stats(const char* name, const BTree* btree, const struct arena* a,
+                             uint64_t items, double elapsed)
+{
+    printf("  %-18s %6.2lf s, depth: %zu, nodes: %zu, items per node: %.1lf, overhead per item: %.1lf%%\n",
+           name, elapsed, btree->depth, btree->node_count,
+           (double)items / (double)btree->node_count,
+           100*((double)a->size / (double)items) / (double)sizeof(Key));
+}
+
+struct paths {
+    char*   data;    /* all paths back to back */
+    size_t* offset;  /* start of every path, plus one past the last */
+    size_t  count;
+    size_t  cap;
+    size_t  size;
+};
+
+/* Collect up to `max` paths under `base`, like the filesystem walk in the
+ * hashmap tests */
+static void walk(const char* base, int depth, struct paths* p, size_t max)
+{
+    if (depth >= 64 || p->count >= max) {
+        return;
+    }
+    DIR* d = opendir(base);
+    if (!d) {
+        return;
+    }
+
+    char path[4096];
+    struct dirent* de;
+    while (p->count < max && (de = readdir(d))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        const int n = snprintf(path, sizeof path, "%s/%s", strcmp(base, "/") == 0 ? "" : base, de->d_name);
+        if (n + 1 >= (int)sizeof path) {
+            continue;
+        }
+
+        if (p->offset[p->count] + n > p->cap) {
+            p->cap  = 2 * (p->cap + n);
+            p->data = realloc(p->data, p->cap);
+        }
+        memcpy(&p->data[p->offset[p->count]], path, n);
+        p->offset[p->count + 1] = p->offset[p->count] + n;
+        p->count++;
+
+        struct stat st;
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) {
+            walk(path, depth + 1, p, max);
+        }
+    }
+    closedir(d);
+}
+
+static uint64_t hash_path(const char* s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)s[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* String keys against the integer tree holding a hash of the same keys */
+static void bench_str(size_t max)
+{
+    struct paths p = { .offset = calloc(max + 1, sizeof (size_t)) };
+    walk("/", 0, &p, max);
+    if (p.count == 0) {
+        free(p.offset);
+        return;
+    }
+
+    struct arena sa = arena_new();
+    struct arena ia = arena_new();
+    BTree_str* str = BTree_str_new(&sa);
+    BTree*     ints = BTree_new(&ia);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < p.count; i++) {
+        BTree_str_insert(str, &p.data[p.offset[i]], p.offset[i + 1] - p.offset[i]);
+    }
+    const double str_insert = seconds_since(start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < p.count; i++) {
+        BTree_insert(ints, hash_path(&p.data[p.offset[i]], p.offset[i + 1] - p.offset[i]));
+    }
+    const double int_insert = seconds_since(start);
+
+    const uint64_t lookups = 1 << 22;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t found = 0;
+    for (uint64_t n = 0; n < lookups; n++) {
+        const size_t i = random_key(n) % p.count;
+        found += BTree_str_find(str, &p.data[p.offset[i]], p.offset[i + 1] - p.offset[i]);
+    }
+    const double str_find = seconds_since(start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t n = 0; n < lookups; n++) {
+        const size_t i = random_key(n) % p.count;
+        found += BTree_find(ints, hash_path(&p.data[p.offset[i]], p.offset[i + 1] - p.offset[i]));
+    }
+    const double int_find = seconds_since(start);
+
+    printf("%zu filesystem paths, %.1lf bytes on average:\n", p.count, (double)p.offset[p.count] / (double)p.count);
+    printf("  string keys:     depth: %zu, insert %6.2lf Minsert/s, find %6.2lf Mfind/s, %.1lf bytes/key\n",
+           str->depth, (double)p.count / str_insert / 1e6, (double)lookups / str_find / 1e6,
+           (double)sa.size / (double)str->count);
+    printf("  hashed keys:     depth: %zu, insert %6.2lf Minsert/s, find %6.2lf Mfind/s (%zu found)\n",
+           ints->depth, (double)p.count / int_insert / 1e6, (double)lookups / int_find / 1e6, found);
+
+    arena_delete(&sa);
+    arena_delete(&ia);
+    free(p.data);
+    free(p.offset);
+}
+
+/* Sorted input through the insert loop versus bottom-up construction */
+static void bench_bulk_load(uint64_t n)
+{
+    Key* keys = malloc(n * sizeof *keys);
+    if (unlikely(!keys)) {
+        abort();
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        keys[i] = random_key(i);
+    }
+    qsort(keys, n, sizeof *keys, cmp_key);
+
+    printf("build from %"PRIu64" sorted keys:\n", n);
+    {
+        struct arena a = arena_new();
+        BTree btree;
+        BTree_init(&a, &btree);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < n; i++) {
+            BTree_insert(&btree, keys[i]);
+        }
+        print_tree_stats("insert loop:", &btree, &a, n, seconds_since(start));
+        arena_delete(&a);
+    }
+
+    const double fill_factors[] = { 0.7, 1.0 };
+    for (size_t i = 0; i < sizeof fill_factors / sizeof *fill_factors; i++) {
+        struct arena a = arena_new();
+        BTree btree;
+        BTree_init(&a, &btree);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!BTree_bulk_load(&btree, keys, n, fill_factors[i])) {
+            fprintf(stderr, "fatal: bulk load rejected sorted input\n");
+            abort();
+        }
+        char name[32];
+        snprintf(name, sizeof name, "bulk load (%.1lf):", fill_factors[i]);
+        print_tree_stats(name, &btree, &a, n, seconds_since(start));
+        arena_delete(&a);
+    }
+
+    /* up to twice as many threads as cores, to see oversubscription too */
+    const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (size_t threads = 1; threads <= 2 * (size_t)(cores > 0 ? cores : 1); threads *= 2) {
+        struct arena a = arena_new();
+        BTree btree;
+        BTree_init(&a, &btree);
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!BTree_bulk_load_parallel(&btree, keys, n, 1.0, threads)) {
+            fprintf(stderr, "fatal: bulk load rejected sorted input\n");
+            abort();
+        }
+        char name[32];
+        snprintf(name, sizeof name, "%zu threads (1.0):", threads);
+        print_tree_stats(name, &btree, &a, n, seconds_since(start));
+        arena_delete(&a);
+    }
+
+    free(keys);
+}
+
+/* Space and lookup speed of a bulk loaded tree, a static snapshot and a
+ * packed snapshot of the same `n` sorted keys. Half of the lookups are
+ * misses between neighbouring keys. */
+static void bench_packed_keys(const char* name, const Key* keys, uint64_t n)
+{
+    struct arena a = arena_new();
+    BTree btree;
+    BTree_init(&a, &btree);
+    if (!BTree_bulk_load(&btree, keys, n, 1.0)) {
+        fprintf(stderr, "fatal: bulk load rejected sorted input\n");
+        abort();
+    }
+    const size_t tree_size = a.size;
+    BTree_static s;
+    BTree_static_init_sorted(&a, &s, keys, n);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BTree_packed p;
+    BTree_packed_init_sorted(&a, &p, keys, n);
+    const double build_time = seconds_since(start);
+
+    printf("%s: packed in %.2lf s, leaves by delta bytes 1/2/4/8: %zu/%zu/%zu/%zu\n", name, build_time,
+           p.shift_count[0], p.shift_count[1], p.shift_count[2], p.shift_count[3]);
+
+    const uint64_t lookups = 1 << 22;
+    Key* x = malloc(lookups * sizeof *x);
+    if (unlikely(!x)) {
+        abort();
+    }
+    for (uint64_t i = 0; i < lookups; i++) {
+        const uint64_t k = random_key(~i) % n;
+        x[i] = keys[k] + (i & 1);
+    }
+
+    size_t hits[3] = { 0 };
+    double times[3];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t i = 0; i < lookups; i++) {
+        hits[0] += BTree_find(&btree, x[i]);
+    }
+    times[0] = seconds_since(start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t i = 0; i < lookups; i++) {
+        hits[1] += BTree_static_find(&s, x[i]);
+    }
+    times[1] = seconds_since(start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t i = 0; i < lookups; i++) {
+        hits[2] += BTree_packed_find(&p, x[i]);
+    }
+    times[2] = seconds_since(start);
+
+    if (hits[0] != hits[1] || hits[0] != hits[2]) {
+        fprintf(stderr, "fatal: packed snapshot disagrees with the tree\n");
+        abort();
+    }
+    const char*  names[3] = { "bulk loaded tree", "static snapshot", "packed snapshot" };
+    const size_t sizes[3] = { tree_size, BTree_static_size(&s), BTree_packed_size(&p) };
+    for (size_t i = 0; i < 3; i++) {
+        printf("  %-17s %6.1lf bits/key %6.2lf Mfind/s\n", names[i],
+               8.0 * (double)sizes[i] / (double)n, (double)lookups / times[i] / 1e6);
+    }
+
+    free(x);
+    arena_delete(&a);
+}
+
+static void bench_packed(uint64_t n)
+{
+    Key* keys = malloc(n * sizeof *keys);
+    if (unlikely(!keys)) {
+        abort();
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        keys[i] = random_key(i);
+    }
+    qsort(keys, n, sizeof *keys, cmp_key);
+    uint64_t unique = n > 0;
+    for (uint64_t i = 1; i < n; i++) {
+        if (keys[i] != keys[unique - 1]) {
+            keys[unique++] = keys[i];
+        }
+    }
+    bench_packed_keys("random keys", keys, unique);
+
+    /* ids handed out in order with some of them since deleted */
+    Key id = 1 << 20;
+    for (uint64_t i = 0; i < n; i++) {
+        keys[i] = id;
+        id += 1 + random_key(i) % 4;
+    }
+    bench_packed_keys("dense ids", keys, n);
+
+    free(keys);
+}
+
+/* The random insert workload of main() on a Bε-tree, and lookups with
+ * the messages still buffered and after flushing them */
+static void bench_be(uint64_t n)
+{
+    struct arena a = arena_new();
+    BTree_be t;
+    BTree_be_init(&a, &t);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t i = 0; i < n; i++) {
+        BTree_be_insert(&t, random_key(i));
+    }
+    const double insert_time = seconds_since(start);
+
+    const uint64_t lookups = 1 << 22;
+    size_t found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t i = 0; i < lookups; i++) {
+        found += BTree_be_find(&t, random_key(random_key(i) % n));
+    }
+    const double find_time = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BTree_be_flush(&t);
+    const double flush_time = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t i = 0; i < lookups; i++) {
+        found += BTree_be_find(&t, random_key(random_key(i) % n));
+    }
+    const double flushed_find_time = seconds_since(start);
+    if (found != 2 * lookups) {
+        fprintf(stderr, "fatal: Bε-tree lost keys\n");
+        abort();
+    }
+
+    printf("Bε-tree insert:    %.2lf Minsert/s (%zu flushes, height %zu, %zu leaves, arena %zu MiB)\n",
+           (double)n / insert_time / 1e6, t.flushes, t.height, t.leaf_count, a.size >> 20);
+    printf("Bε-tree find:      %.2lf Mfind/s buffered, %.2lf Mfind/s after a %.2lf s flush\n",
+           (double)lookups / find_time / 1e6, (double)lookups / flushed_find_time / 1e6, flush_time);
+    arena_delete(&a);
+}
+
+/* Inserts and lookups of a key stream that moves in small steps from one
+ * key to the next, from the root and from a finger */
+static void bench_finger(uint64_t n)
+{
+    Key* keys = malloc(n * sizeof *keys);
+    if (unlikely(!keys)) {
+        abort();
+    }
+    Key pos = random_key(0);
+    for (uint64_t i = 0; i < n; i++) {
+        pos += random_key(i) % 64;
+        keys[i] = pos;
+    }
+
+    for (int fingered = 0; fingered <= 1; fingered++) {
+        struct arena a = arena_new();
+        BTree btree;
+        BTree_init(&a, &btree);
+        BTree_finger finger = {0};
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < n; i++) {
+            if (fingered) {
+                BTree_insert_finger(&btree, keys[i], &finger);
+            } else {
+                BTree_insert(&btree, keys[i]);
+            }
+        }
+        const double insert_time = seconds_since(start);
+
+        size_t found = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < n; i++) {
+            found += fingered ? BTree_find_finger(&btree, keys[i], &finger) : BTree_find(&btree, keys[i]);
+        }
+        const double find_time = seconds_since(start);
+        if (found != n) {
+            fprintf(stderr, "fatal: lost keys\n");
+            abort();
+        }
+
+        printf("%s %.2lf Minsert/s, %.2lf Mfind/s of near-sequential keys\n",
+               fingered ? "from finger:      " : "from root:        ",
+               (double)n / insert_time / 1e6, (double)n / find_time / 1e6);
+        arena_delete(&a);
+    }
+    free(keys);
+}
+
+/* Durable inserts at several group commit sizes, against the tree alone.
+ * The log goes to $TMPDIR, or /tmp, whose sync cost is what's measured. */
+static void bench_wal(uint64_t n)
+{
+    const char* dir = getenv("TMPDIR");
+    char path[4096], wal_path[4096];
+    snprintf(path, sizeof path, "%s/bench-btree-wal", dir ? dir : "/tmp");
+    snprintf(wal_path, sizeof wal_path, "%s/bench-btree-wal.wal", dir ? dir : "/tmp");
+
+    const size_t groups[] = { 0, 1, 16, 256, 4096 };
+    for (size_t g = 0; g < sizeof groups / sizeof *groups; g++) {
+        /* a sync per insert is slow enough to need fewer of them */
+        const uint64_t count = groups[g] == 1 ? n / 64 : n;
+        struct arena a = arena_new();
+        BTree btree;
+        BTree_init(&a, &btree);
+        BTree_wal w;
+        unlink(path);
+        unlink(wal_path);
+        if (groups[g] > 0 && BTree_wal_open(&w, &btree, path, groups[g]) == -1) {
+            perror("BTree_wal_open");
+            abort();
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < count; i++) {
+            if (groups[g] > 0) {
+                BTree_wal_insert(&w, random_key(i));
+            } else {
+                BTree_insert(&btree, random_key(i));
+            }
+        }
+        if (groups[g] > 0 && BTree_wal_sync(&w) == -1) {
+            perror("BTree_wal_sync");
+            abort();
+        }
+        const double time = seconds_since(start);
+
+        if (groups[g] == 0) {
+            printf("wal: none              %8.3lf Minsert/s\n", (double)count / time / 1e6);
+        } else {
+            printf("wal: group of %4zu      %8.3lf Minsert/s, %"PRIu64" syncs\n",
+                   groups[g], (double)count / time / 1e6, w.syncs);
+            BTree_wal_close(&w);
+        }
+        arena_delete(&a);
+    }
+    unlink(path);
+    unlink(wal_path);
+}
+
+/* Merging a delta of `m` random keys into a base of `n`, and intersecting
+ * the two, against inserting or looking up the delta key by key */
+static void bench_set_ops(uint64_t n, uint64_t m)
+{
+    Key* keys = malloc((n > m ? n : m) * sizeof *keys);
+    if (unlikely(!keys)) {
+        abort();
+    }
+    struct arena a = arena_new();
+    BTree* base  = BTree_new(&a);
+    BTree* delta = BTree_new(&a);
+    for (uint64_t i = 0; i < n; i++) {
+        keys[i] = random_key(i);
+    }
+    qsort(keys, n, sizeof *keys, cmp_key);
+    BTree_bulk_load(base, keys, n, 1.0);
+    for (uint64_t i = 0; i < m; i++) {
+        BTree_insert(delta, random_key(n / 2 + i));
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BTree* merged = BTree_new(&a);
+    BTree_union(merged, base, delta, 1.0);
+    const double union_time = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BTree* copy = BTree_new(&a);
+    BTree_bulk_load(copy, keys, n, 1.0);
+    BTree_cursor c;
+    for (bool more = BTree_first(delta, &c); more; more = BTree_next(&c)) {
+        BTree_insert(copy, BTree_cursor_key(&c));
+    }
+    const double insert_time = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    BTree* common = BTree_new(&a);
+    BTree_intersect(common, base, delta, 1.0);
+    const double intersect_time = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t found = 0;
+    for (bool more = BTree_first(delta, &c); more; more = BTree_next(&c)) {
+        found += BTree_find(base, BTree_cursor_key(&c));
+    }
+    const double find_time = seconds_since(start);
+
+    printf("set ops, %"PRIu64" base and %"PRIu64" delta keys:\n", n, m);
+    printf("  union:        %.3lf s (copy and insert: %.3lf s)\n", union_time, insert_time);
+    printf("  intersection: %.3lf s (find loop: %.3lf s, %zu common)\n", intersect_time, find_time, found);
+
+    free(keys);
+    arena_delete(&a);
+}
+
+/* Cost of copy-on-write: random inserts publishing a snapshot every
+ * `batch` inserts, against a tree changed in place */
+static void bench_snapshots(uint64_t n)
+{
+    const uint64_t batches[] = { 0, 1, 16, 256, 4096 };
+    for (size_t b = 0; b < sizeof batches / sizeof *batches; b++) {
+        const uint64_t batch = batches[b];
+        struct arena a = arena_new();
+        BTree btree;
+        BTree_init(&a, &btree);
+        if (batch > 0) {
+            BTree_enable_snapshots(&btree);
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; i < n; i++) {
+            BTree_insert(&btree, random_key(i));
+            if (batch > 0 && (i + 1) % batch == 0) {
+                BTree_publish(&btree);
+            }
+        }
+        const double time = seconds_since(start);
+
+        if (batch == 0) {
+            printf("snapshots: none            %6.2lf Minsert/s, arena %zu MiB\n",
+                   (double)n / time / 1e6, a.size >> 20);
+        } else {
+            printf("snapshots: every %4" PRIu64 " inserts %6.2lf Minsert/s, arena %zu MiB\n",
+                   batch, (double)n / time / 1e6, a.size >> 20);
+            BTree_disable_snapshots(&btree);
+        }
+        arena_delete(&a);
+    }
+}
+
+enum concurrent_op { OP_INSERT_OLC, OP_INSERT_MUTEX, OP_FIND_OLC };
+
+struct concurrent_job {
+    BTree*             btree;
+    pthread_mutex_t*   mutex;
+    enum concurrent_op op;
+    uint64_t           begin;
+    uint64_t           end;
+    uint64_t           keys; /* lookups pick from the first `keys` inserted */
+};
+
+static void* concurrent_worker(void* arg)
+{
+    const struct concurrent_job* job = arg;
+    size_t found = 0;
+    for (uint64_t n = job->begin; n < job->end; n++) {
+        switch (job->op) {
+        case OP_INSERT_OLC:
+            BTree_insert_concurrent(job->btree, random_key(n));
+            break;
+        case OP_INSERT_MUTEX:
+            pthread_mutex_lock(job->mutex);
+            BTree_insert(job->btree, random_key(n));
+            pthread_mutex_unlock(job->mutex);
+            break;
+        case OP_FIND_OLC:
+            found += BTree_find_concurrent(job->btree, random_key(random_key(~n) % job->keys));
+            break;
+        }
+    }
+    volatile size_t sink = found;
+    (void)sink;
+    return NULL;
+}
+
+/* Runs `n` operations split evenly across `threads`, returns Mop/s */
+static double run_concurrent(BTree* btree, enum concurrent_op op, uint64_t n, size_t threads)
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t tids[threads];
+    struct concurrent_job jobs[threads];
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t t = 0; t < threads; t++) {
+        jobs[t] = (struct concurrent_job) {
+            .btree = btree,
+            .mutex = &mutex,
+            .op    = op,
+            .begin = n * t / threads,
+            .end   = n * (t + 1) / threads,
+            .keys  = n,
+        };
+        pthread_create(&tids[t], NULL, concurrent_worker, &jobs[t]);
+    }
+    for (size_t t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    return (double)n / seconds_since(start) / 1e6;
+}
+
+/* Insert and lookup throughput from 1 to N threads, with a global mutex
+ * around BTree_insert as the baseline */
+static void bench_concurrent(uint64_t n)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t max_threads = cpus > 0 ? (size_t)cpus : 1;
+
+    printf("concurrent (%"PRIu64" keys, %zu cpus):\n", n, max_threads);
+    printf("  threads  insert olc    insert mutex  find olc\n");
+    for (size_t threads = 1; ; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+
+        struct arena a = arena_new();
+        a.flags |= ARENA_SHARED;
+        BTree btree;
+        BTree_init(&a, &btree);
+        const double olc  = run_concurrent(&btree, OP_INSERT_OLC, n, threads);
+        const double find = run_concurrent(&btree, OP_FIND_OLC, n, threads);
+        arena_delete(&a);
+
+        a = arena_new();
+        BTree_init(&a, &btree);
+        const double mutex = run_concurrent(&btree, OP_INSERT_MUTEX, n, threads);
+        arena_delete(&a);
+
+        printf("  %7zu  %6.2lf Mop/s  %6.2lf Mop/s  %6.2lf Mop/s\n", threads, olc, mutex, find);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
+int main()
+{
+    printf("sizeof(BTree_node): %zu\n", sizeof(BTree_node));
+    printf("CACHE_LINE_SIZE: %zu\n", CACHE_LINE_SIZE);
+    printf("MAX_CHILDREN: %"KeyFmt"\n", MAX_CHILDREN);
+    printf("MAX_LEAF_KEY: %"KeyFmt"\n", MAX_LEAF_KEY);
+    printf("search kernel: %s\n", BTree_search_kernel_name(BTree_search_kernel_selected()));
+
+    bench_search_kernels();
+
+    {
+        struct arena a = arena_new();
+        BTree btree;
+        BTree_init(&a, &btree);
+
+        const uint64_t insert_ceil = 16 * 1024 * 1024;
+        int64_t insert_count = 0;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t n = 0; n < insert_ceil; n++) {
+            insert_count += BTree_insert(&btree, random_key(n));
+        }
+        const double insert_time = seconds_since(start);
+
+        //print_node(btree.root);
+
+        printf("insert throughput: %.2lf Minsert/s\n", (double)insert_ceil / insert_time / 1e6);
+        printf("arena allocated:   %zu\n", a.size);
+        printf("items inserted:    %zu\n", insert_count);
+        printf("depth:             %zu\n", btree.depth);
+        printf("nodes:             %zu\n", btree.node_count);
+        printf("items per node:    %.1lf\n", (double)insert_count / (double)btree.node_count);
+        printf("overhead per item: %.1lf%%\n", 100*((double)a.size / (double)insert_count) / (double)sizeof(Key));
+
+        bench_find(&btree, insert_ceil);
+        bench_range_scans(&btree);
+        bench_file(&btree, insert_ceil);
+        bench_static(&btree, &a, insert_ceil);
+        bench_churn(&btree, &a, insert_ceil);
+        arena_delete(&a);
+    }
+    bench_be(16 * 1024 * 1024);
+    bench_finger(16 * 1024 * 1024);
+
+    bench_bulk_load(16 * 1024 * 1024);
+    bench_packed(16 * 1024 * 1024);
+    bench_concurrent(4 * 1024 * 1024);
+    bench_snapshots(4 * 1024 * 1024);
+    bench_set_ops(4 * 1024 * 1024, 64 * 1024);
+    bench_wal(1024 * 1024);
+    bench_set_ops(4 * 1024 * 1024, 4 * 1024 * 1024);
+    bench_str(1 << 20);
+
+    return EXIT_SUCCESS;
+}
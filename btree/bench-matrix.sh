@@ -0,0 +1,32 @@
+#!/bin/sh
+# Run bench-workload binaries built at different node sizes with the same
+# arguments and print one table of throughput, latency and memory.
+#
+# usage: bench-matrix.sh [bench-workload options] -- binary...
+
+set -eu
+
+args=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+  args="$args $1"
+  shift
+done
+if [ $# -eq 0 ]; then
+  echo "usage: $0 [bench-workload options] -- binary..." >&2
+  exit 1
+fi
+shift
+
+printf "%10s %8s %6s %10s %-8s %10s %8s %8s %8s\n" \
+  node_size max_key depth bytes/key op Mop/s p50_ns p99_ns p999_ns
+for bin in "$@"; do
+  # shellcheck disable=SC2086 # args are split on purpose
+  "$bin" $args -f csv | awk -F, '
+    NR == 1 { for (i = 1; i <= NF; i++) col[$i] = i; next }
+    {
+      printf "%10s %8s %6s %10.1f %-8s %10.2f %8s %8s %8s\n",
+        $col["node_size"], $col["max_key"], $col["depth"],
+        ($col["preload"] > 0 ? $col["arena_bytes"] / $col["preload"] : 0),
+        $col["op"], $col["mops"], $col["p50_ns"], $col["p99_ns"], $col["p999_ns"]
+    }'
+done
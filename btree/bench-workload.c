@@ -0,0 +1,536 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "btree.h"
+
+/* Workload driver for BTree.
+ *
+ * Preloads a tree, then runs a mix of operations on it and reports the
+ * throughput and latency percentiles of every kind of operation, as text,
+ * CSV or JSON. Run with -h for the options. */
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+#define ARRAY_LEN(x) (sizeof x) / sizeof (*(x))
+
+static Key random_key(uint64_t n)
+{
+    const Key PRIME = 0x9e3779b97f4a7c15ULL;
+    n = (n ^ (n >> 30)) * PRIME;
+    n = (n ^ (n >> 27)) * PRIME;
+    n = n ^ (n >> 31);
+    return n;
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* ==== Latency histogram ==== */
+
+/* Log-linear buckets: 16 per power of two, so every bucket is within
+ * about 6% of the values in it, from 1 ns to the full 64-bit range. */
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static size_t hist_bucket(uint64_t ns)
+{
+    if (ns < HIST_SUB) {
+        return ns;
+    }
+    const size_t e = 63 - __builtin_clzll(ns);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + ((ns >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* the largest value that lands in bucket `b` */
+static uint64_t hist_bucket_max(size_t b)
+{
+    if (b < HIST_SUB) {
+        return b;
+    }
+    const size_t e = b / HIST_SUB + HIST_SUB_BITS - 1;
+    const uint64_t low = ((uint64_t)(HIST_SUB + b % HIST_SUB)) << (e - HIST_SUB_BITS);
+    return low + (1ULL << (e - HIST_SUB_BITS)) - 1;
+}
+
+static void hist_add(struct histogram* h, uint64_t ns)
+{
+    h->count++;
+    h->total_ns += ns;
+    h->max_ns = ns > h->max_ns ? ns : h->max_ns;
+    h->buckets[hist_bucket(ns)]++;
+}
+
+static uint64_t hist_percentile(const struct histogram* h, double p)
+{
+    const uint64_t rank = (uint64_t)ceil(p * (double)h->count);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank && seen > 0) {
+            const uint64_t v = hist_bucket_max(b);
+            return v < h->max_ns ? v : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+/* ==== Key distributions ==== */
+
+enum distribution { DIST_UNIFORM, DIST_SEQUENTIAL, DIST_ZIPF, DIST_CLUSTERED };
+
+static const char* distribution_names[] = {
+    [DIST_UNIFORM]    = "uniform",
+    [DIST_SEQUENTIAL] = "sequential",
+    [DIST_ZIPF]       = "zipf",
+    [DIST_CLUSTERED]  = "clustered",
+};
+
+/* keys in a cluster of the clustered distribution */
+#define CLUSTER_SIZE 64
+
+/* Every key is identified by its insertion index i. Operations pick an
+ * index among the keys inserted so far and map it to the key. */
+struct keyspace {
+    enum distribution dist;
+    uint64_t          rng;
+    uint64_t          next_seq;
+    /* Zipfian ranks, see Gray et al., "Quickly Generating Billion-Record
+     * Synthetic Databases" */
+    double            theta;
+    double            zeta_n;
+    double            alpha;
+    double            eta;
+    uint64_t          zipf_n;
+};
+
+static uint64_t next_random(struct keyspace* ks)
+{
+    return random_key(ks->rng++);
+}
+
+static double next_unit(struct keyspace* ks)
+{
+    return (double)(next_random(ks) >> 11) * 0x1.0p-53;
+}
+
+static Key index_to_key(const struct keyspace* ks, uint64_t i)
+{
+    switch (ks->dist) {
+    case DIST_SEQUENTIAL:
+        return i + 1;
+    case DIST_CLUSTERED:
+        /* runs of consecutive keys starting at random points */
+        return (random_key(i / CLUSTER_SIZE) & ~(Key)(CLUSTER_SIZE - 1)) + i % CLUSTER_SIZE;
+    case DIST_UNIFORM:
+    case DIST_ZIPF:
+        break;
+    }
+    return random_key(i);
+}
+
+static void zipf_init(struct keyspace* ks, uint64_t n, double theta)
+{
+    double zeta_n = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+        zeta_n += 1.0 / pow((double)i, theta);
+    }
+    const double zeta_2 = 1.0 + 1.0 / pow(2.0, theta);
+    ks->theta  = theta;
+    ks->zipf_n = n;
+    ks->zeta_n = zeta_n;
+    ks->alpha  = 1.0 / (1.0 - theta);
+    ks->eta    = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta_2 / zeta_n);
+}
+
+static uint64_t zipf_next(struct keyspace* ks)
+{
+    const double u  = next_unit(ks);
+    const double uz = u * ks->zeta_n;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < 1.0 + pow(0.5, ks->theta)) {
+        return 1;
+    }
+    return (uint64_t)((double)ks->zipf_n * pow(ks->eta * u - ks->eta + 1.0, ks->alpha));
+}
+
+/* An index among the `n` keys inserted so far */
+static uint64_t pick_index(struct keyspace* ks, uint64_t n)
+{
+    switch (ks->dist) {
+    case DIST_SEQUENTIAL:
+        return ks->next_seq++ % n;
+    case DIST_ZIPF:
+        /* rank 0 is the hottest key, spread the ranks over the indexes so
+         * hot keys aren't all neighbours in the tree */
+        return random_key(zipf_next(ks)) % n;
+    case DIST_UNIFORM:
+    case DIST_CLUSTERED:
+        break;
+    }
+    return next_random(ks) % n;
+}
+
+/* ==== Operations ==== */
+
+enum op { OP_INSERT, OP_FIND, OP_SCAN, OP_REMOVE, OP_COUNT };
+
+static const char* op_names[] = {
+    [OP_INSERT] = "insert",
+    [OP_FIND]   = "find",
+    [OP_SCAN]   = "scan",
+    [OP_REMOVE] = "remove",
+};
+
+struct config {
+    uint64_t          preload;
+    uint64_t          ops;
+    unsigned          mix[OP_COUNT]; /* relative weights */
+    size_t            scan_len;
+    enum distribution dist;
+    double            zipf_theta;
+    size_t            cold_bytes;    /* cache flush between operations, 0 for warm */
+    const char*       kernel;
+    const char*       format;
+    uint64_t          seed;
+};
+
+struct result {
+    struct histogram hist[OP_COUNT];
+    uint64_t         hits[OP_COUNT];
+    double           preload_s;
+    double           run_s;
+    uint64_t         timer_ns;
+    size_t           depth;
+    size_t           nodes;
+    size_t           arena_bytes;
+};
+
+/* Evict the tree from the caches by streaming through a buffer that is
+ * larger than them */
+static void flush_caches(volatile char* buf, size_t size)
+{
+    for (size_t i = 0; i < size; i += CACHE_LINE_SIZE) {
+        buf[i]++;
+    }
+}
+
+/* The smallest back to back difference of the clock, which is included in
+ * every latency */
+static uint64_t timer_overhead(void)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        const uint64_t a = now_ns();
+        const uint64_t b = now_ns();
+        best = b - a < best ? b - a : best;
+    }
+    return best;
+}
+
+static bool run(const struct config* cfg, struct result* r)
+{
+    memset(r, 0, sizeof *r);
+    r->timer_ns = timer_overhead();
+
+    struct keyspace ks = { .dist = cfg->dist, .rng = cfg->seed };
+    if (cfg->dist == DIST_ZIPF) {
+        const uint64_t n = cfg->preload + cfg->ops;
+        zipf_init(&ks, n > 2 ? n : 2, cfg->zipf_theta);
+    }
+
+    struct arena a = arena_new();
+    if (arena_new_failed(&a)) {
+        return false;
+    }
+    BTree btree;
+    BTree_init(&a, &btree);
+
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < cfg->preload; i++) {
+        BTree_insert(&btree, index_to_key(&ks, i));
+    }
+    r->preload_s = (double)(now_ns() - start) / 1e9;
+
+    unsigned total_weight = 0;
+    for (size_t op = 0; op < OP_COUNT; op++) {
+        total_weight += cfg->mix[op];
+    }
+
+    char* flush = NULL;
+    if (cfg->cold_bytes > 0) {
+        flush = malloc(cfg->cold_bytes);
+        if (unlikely(!flush)) {
+            abort();
+        }
+        memset(flush, 0, cfg->cold_bytes);
+    }
+
+    uint64_t inserted = cfg->preload;
+    uint64_t run_ns   = 0;
+    for (uint64_t n = 0; n < cfg->ops; n++) {
+        unsigned pick = next_random(&ks) % total_weight;
+        enum op op = 0;
+        while (pick >= cfg->mix[op]) {
+            pick -= cfg->mix[op++];
+        }
+        /* with nothing inserted yet there is nothing to look for */
+        if (inserted == 0) {
+            op = OP_INSERT;
+        }
+
+        const Key key = op == OP_INSERT ? index_to_key(&ks, inserted)
+                                        : index_to_key(&ks, pick_index(&ks, inserted));
+        if (flush) {
+            flush_caches(flush, cfg->cold_bytes);
+        }
+
+        bool hit = false;
+        start = now_ns();
+        switch (op) {
+        case OP_INSERT:
+            hit = BTree_insert(&btree, key);
+            break;
+        case OP_FIND:
+            hit = BTree_find(&btree, key);
+            break;
+        case OP_SCAN: {
+            BTree_cursor c;
+            size_t i = 0;
+            for (bool more = BTree_lower_bound(&btree, key, &c); more && i < cfg->scan_len; i++) {
+                more = BTree_next(&c);
+            }
+            hit = i == cfg->scan_len;
+            break;
+        }
+        case OP_REMOVE:
+            hit = BTree_remove(&btree, key);
+            break;
+        case OP_COUNT:
+            break;
+        }
+        const uint64_t ns = now_ns() - start;
+
+        if (op == OP_INSERT) {
+            inserted++;
+        }
+        run_ns += ns;
+        hist_add(&r->hist[op], ns);
+        r->hits[op] += hit;
+    }
+    r->run_s = (double)run_ns / 1e9;
+
+    r->depth       = btree.depth;
+    r->nodes       = btree.node_count;
+    r->arena_bytes = a.size;
+
+    free(flush);
+    arena_delete(&a);
+    return true;
+}
+
+/* ==== Output ==== */
+
+static void print_text(const struct config* cfg, const struct result* r)
+{
+    printf("kernel: %s, node: %zu bytes, keys per node: %zu, distribution: %s, cache: %s\n",
+           BTree_search_kernel_name(BTree_search_kernel_selected()), sizeof (BTree_node),
+           (size_t)MAX_KEY, distribution_names[cfg->dist], cfg->cold_bytes ? "cold" : "warm");
+    printf("preload: %"PRIu64" keys in %.2lf s, depth: %zu, nodes: %zu, arena: %zu bytes\n",
+           cfg->preload, r->preload_s, r->depth, r->nodes, r->arena_bytes);
+    printf("%"PRIu64" operations in %.2lf s, %.2lf Mop/s, timer overhead %"PRIu64" ns\n",
+           cfg->ops, r->run_s, (double)cfg->ops / r->run_s / 1e6, r->timer_ns);
+    printf("  %-8s %10s %8s %10s %10s %10s %10s %10s\n",
+           "op", "count", "hit%", "Mop/s", "p50 ns", "p99 ns", "p999 ns", "max ns");
+    for (size_t op = 0; op < OP_COUNT; op++) {
+        const struct histogram* h = &r->hist[op];
+        if (h->count == 0) {
+            continue;
+        }
+        printf("  %-8s %10"PRIu64" %7.1lf%% %10.2lf %10"PRIu64" %10"PRIu64" %10"PRIu64" %10"PRIu64"\n",
+               op_names[op], h->count, 100.0 * (double)r->hits[op] / (double)h->count,
+               (double)h->count / ((double)h->total_ns / 1e9) / 1e6,
+               hist_percentile(h, 0.5), hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max_ns);
+    }
+}
+
+static void print_csv(const struct config* cfg, const struct result* r)
+{
+    printf("kernel,node_size,max_key,distribution,cache,preload,op,count,hits,mops,p50_ns,p99_ns,p999_ns,max_ns,depth,arena_bytes\n");
+    for (size_t op = 0; op < OP_COUNT; op++) {
+        const struct histogram* h = &r->hist[op];
+        if (h->count == 0) {
+            continue;
+        }
+        printf("%s,%zu,%zu,%s,%s,%"PRIu64",%s,%"PRIu64",%"PRIu64",%.4lf,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%zu,%zu\n",
+               BTree_search_kernel_name(BTree_search_kernel_selected()), sizeof (BTree_node),
+               (size_t)MAX_KEY, distribution_names[cfg->dist], cfg->cold_bytes ? "cold" : "warm",
+               cfg->preload, op_names[op], h->count, r->hits[op],
+               (double)h->count / ((double)h->total_ns / 1e9) / 1e6,
+               hist_percentile(h, 0.5), hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max_ns,
+               r->depth, r->arena_bytes);
+    }
+}
+
+static void print_json(const struct config* cfg, const struct result* r)
+{
+    printf("{\"kernel\":\"%s\",\"node_size\":%zu,\"max_key\":%zu,\"cache_line_size\":%zu,"
+           "\"distribution\":\"%s\",\"cache\":\"%s\",\"preload\":%"PRIu64",\"ops\":%"PRIu64","
+           "\"scan_len\":%zu,\"seed\":%"PRIu64",\"preload_s\":%.6lf,\"run_s\":%.6lf,"
+           "\"timer_ns\":%"PRIu64",\"depth\":%zu,\"nodes\":%zu,\"arena_bytes\":%zu,\"results\":[",
+           BTree_search_kernel_name(BTree_search_kernel_selected()), sizeof (BTree_node),
+           (size_t)MAX_KEY, (size_t)CACHE_LINE_SIZE, distribution_names[cfg->dist],
+           cfg->cold_bytes ? "cold" : "warm", cfg->preload, cfg->ops, cfg->scan_len, cfg->seed,
+           r->preload_s, r->run_s, r->timer_ns, r->depth, r->nodes, r->arena_bytes);
+    bool first = true;
+    for (size_t op = 0; op < OP_COUNT; op++) {
+        const struct histogram* h = &r->hist[op];
+        if (h->count == 0) {
+            continue;
+        }
+        printf("%s{\"op\":\"%s\",\"count\":%"PRIu64",\"hits\":%"PRIu64",\"mops\":%.4lf,"
+               "\"p50_ns\":%"PRIu64",\"p99_ns\":%"PRIu64",\"p999_ns\":%"PRIu64",\"max_ns\":%"PRIu64"}",
+               first ? "" : ",", op_names[op], h->count, r->hits[op],
+               (double)h->count / ((double)h->total_ns / 1e9) / 1e6,
+               hist_percentile(h, 0.5), hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max_ns);
+        first = false;
+    }
+    printf("]}\n");
+}
+
+/* ==== Options ==== */
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -n KEYS     keys inserted before the run (default 1000000)\n"
+        "  -o OPS      operations in the run (default 1000000)\n"
+        "  -m MIX      weights of insert,find,scan,remove (default 0,100,0,0)\n"
+        "  -l LEN      keys read by a scan (default 100)\n"
+        "  -d DIST     uniform, sequential, zipf or clustered (default uniform)\n"
+        "  -z THETA    zipf skew, below 1 (default 0.99)\n"
+        "  -c MIB      cold cache, stream MIB of memory between operations\n"
+        "  -k KERNEL   node search kernel (default: picked from cpuid)\n"
+        "  -f FORMAT   text, csv or json (default text)\n"
+        "  -s SEED     seed of the operation sequence (default 1)\n",
+        argv0);
+}
+
+static bool parse_mix(const char* s, unsigned mix[OP_COUNT])
+{
+    char* end;
+    for (size_t op = 0; op < OP_COUNT; op++) {
+        mix[op] = strtoul(s, &end, 10);
+        if (end == s || (op + 1 < OP_COUNT && *end != ',')) {
+            return false;
+        }
+        s = end + 1;
+    }
+    return *end == '\0' && mix[OP_INSERT] + mix[OP_FIND] + mix[OP_SCAN] + mix[OP_REMOVE] > 0;
+}
+
+static bool select_kernel(const char* name)
+{
+    for (size_t i = 0; i < BTree_search_kernel_count(); i++) {
+        if (strcmp(BTree_search_kernel_name(i), name) == 0) {
+            return BTree_search_kernel_select(i);
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    struct config cfg = {
+        .preload    = 1000 * 1000,
+        .ops        = 1000 * 1000,
+        .mix        = { [OP_FIND] = 100 },
+        .scan_len   = 100,
+        .dist       = DIST_UNIFORM,
+        .zipf_theta = 0.99,
+        .format     = "text",
+        .seed       = 1,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:m:l:d:z:c:k:f:s:h")) != -1) {
+        switch (opt) {
+        case 'n': cfg.preload    = strtoull(optarg, NULL, 10); break;
+        case 'o': cfg.ops        = strtoull(optarg, NULL, 10); break;
+        case 'l': cfg.scan_len   = strtoull(optarg, NULL, 10); break;
+        case 'z': cfg.zipf_theta = strtod(optarg, NULL); break;
+        case 'c': cfg.cold_bytes = strtoull(optarg, NULL, 10) << 20; break;
+        case 'k': cfg.kernel     = optarg; break;
+        case 'f': cfg.format     = optarg; break;
+        case 's': cfg.seed       = strtoull(optarg, NULL, 10); break;
+        case 'm':
+            if (!parse_mix(optarg, cfg.mix)) {
+                fprintf(stderr, "bad mix: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd': {
+            size_t d = 0;
+            while (d < ARRAY_LEN(distribution_names) && strcmp(distribution_names[d], optarg) != 0) {
+                d++;
+            }
+            if (d == ARRAY_LEN(distribution_names)) {
+                fprintf(stderr, "unknown distribution: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            cfg.dist = d;
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (cfg.zipf_theta <= 0 || cfg.zipf_theta >= 1) {
+        fprintf(stderr, "zipf theta must be in (0, 1)\n");
+        return EXIT_FAILURE;
+    }
+    if (cfg.kernel && !select_kernel(cfg.kernel)) {
+        fprintf(stderr, "search kernel %s is unknown or unsupported\n", cfg.kernel);
+        return EXIT_FAILURE;
+    }
+    void (*print)(const struct config*, const struct result*) =
+        strcmp(cfg.format, "text") == 0 ? print_text :
+        strcmp(cfg.format, "csv")  == 0 ? print_csv  :
+        strcmp(cfg.format, "json") == 0 ? print_json : NULL;
+    if (!print) {
+        fprintf(stderr, "unknown format: %s\n", cfg.format);
+        return EXIT_FAILURE;
+    }
+
+    struct result r;
+    if (!run(&cfg, &r)) {
+        fprintf(stderr, "fatal: could not create arena\n");
+        return EXIT_FAILURE;
+    }
+    print(&cfg, &r);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,637 @@
+#include "arena.h"
+#include "bptree.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+
+/* Separators are inclusive upper bounds: children[i] holds the keys in
+ * (keys[i-1], keys[i]], so the child to descend into is the lower bound of
+ * the key among the separators and the SIMD node search can be reused.
+ *
+ * Removes don't tighten separators, a separator only has to be at least
+ * the largest key in its child. Nodes that merge away stay in the arena. */
+
+#define LEAF_MIN     (BTREE_LEAF_MAX / 2)
+#define INTERNAL_MIN ((BTREE_INTERNAL_MAX_KEY - 1) / 2)
+
+/* The internal nodes descended through and the child taken in each, root
+ * first */
+struct BTREE_METHOD(step) {
+    BTREE_INTERNAL_T* node;
+    size_t            index;
+};
+
+static inline size_t BTREE_METHOD(degree)(const void* node, size_t height)
+{
+    if (height == 0) {
+        return ((const BTREE_LEAF_T*)node)->degree;
+    }
+    return ((const BTREE_INTERNAL_T*)node)->degree;
+}
+
+#ifdef BTREE_AUGMENT
+/* Keys under children[from, to) of `node` */
+static size_t BTREE_METHOD(count_children)(const BTREE_INTERNAL_T* node, size_t from, size_t to)
+{
+    size_t count = 0;
+    for (size_t i = from; i < to; i++) {
+        count += node->counts[i];
+    }
+    return count;
+}
+#endif
+
+#ifdef BTREE_SUM
+static BTREE_SUM BTREE_METHOD(sum_children)(const BTREE_INTERNAL_T* node, size_t from, size_t to)
+{
+    BTREE_SUM sum = 0;
+    for (size_t i = from; i < to; i++) {
+        sum += node->sums[i];
+    }
+    return sum;
+}
+
+static BTREE_SUM BTREE_METHOD(sum_vals)(const BTREE_LEAF_T* leaf, size_t from, size_t to)
+{
+    BTREE_SUM sum = 0;
+    for (size_t i = from; i < to; i++) {
+        sum += leaf->vals[i];
+    }
+    return sum;
+}
+
+/* Sum of the values under a whole node */
+static BTREE_SUM BTREE_METHOD(node_sum)(const void* node, size_t height)
+{
+    if (height == 0) {
+        const BTREE_LEAF_T* leaf = node;
+        return BTREE_METHOD(sum_vals)(leaf, 0, leaf->degree);
+    }
+    const BTREE_INTERNAL_T* in = node;
+    return BTREE_METHOD(sum_children)(in, 0, in->degree + 1u);
+}
+#endif
+
+static BTREE_LEAF_T* BTREE_METHOD(new_leaf)(BTREE_T* btree)
+{
+    BTREE_LEAF_T* leaf = arena_alloc(btree->arena, sizeof *leaf);
+    if (unlikely(!leaf)) {
+        abort();
+    }
+    leaf->degree = 0;
+    leaf->prev   = NULL;
+    leaf->next   = NULL;
+    return leaf;
+}
+
+static BTREE_INTERNAL_T* BTREE_METHOD(new_internal)(BTREE_T* btree)
+{
+    BTREE_INTERNAL_T* node = arena_alloc(btree->arena, sizeof *node);
+    if (unlikely(!node)) {
+        abort();
+    }
+    node->degree = 0;
+    return node;
+}
+
+static inline bool BTREE_METHOD(is_full)(const void* node, size_t height)
+{
+    if (height == 0) {
+        return ((const BTREE_LEAF_T*)node)->degree == BTREE_LEAF_MAX;
+    }
+    return ((const BTREE_INTERNAL_T*)node)->degree == BTREE_INTERNAL_MAX_KEY;
+}
+
+/* Split the full children[i] of `parent`, which is `height` levels above
+ * the leaves, and add the new right half and its separator to `parent`. */
+static void BTREE_METHOD(split_child)(BTREE_T* btree, BTREE_INTERNAL_T* parent, size_t i, size_t height)
+{
+    K     sep;
+    void* right;
+#ifdef BTREE_AUGMENT
+    size_t right_count;
+#endif
+#ifdef BTREE_SUM
+    BTREE_SUM right_sum;
+#endif
+
+    if (height == 0) {
+        /* the separator is copied up, the key stays in the left leaf */
+        BTREE_LEAF_T* l = parent->children[i];
+        BTREE_LEAF_T* r = BTREE_METHOD(new_leaf)(btree);
+        const size_t half = l->degree / 2;
+
+        r->degree = l->degree - half;
+        memcpy(r->keys, &l->keys[half], r->degree * sizeof r->keys[0]);
+        memcpy(r->vals, &l->vals[half], r->degree * sizeof r->vals[0]);
+        l->degree = half;
+
+        r->prev = l;
+        r->next = l->next;
+        if (l->next) {
+            l->next->prev = r;
+        } else {
+            btree->last = r;
+        }
+        l->next = r;
+
+        sep   = l->keys[half - 1];
+        right = r;
+#ifdef BTREE_AUGMENT
+        right_count = r->degree;
+#endif
+#ifdef BTREE_SUM
+        right_sum = BTREE_METHOD(sum_vals)(r, 0, r->degree);
+#endif
+    } else {
+        /* the middle separator moves up */
+        BTREE_INTERNAL_T* l = parent->children[i];
+        BTREE_INTERNAL_T* r = BTREE_METHOD(new_internal)(btree);
+        const size_t mid = BTREE_INTERNAL_MAX_KEY / 2;
+
+        r->degree = l->degree - mid - 1;
+        memcpy(r->keys, &l->keys[mid + 1], r->degree * sizeof r->keys[0]);
+        memcpy(r->children, &l->children[mid + 1], (r->degree + 1) * sizeof r->children[0]);
+#ifdef BTREE_AUGMENT
+        memcpy(r->counts, &l->counts[mid + 1], (r->degree + 1) * sizeof r->counts[0]);
+        right_count = BTREE_METHOD(count_children)(r, 0, r->degree + 1u);
+#endif
+#ifdef BTREE_SUM
+        memcpy(r->sums, &l->sums[mid + 1], (r->degree + 1) * sizeof r->sums[0]);
+        right_sum = BTREE_METHOD(sum_children)(r, 0, r->degree + 1u);
+#endif
+        l->degree = mid;
+
+        sep   = l->keys[mid];
+        right = r;
+    }
+
+    memmove(&parent->keys[i+1], &parent->keys[i], (parent->degree - i) * sizeof parent->keys[0]);
+    memmove(&parent->children[i+2], &parent->children[i+1], (parent->degree - i) * sizeof parent->children[0]);
+    parent->keys[i]       = sep;
+    parent->children[i+1] = right;
+#ifdef BTREE_AUGMENT
+    memmove(&parent->counts[i+2], &parent->counts[i+1], (parent->degree - i) * sizeof parent->counts[0]);
+    parent->counts[i]  -= right_count;
+    parent->counts[i+1] = right_count;
+#endif
+#ifdef BTREE_SUM
+    memmove(&parent->sums[i+2], &parent->sums[i+1], (parent->degree - i) * sizeof parent->sums[0]);
+    parent->sums[i]  -= right_sum;
+    parent->sums[i+1] = right_sum;
+#endif
+    parent->degree++;
+}
+
+static BTREE_LEAF_T* BTREE_METHOD(find_leaf)(const BTREE_T* btree, K key)
+{
+    void* node = btree->root;
+    for (size_t height = btree->depth; height > 0; height--) {
+        const BTREE_INTERNAL_T* in = node;
+        node = in->children[BTREE_KEYS_LOWER_BOUND(in->keys, in->degree, key)];
+    }
+    return node;
+}
+
+void BTREE_METHOD(init)(struct arena* a, BTREE_T* btree)
+{
+    *btree = (BTREE_T) {
+        .arena = a,
+        .depth = 0,
+        .count = 0,
+    };
+    BTREE_LEAF_T* leaf = BTREE_METHOD(new_leaf)(btree);
+    btree->root  = leaf;
+    btree->first = leaf;
+    btree->last  = leaf;
+}
+
+BTREE_T* BTREE_METHOD(new)(struct arena* a)
+{
+    BTREE_T* btree = arena_alloc(a, sizeof *btree);
+    if (unlikely(!btree)) {
+        abort();
+    }
+    BTREE_METHOD(init)(a, btree);
+    return btree;
+}
+
+/* Find the slot for `key`, inserting it with a zeroed value if it is new,
+ * and record the path to its leaf in `path`. Sets `is_new` if the key was
+ * inserted, in which case the counts on the path already include it. */
+static T* BTREE_METHOD(insert_slot)(BTREE_T* btree, K key, bool* is_new, struct BTREE_METHOD(step)* path)
+{
+    if (unlikely(BTREE_METHOD(is_full)(btree->root, btree->depth))) {
+        BTREE_INTERNAL_T* new_root = BTREE_METHOD(new_internal)(btree);
+        new_root->children[0] = btree->root;
+#ifdef BTREE_AUGMENT
+        new_root->counts[0] = btree->count;
+#endif
+#ifdef BTREE_SUM
+        new_root->sums[0] = BTREE_METHOD(node_sum)(btree->root, btree->depth);
+#endif
+        BTREE_METHOD(split_child)(btree, new_root, 0, btree->depth);
+        btree->root = new_root;
+        btree->depth++;
+    }
+
+    /* split full nodes on the way down so there is always room to insert
+     * into the leaf without walking back up */
+    void* node = btree->root;
+    for (size_t height = btree->depth; height > 0; height--) {
+        BTREE_INTERNAL_T* in = node;
+        size_t i = BTREE_KEYS_LOWER_BOUND(in->keys, in->degree, key);
+        if (unlikely(BTREE_METHOD(is_full)(in->children[i], height - 1))) {
+            BTREE_METHOD(split_child)(btree, in, i, height - 1);
+            if (key > in->keys[i]) {
+                i++;
+            }
+        }
+        path[btree->depth - height] = (struct BTREE_METHOD(step)) { .node = in, .index = i };
+        node = in->children[i];
+    }
+
+    BTREE_LEAF_T* leaf = node;
+    const size_t i = BTREE_KEYS_LOWER_BOUND(leaf->keys, leaf->degree, key);
+    if (i < leaf->degree && leaf->keys[i] == key) {
+        *is_new = false;
+        return &leaf->vals[i];
+    }
+
+    memmove(&leaf->keys[i+1], &leaf->keys[i], (leaf->degree - i) * sizeof leaf->keys[0]);
+    memmove(&leaf->vals[i+1], &leaf->vals[i], (leaf->degree - i) * sizeof leaf->vals[0]);
+    leaf->keys[i] = key;
+    memset(&leaf->vals[i], 0, sizeof leaf->vals[i]);
+    leaf->degree++;
+    btree->count++;
+#ifdef BTREE_AUGMENT
+    for (size_t d = 0; d < btree->depth; d++) {
+        path[d].node->counts[path[d].index]++;
+    }
+#endif
+
+    *is_new = true;
+    return &leaf->vals[i];
+}
+
+#ifndef BTREE_SUM
+T* BTREE_METHOD(insert)(BTREE_T* btree, K key)
+{
+    struct BTREE_METHOD(step) path[BTREE_MAX_DEPTH];
+    bool is_new;
+    return BTREE_METHOD(insert_slot)(btree, key, &is_new, path);
+}
+#endif
+
+bool BTREE_METHOD(put)(BTREE_T* btree, K key, T val)
+{
+    struct BTREE_METHOD(step) path[BTREE_MAX_DEPTH];
+    bool is_new;
+    T* slot = BTREE_METHOD(insert_slot)(btree, key, &is_new, path);
+#ifdef BTREE_SUM
+    const BTREE_SUM delta = (BTREE_SUM)val - (BTREE_SUM)*slot;
+    for (size_t d = 0; d < btree->depth; d++) {
+        path[d].node->sums[path[d].index] += delta;
+    }
+#endif
+    *slot = val;
+    return is_new;
+}
+
+/* Move the last entry of children[i-1] of `parent` to the front of
+ * children[i], which is `height` levels above the leaves */
+static void BTREE_METHOD(borrow_left)(BTREE_INTERNAL_T* parent, size_t i, size_t height)
+{
+#ifdef BTREE_AUGMENT
+    size_t moved_count;
+#endif
+#ifdef BTREE_SUM
+    BTREE_SUM moved_sum;
+#endif
+    if (height == 0) {
+        BTREE_LEAF_T* l = parent->children[i - 1];
+        BTREE_LEAF_T* n = parent->children[i];
+        memmove(&n->keys[1], &n->keys[0], n->degree * sizeof n->keys[0]);
+        memmove(&n->vals[1], &n->vals[0], n->degree * sizeof n->vals[0]);
+        l->degree--;
+        n->keys[0] = l->keys[l->degree];
+        n->vals[0] = l->vals[l->degree];
+        n->degree++;
+        parent->keys[i - 1] = l->keys[l->degree - 1];
+#ifdef BTREE_AUGMENT
+        moved_count = 1;
+#endif
+#ifdef BTREE_SUM
+        moved_sum = n->vals[0];
+#endif
+    } else {
+        /* the separator rotates down and the left node's last key up */
+        BTREE_INTERNAL_T* l = parent->children[i - 1];
+        BTREE_INTERNAL_T* n = parent->children[i];
+        memmove(&n->keys[1], &n->keys[0], n->degree * sizeof n->keys[0]);
+        memmove(&n->children[1], &n->children[0], (n->degree + 1) * sizeof n->children[0]);
+        n->keys[0]     = parent->keys[i - 1];
+        n->children[0] = l->children[l->degree];
+#ifdef BTREE_AUGMENT
+        memmove(&n->counts[1], &n->counts[0], (n->degree + 1) * sizeof n->counts[0]);
+        n->counts[0] = moved_count = l->counts[l->degree];
+#endif
+#ifdef BTREE_SUM
+        memmove(&n->sums[1], &n->sums[0], (n->degree + 1) * sizeof n->sums[0]);
+        n->sums[0] = moved_sum = l->sums[l->degree];
+#endif
+        n->degree++;
+        parent->keys[i - 1] = l->keys[l->degree - 1];
+        l->degree--;
+    }
+#ifdef BTREE_AUGMENT
+    parent->counts[i - 1] -= moved_count;
+    parent->counts[i]     += moved_count;
+#endif
+#ifdef BTREE_SUM
+    parent->sums[i - 1] -= moved_sum;
+    parent->sums[i]     += moved_sum;
+#endif
+}
+
+/* Move the first entry of children[i+1] of `parent` to the end of
+ * children[i], which is `height` levels above the leaves */
+static void BTREE_METHOD(borrow_right)(BTREE_INTERNAL_T* parent, size_t i, size_t height)
+{
+#ifdef BTREE_AUGMENT
+    size_t moved_count;
+#endif
+#ifdef BTREE_SUM
+    BTREE_SUM moved_sum;
+#endif
+    if (height == 0) {
+        BTREE_LEAF_T* n = parent->children[i];
+        BTREE_LEAF_T* r = parent->children[i + 1];
+        n->keys[n->degree] = r->keys[0];
+        n->vals[n->degree] = r->vals[0];
+        n->degree++;
+        r->degree--;
+        memmove(&r->keys[0], &r->keys[1], r->degree * sizeof r->keys[0]);
+        memmove(&r->vals[0], &r->vals[1], r->degree * sizeof r->vals[0]);
+        parent->keys[i] = n->keys[n->degree - 1];
+#ifdef BTREE_AUGMENT
+        moved_count = 1;
+#endif
+#ifdef BTREE_SUM
+        moved_sum = n->vals[n->degree - 1];
+#endif
+    } else {
+        BTREE_INTERNAL_T* n = parent->children[i];
+        BTREE_INTERNAL_T* r = parent->children[i + 1];
+        n->keys[n->degree]         = parent->keys[i];
+        n->children[n->degree + 1] = r->children[0];
+#ifdef BTREE_AUGMENT
+        n->counts[n->degree + 1] = moved_count = r->counts[0];
+        memmove(&r->counts[0], &r->counts[1], r->degree * sizeof r->counts[0]);
+#endif
+#ifdef BTREE_SUM
+        n->sums[n->degree + 1] = moved_sum = r->sums[0];
+        memmove(&r->sums[0], &r->sums[1], r->degree * sizeof r->sums[0]);
+#endif
+        n->degree++;
+        parent->keys[i] = r->keys[0];
+        memmove(&r->keys[0], &r->keys[1], (r->degree - 1) * sizeof r->keys[0]);
+        memmove(&r->children[0], &r->children[1], r->degree * sizeof r->children[0]);
+        r->degree--;
+    }
+#ifdef BTREE_AUGMENT
+    parent->counts[i]     += moved_count;
+    parent->counts[i + 1] -= moved_count;
+#endif
+#ifdef BTREE_SUM
+    parent->sums[i]     += moved_sum;
+    parent->sums[i + 1] -= moved_sum;
+#endif
+}
+
+/* Merge children[i+1] of `parent` into children[i], which are `height`
+ * levels above the leaves, and drop the separator between them */
+static void BTREE_METHOD(merge)(BTREE_T* btree, BTREE_INTERNAL_T* parent, size_t i, size_t height)
+{
+    if (height == 0) {
+        BTREE_LEAF_T* l = parent->children[i];
+        BTREE_LEAF_T* r = parent->children[i + 1];
+        memcpy(&l->keys[l->degree], r->keys, r->degree * sizeof r->keys[0]);
+        memcpy(&l->vals[l->degree], r->vals, r->degree * sizeof r->vals[0]);
+        l->degree += r->degree;
+        l->next = r->next;
+        if (r->next) {
+            r->next->prev = l;
+        } else {
+            btree->last = l;
+        }
+    } else {
+        BTREE_INTERNAL_T* l = parent->children[i];
+        BTREE_INTERNAL_T* r = parent->children[i + 1];
+        l->keys[l->degree] = parent->keys[i];
+        memcpy(&l->keys[l->degree + 1], r->keys, r->degree * sizeof r->keys[0]);
+        memcpy(&l->children[l->degree + 1], r->children, (r->degree + 1) * sizeof r->children[0]);
+#ifdef BTREE_AUGMENT
+        memcpy(&l->counts[l->degree + 1], r->counts, (r->degree + 1) * sizeof r->counts[0]);
+#endif
+#ifdef BTREE_SUM
+        memcpy(&l->sums[l->degree + 1], r->sums, (r->degree + 1) * sizeof r->sums[0]);
+#endif
+        l->degree += r->degree + 1;
+    }
+
+    /* children[i] now ends where children[i+1] did */
+    memmove(&parent->keys[i], &parent->keys[i + 1], (parent->degree - i - 1) * sizeof parent->keys[0]);
+    memmove(&parent->children[i + 1], &parent->children[i + 2], (parent->degree - i - 1) * sizeof parent->children[0]);
+#ifdef BTREE_AUGMENT
+    parent->counts[i] += parent->counts[i + 1];
+    memmove(&parent->counts[i + 1], &parent->counts[i + 2], (parent->degree - i - 1) * sizeof parent->counts[0]);
+#endif
+#ifdef BTREE_SUM
+    parent->sums[i] += parent->sums[i + 1];
+    memmove(&parent->sums[i + 1], &parent->sums[i + 2], (parent->degree - i - 1) * sizeof parent->sums[0]);
+#endif
+    parent->degree--;
+}
+
+bool BTREE_METHOD(remove)(BTREE_T* btree, K key)
+{
+    struct BTREE_METHOD(step) path[BTREE_MAX_DEPTH];
+    void* node = btree->root;
+    for (size_t height = btree->depth; height > 0; height--) {
+        BTREE_INTERNAL_T* in = node;
+        const size_t i = BTREE_KEYS_LOWER_BOUND(in->keys, in->degree, key);
+        path[btree->depth - height] = (struct BTREE_METHOD(step)) { .node = in, .index = i };
+        node = in->children[i];
+    }
+
+    BTREE_LEAF_T* leaf = node;
+    const size_t i = BTREE_KEYS_LOWER_BOUND(leaf->keys, leaf->degree, key);
+    if (i == leaf->degree || leaf->keys[i] != key) {
+        return false;
+    }
+#ifdef BTREE_AUGMENT
+    for (size_t d = 0; d < btree->depth; d++) {
+        path[d].node->counts[path[d].index]--;
+#ifdef BTREE_SUM
+        path[d].node->sums[path[d].index] -= leaf->vals[i];
+#endif
+    }
+#endif
+    memmove(&leaf->keys[i], &leaf->keys[i+1], (leaf->degree - i - 1) * sizeof leaf->keys[0]);
+    memmove(&leaf->vals[i], &leaf->vals[i+1], (leaf->degree - i - 1) * sizeof leaf->vals[0]);
+    leaf->degree--;
+    btree->count--;
+
+    /* refill underfull nodes from a sibling, or merge them into one, from
+     * the leaf up as long as that leaves the parent underfull */
+    for (size_t d = btree->depth; d > 0; d--) {
+        const size_t height = btree->depth - d;
+        const size_t min    = height == 0 ? LEAF_MIN : INTERNAL_MIN;
+        BTREE_INTERNAL_T* parent = path[d - 1].node;
+        const size_t c = path[d - 1].index;
+        if (BTREE_METHOD(degree)(parent->children[c], height) >= min) {
+            break;
+        }
+        if (c > 0 && BTREE_METHOD(degree)(parent->children[c - 1], height) > min) {
+            BTREE_METHOD(borrow_left)(parent, c, height);
+        } else if (c < parent->degree && BTREE_METHOD(degree)(parent->children[c + 1], height) > min) {
+            BTREE_METHOD(borrow_right)(parent, c, height);
+        } else {
+            BTREE_METHOD(merge)(btree, parent, c > 0 ? c - 1 : c, height);
+        }
+    }
+
+    if (btree->depth > 0 && ((BTREE_INTERNAL_T*)btree->root)->degree == 0) {
+        btree->root = ((BTREE_INTERNAL_T*)btree->root)->children[0];
+        btree->depth--;
+    }
+    return true;
+}
+
+T BTREE_METHOD(get)(const BTREE_T* btree, K key, T otherwise)
+{
+    const BTREE_LEAF_T* leaf = BTREE_METHOD(find_leaf)(btree, key);
+    const size_t i = BTREE_KEYS_LOWER_BOUND(leaf->keys, leaf->degree, key);
+    if (i < leaf->degree && leaf->keys[i] == key) {
+        return leaf->vals[i];
+    }
+    return otherwise;
+}
+
+bool BTREE_METHOD(contains)(const BTREE_T* btree, K key)
+{
+    const BTREE_LEAF_T* leaf = BTREE_METHOD(find_leaf)(btree, key);
+    const size_t i = BTREE_KEYS_LOWER_BOUND(leaf->keys, leaf->degree, key);
+    return i < leaf->degree && leaf->keys[i] == key;
+}
+
+bool BTREE_METHOD(lower_bound)(const BTREE_T* btree, K key, BTREE_CURSOR_T* cursor)
+{
+    BTREE_LEAF_T* leaf = BTREE_METHOD(find_leaf)(btree, key);
+    size_t i = BTREE_KEYS_LOWER_BOUND(leaf->keys, leaf->degree, key);
+    if (i == leaf->degree) {
+        /* everything in the next leaf is above this leaf's separator */
+        leaf = leaf->next;
+        i = 0;
+    }
+    cursor->leaf  = leaf;
+    cursor->index = i;
+    return leaf != NULL;
+}
+
+bool BTREE_METHOD(first)(const BTREE_T* btree, BTREE_CURSOR_T* cursor)
+{
+    cursor->leaf  = btree->count > 0 ? btree->first : NULL;
+    cursor->index = 0;
+    return cursor->leaf != NULL;
+}
+
+bool BTREE_METHOD(last)(const BTREE_T* btree, BTREE_CURSOR_T* cursor)
+{
+    cursor->leaf  = btree->count > 0 ? btree->last : NULL;
+    cursor->index = cursor->leaf ? cursor->leaf->degree - 1 : 0;
+    return cursor->leaf != NULL;
+}
+
+#ifdef BTREE_AUGMENT
+size_t BTREE_METHOD(rank)(const BTREE_T* btree, K key)
+{
+    size_t rank = 0;
+    const void* node = btree->root;
+    for (size_t height = btree->depth; height > 0; height--) {
+        const BTREE_INTERNAL_T* in = node;
+        const size_t i = BTREE_KEYS_LOWER_BOUND(in->keys, in->degree, key);
+        rank += BTREE_METHOD(count_children)(in, 0, i);
+        node = in->children[i];
+    }
+    const BTREE_LEAF_T* leaf = node;
+    return rank + BTREE_KEYS_LOWER_BOUND(leaf->keys, leaf->degree, key);
+}
+
+bool BTREE_METHOD(select)(const BTREE_T* btree, size_t rank, BTREE_CURSOR_T* cursor)
+{
+    cursor->leaf  = NULL;
+    cursor->index = 0;
+    if (rank >= btree->count) {
+        return false;
+    }
+    void* node = btree->root;
+    for (size_t height = btree->depth; height > 0; height--) {
+        BTREE_INTERNAL_T* in = node;
+        size_t i = 0;
+        while (rank >= in->counts[i]) {
+            rank -= in->counts[i++];
+        }
+        node = in->children[i];
+    }
+    cursor->leaf  = node;
+    cursor->index = rank;
+    return true;
+}
+
+size_t BTREE_METHOD(count_range)(const BTREE_T* btree, K lo, K hi)
+{
+    if (lo >= hi) {
+        return 0;
+    }
+    return BTREE_METHOD(rank)(btree, hi) - BTREE_METHOD(rank)(btree, lo);
+}
+#endif
+
+#ifdef BTREE_SUM
+/* Sum of the values of the keys < `key` */
+static BTREE_SUM BTREE_METHOD(sum_below)(const BTREE_T* btree, K key)
+{
+    BTREE_SUM sum = 0;
+    const void* node = btree->root;
+    for (size_t height = btree->depth; height > 0; height--) {
+        const BTREE_INTERNAL_T* in = node;
+        const size_t i = BTREE_KEYS_LOWER_BOUND(in->keys, in->degree, key);
+        sum += BTREE_METHOD(sum_children)(in, 0, i);
+        node = in->children[i];
+    }
+    const BTREE_LEAF_T* leaf = node;
+    return sum + BTREE_METHOD(sum_vals)(leaf, 0, BTREE_KEYS_LOWER_BOUND(leaf->keys, leaf->degree, key));
+}
+
+BTREE_SUM BTREE_METHOD(sum_range)(const BTREE_T* btree, K lo, K hi)
+{
+    if (lo >= hi) {
+        return 0;
+    }
+    return BTREE_METHOD(sum_below)(btree, hi) - BTREE_METHOD(sum_below)(btree, lo);
+}
+#endif
+
+#undef LEAF_MIN
+#undef INTERNAL_MIN
+#undef BTREE_VAL
+#undef BTREE_KEY
+#undef BTREE_PREFIX
+#undef BTREE_AUGMENT
+#undef BTREE_SUM
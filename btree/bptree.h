@@ -0,0 +1,273 @@
+#define XCAT(a, b) a##b
+#define CAT(a, b) XCAT(a,b)
+
+/* Key/value B+tree, templated on the value type like hashmap.h.
+ *
+ * Define BTREE_VAL and BTREE_PREFIX before including to instantiate it for a
+ * value type, see codegen/gen.sh. Without them the values are void*.
+ *
+ * Define BTREE_KEY as well to one of uint32_t, int32_t, uint64_t, int64_t,
+ * double or uint128_t for keys of that type instead of Key. Nodes hold as
+ * many keys as fit, so narrower keys give a wider fan-out, and nodes are
+ * searched with the kernel for that type. Keyed instantiations are named
+ * BPTree_K_T.
+ *
+ * Values are only stored in the leaves, and the leaves are linked so scans
+ * never go back up the tree. Internal nodes hold separators and children
+ * only, so their fan-out is the same for every value type.
+ *
+ * Define BTREE_AUGMENT as well to keep the number of keys under every child
+ * of an internal node, for rank, select and range counts in O(log n). Define
+ * BTREE_SUM to an accumulator type to also keep the sum of the values under
+ * every child, which implies BTREE_AUGMENT. A summed tree sets values with
+ * put only, since a value written through a pointer can't update the sums.
+ * Augmented instantiations are named BPTree_ranked_T or BPTree_summed_T. */
+
+#undef T
+#undef BTREE_T
+#undef BTREE_LEAF_T
+#undef BTREE_INTERNAL_T
+#undef BTREE_CURSOR_T
+#undef BTREE_METHOD
+#undef BTREE_LEAF_HEADER
+#undef BTREE_LEAF_MAX
+#undef BTREE_INTERNAL_MAX_CHILDREN
+#undef BTREE_INTERNAL_MAX_KEY
+#undef K
+#undef BTREE_KEY_TAG
+#undef BTREE_KEYS_LOWER_BOUND
+
+#if defined(BTREE_SUM) && !defined(BTREE_AUGMENT)
+    #define BTREE_AUGMENT
+#endif
+
+#if defined(BTREE_AUGMENT) && !defined(BTREE_VAL)
+    #error "BTREE_AUGMENT needs BTREE_VAL"
+#endif
+
+#if defined(BTREE_KEY) && !defined(BTREE_VAL)
+    #error "BTREE_KEY needs BTREE_VAL"
+#endif
+
+#ifdef BTREE_KEY
+    #define K                      BTREE_KEY
+    #define BTREE_KEY_TAG          CAT(BTREE_KEY,_)
+    #define BTREE_KEYS_LOWER_BOUND CAT(BTree_keys_lower_bound_,BTREE_KEY)
+#else
+    #define K                      Key
+    #define BTREE_KEY_TAG
+    #define BTREE_KEYS_LOWER_BOUND BTree_keys_lower_bound
+#endif
+
+#if defined(BTREE_SUM)
+    #define T BTREE_VAL
+    #define BTREE_T          CAT(CAT(BPTree_summed_,BTREE_KEY_TAG),T)
+    #define BTREE_LEAF_T     CAT(CAT(BPTree_leaf_summed_,BTREE_KEY_TAG),T)
+    #define BTREE_INTERNAL_T CAT(CAT(BPTree_internal_summed_,BTREE_KEY_TAG),T)
+    #define BTREE_CURSOR_T   CAT(CAT(BPTree_cursor_summed_,BTREE_KEY_TAG),T)
+#elif defined(BTREE_AUGMENT)
+    #define T BTREE_VAL
+    #define BTREE_T          CAT(CAT(BPTree_ranked_,BTREE_KEY_TAG),T)
+    #define BTREE_LEAF_T     CAT(CAT(BPTree_leaf_ranked_,BTREE_KEY_TAG),T)
+    #define BTREE_INTERNAL_T CAT(CAT(BPTree_internal_ranked_,BTREE_KEY_TAG),T)
+    #define BTREE_CURSOR_T   CAT(CAT(BPTree_cursor_ranked_,BTREE_KEY_TAG),T)
+#elif defined(BTREE_VAL)
+    #define T BTREE_VAL
+    #define BTREE_T          CAT(CAT(BPTree_,BTREE_KEY_TAG),T)
+    #define BTREE_LEAF_T     CAT(CAT(BPTree_leaf_,BTREE_KEY_TAG),T)
+    #define BTREE_INTERNAL_T CAT(CAT(BPTree_internal_,BTREE_KEY_TAG),T)
+    #define BTREE_CURSOR_T   CAT(CAT(BPTree_cursor_,BTREE_KEY_TAG),T)
+#else
+    #define T void*
+    #define BTREE_T          BPTree
+	#define BTREE_PREFIX     bptree
+    #define BTREE_LEAF_T     BPTree_leaf
+    #define BTREE_INTERNAL_T BPTree_internal
+    #define BTREE_CURSOR_T   BPTree_cursor
+#endif
+
+#if defined(BTREE_VAL) && !defined(BTREE_PREFIX)
+    #error "BTREE_VAL defined but not BTREE_PREFIX"
+#endif
+
+#define BTREE_METHOD(x) CAT(CAT(BTREE_PREFIX,_), x)
+
+/* ==== */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "btree.h"
+
+/* ==== */
+
+/* Leaves are two cache lines like BTree_node, minus the header and the
+ * sibling links, which the keys may have to be aligned past */
+#define BTREE_LEAF_HEADER ((3*sizeof(void*) + _Alignof(K) - 1) / _Alignof(K) * _Alignof(K))
+#define BTREE_LEAF_MAX ((2*CACHE_LINE_SIZE - BTREE_LEAF_HEADER) / (sizeof(K) + sizeof(T)))
+
+typedef struct BTREE_LEAF_T {
+    uint16_t             degree;
+    struct BTREE_LEAF_T* prev;
+    struct BTREE_LEAF_T* next;
+    K                    keys[BTREE_LEAF_MAX];
+    T                    vals[BTREE_LEAF_MAX];
+} __attribute__((aligned(CACHE_LINE_SIZE))) BTREE_LEAF_T;
+
+_Static_assert(BTREE_LEAF_MAX >= 2, "value type too large for a B+tree leaf");
+_Static_assert(sizeof (BTREE_LEAF_T) == 2*CACHE_LINE_SIZE, "B+tree leaf doesn't fit two cache lines");
+
+/* The counts and sums take as much room as the keys and children, so
+ * augmented internal nodes get twice the bytes to keep their fan-out */
+#if defined(BTREE_SUM)
+    #define BTREE_INTERNAL_MAX_CHILDREN \
+        ((2*BTREE_NODE_SIZE - sizeof (uint64_t)) / (sizeof (K) + sizeof (void*) + sizeof (size_t) + sizeof (BTREE_SUM)))
+#elif defined(BTREE_AUGMENT)
+    #define BTREE_INTERNAL_MAX_CHILDREN \
+        ((2*BTREE_NODE_SIZE - sizeof (uint64_t)) / (sizeof (K) + sizeof (void*) + sizeof (size_t)))
+#else
+    #define BTREE_INTERNAL_MAX_CHILDREN (BTREE_NODE_SIZE / (sizeof (K) + sizeof (void*)))
+#endif
+#define BTREE_INTERNAL_MAX_KEY (BTREE_INTERNAL_MAX_CHILDREN - 1)
+
+typedef struct BTREE_INTERNAL_T {
+    uint16_t  degree;
+    K         keys[BTREE_INTERNAL_MAX_KEY];
+    void*     children[BTREE_INTERNAL_MAX_CHILDREN];
+#ifdef BTREE_AUGMENT
+    size_t    counts[BTREE_INTERNAL_MAX_CHILDREN]; /* keys under every child */
+#endif
+#ifdef BTREE_SUM
+    BTREE_SUM sums[BTREE_INTERNAL_MAX_CHILDREN];   /* sum of the values under every child */
+#endif
+} __attribute__((aligned(CACHE_LINE_SIZE))) BTREE_INTERNAL_T;
+
+_Static_assert(BTREE_INTERNAL_MAX_CHILDREN >= 4, "accumulator too large for a B+tree internal node");
+#ifdef BTREE_AUGMENT
+_Static_assert(sizeof (BTREE_INTERNAL_T) == 2*BTREE_NODE_SIZE, "B+tree internal node doesn't fit its size");
+#else
+_Static_assert(sizeof (BTREE_INTERNAL_T) == BTREE_NODE_SIZE, "B+tree internal node doesn't fit its size");
+#endif
+
+/* All leaves are at the same depth, so the level tells whether a child is a
+ * leaf and the nodes don't need a flag for it */
+typedef struct BTREE_T {
+    void*               root;
+    size_t              depth;
+    size_t              count;
+    struct BTREE_LEAF_T* first;
+    struct BTREE_LEAF_T* last;
+    struct arena*       arena;
+} BTREE_T;
+
+typedef struct BTREE_CURSOR_T {
+    struct BTREE_LEAF_T* leaf;
+    size_t               index;
+} BTREE_CURSOR_T;
+
+BTREE_T* BTREE_METHOD(new)(struct arena* a);
+
+void BTREE_METHOD(init)(struct arena* a, BTREE_T* btree);
+
+#ifndef BTREE_SUM
+/**
+ * Returns a pointer to the value for `key`, inserting a zeroed value if the
+ * key is new. The pointer is valid until the next insert or remove.
+ */
+T* BTREE_METHOD(insert)(BTREE_T* btree, K key);
+#endif
+
+/**
+ * Set the value for `key`, inserting the key if it is new.
+ * Returns false if the key was already present.
+ */
+bool BTREE_METHOD(put)(BTREE_T* btree, K key, T val);
+
+/**
+ * Remove `key` and its value.
+ * Returns false if the key wasn't present.
+ */
+bool BTREE_METHOD(remove)(BTREE_T* btree, K key);
+
+T BTREE_METHOD(get)(const BTREE_T* btree, K key, T otherwise);
+
+bool BTREE_METHOD(contains)(const BTREE_T* btree, K key);
+
+/**
+ * Position a cursor at the first key >= `key`.
+ * Returns false, and leaves the cursor invalid, if there is no such key.
+ */
+bool BTREE_METHOD(lower_bound)(const BTREE_T* btree, K key, BTREE_CURSOR_T* cursor);
+
+bool BTREE_METHOD(first)(const BTREE_T* btree, BTREE_CURSOR_T* cursor);
+
+#ifdef BTREE_AUGMENT
+/**
+ * Number of keys < `key`.
+ */
+size_t BTREE_METHOD(rank)(const BTREE_T* btree, K key);
+
+/**
+ * Position a cursor at the key with `rank` smaller keys.
+ * Returns false, and leaves the cursor invalid, if there are only `rank`
+ * keys or fewer.
+ */
+bool BTREE_METHOD(select)(const BTREE_T* btree, size_t rank, BTREE_CURSOR_T* cursor);
+
+/**
+ * Number of keys in [lo, hi).
+ */
+size_t BTREE_METHOD(count_range)(const BTREE_T* btree, K lo, K hi);
+#endif
+
+#ifdef BTREE_SUM
+/**
+ * Sum of the values of the keys in [lo, hi).
+ */
+BTREE_SUM BTREE_METHOD(sum_range)(const BTREE_T* btree, K lo, K hi);
+#endif
+
+bool BTREE_METHOD(last)(const BTREE_T* btree, BTREE_CURSOR_T* cursor);
+
+static inline bool BTREE_METHOD(next)(BTREE_CURSOR_T* cursor)
+{
+    if (++cursor->index < cursor->leaf->degree) {
+        return true;
+    }
+    cursor->leaf  = cursor->leaf->next;
+    cursor->index = 0;
+    if (cursor->leaf && cursor->leaf->next) {
+        __builtin_prefetch(cursor->leaf->next);
+        __builtin_prefetch((const char*)cursor->leaf->next + CACHE_LINE_SIZE);
+    }
+    return cursor->leaf != NULL;
+}
+
+static inline bool BTREE_METHOD(prev)(BTREE_CURSOR_T* cursor)
+{
+    if (cursor->index > 0) {
+        cursor->index--;
+        return true;
+    }
+    cursor->leaf = cursor->leaf->prev;
+    if (cursor->leaf) {
+        cursor->index = cursor->leaf->degree - 1;
+    }
+    return cursor->leaf != NULL;
+}
+
+static inline bool BTREE_METHOD(cursor_valid)(const BTREE_CURSOR_T* cursor)
+{
+    return cursor->leaf != NULL;
+}
+
+static inline K BTREE_METHOD(cursor_key)(const BTREE_CURSOR_T* cursor)
+{
+    return cursor->leaf->keys[cursor->index];
+}
+
+static inline T* BTREE_METHOD(cursor_val)(const BTREE_CURSOR_T* cursor)
+{
+    return &cursor->leaf->vals[cursor->index];
+}
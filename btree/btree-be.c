@@ -0,0 +1,381 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "btree.h"
+#include "btree-be.h"
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+
+#define FANOUT BTREE_BE_FANOUT
+#define BUFFER BTREE_BE_BUFFER
+#define LEAF   BTREE_BE_LEAF
+
+enum { OP_INSERT = 1, OP_REMOVE = 2 };
+
+static BTree_be_leaf* new_leaf(BTree_be* t)
+{
+    BTree_be_leaf* leaf = arena_alloc(t->arena, sizeof *leaf);
+    if (unlikely(!leaf)) {
+        abort();
+    }
+    leaf->count = 0;
+    t->leaf_count++;
+    return leaf;
+}
+
+static BTree_be_internal* new_internal(BTree_be* t)
+{
+    BTree_be_internal* node = arena_alloc(t->arena, sizeof *node);
+    if (unlikely(!node)) {
+        abort();
+    }
+    node->degree   = 0;
+    node->buffered = 0;
+    memset(node->counts, 0, sizeof node->counts);
+    t->internal_count++;
+    return node;
+}
+
+void BTree_be_init(struct arena* a, BTree_be* t)
+{
+    *t = (BTree_be) { .arena = a };
+    t->root = new_leaf(t);
+}
+
+BTree_be* BTree_be_new(struct arena* a)
+{
+    BTree_be* t = arena_alloc(a, sizeof *t);
+    if (unlikely(!t)) {
+        abort();
+    }
+    BTree_be_init(a, t);
+    return t;
+}
+
+/* the child of `node` whose range holds `key` */
+static inline size_t route(const BTree_be_internal* node, Key key)
+{
+    const size_t pivots = node->degree - 1;
+    const size_t i = BTree_keys_lower_bound(node->pivots, pivots, key);
+    return i < pivots && node->pivots[i] == key ? i + 1 : i;
+}
+
+/* Append a message to the buffer of `node`, which has room for it */
+static inline void push(BTree_be_internal* node, Key key, uint8_t op)
+{
+    const size_t r = route(node, key);
+    node->messages[node->buffered] = key;
+    node->ops[node->buffered]      = op;
+    node->routes[node->buffered++] = r;
+    node->counts[r]++;
+}
+
+/* Insert `count` children after children[i] of `node`, each starting at
+ * its pivot. The buffered messages for children[i] are routed again
+ * between it and the new children. */
+static void insert_children(BTree_be_internal* node, size_t i, void* const* children,
+                            const Key* pivots, size_t count)
+{
+    memmove(&node->children[i + 1 + count], &node->children[i + 1],
+            (node->degree - i - 1) * sizeof *node->children);
+    memmove(&node->pivots[i + count], &node->pivots[i],
+            (node->degree - 1 - i) * sizeof *node->pivots);
+    memmove(&node->counts[i + 1 + count], &node->counts[i + 1],
+            (node->degree - i - 1) * sizeof *node->counts);
+    memcpy(&node->children[i + 1], children, count * sizeof *children);
+    memcpy(&node->pivots[i], pivots, count * sizeof *pivots);
+    memset(&node->counts[i + 1], 0, count * sizeof *node->counts);
+    node->degree += count;
+
+    for (size_t j = 0; j < node->buffered; j++) {
+        size_t r = node->routes[j];
+        if (r > i) {
+            node->routes[j] = r + count;
+        } else if (r == i) {
+            while (r - i < count && node->messages[j] >= pivots[r - i]) {
+                r++;
+            }
+            node->counts[i]--;
+            node->counts[r]++;
+            node->routes[j] = r;
+        }
+    }
+}
+
+/* Split children[i] of `parent`, an internal node over the fanout, in two.
+ * Its buffer is split along with its children. */
+static void split_internal(BTree_be* t, BTree_be_internal* parent, size_t i)
+{
+    BTree_be_internal* left  = parent->children[i];
+    BTree_be_internal* right = new_internal(t);
+    const size_t keep = left->degree / 2;
+    const Key    up   = left->pivots[keep - 1];
+
+    right->degree = left->degree - keep;
+    memcpy(right->children, &left->children[keep], right->degree * sizeof *right->children);
+    memcpy(right->pivots, &left->pivots[keep], (right->degree - 1) * sizeof *right->pivots);
+    memcpy(right->counts, &left->counts[keep], right->degree * sizeof *right->counts);
+    memset(&left->counts[keep], 0, right->degree * sizeof *left->counts);
+    left->degree = keep;
+
+    size_t kept = 0;
+    for (size_t j = 0; j < left->buffered; j++) {
+        if (left->routes[j] >= keep) {
+            right->messages[right->buffered] = left->messages[j];
+            right->ops[right->buffered]      = left->ops[j];
+            right->routes[right->buffered++] = left->routes[j] - keep;
+        } else {
+            left->messages[kept] = left->messages[j];
+            left->ops[kept]      = left->ops[j];
+            left->routes[kept++] = left->routes[j];
+        }
+    }
+    left->buffered = kept;
+
+    void* children[1] = { right };
+    insert_children(parent, i, children, &up, 1);
+}
+
+/* Grow the tree by a level if the root went over the fanout */
+static void split_root(BTree_be* t)
+{
+    BTree_be_internal* old = t->root;
+    if (old->degree <= FANOUT) {
+        return;
+    }
+    BTree_be_internal* root = new_internal(t);
+    root->degree      = 1;
+    root->children[0] = old;
+    split_internal(t, root, 0);
+    t->root = root;
+    t->height++;
+}
+
+struct message {
+    Key      key;
+    uint32_t seq;
+    uint8_t  op;
+};
+
+static int cmp_message(const void* a, const void* b)
+{
+    const struct message* x = a;
+    const struct message* y = b;
+    if (x->key != y->key) {
+        return (x->key > y->key) - (x->key < y->key);
+    }
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/* Merge `count` messages, oldest first, into `leaf`. Whatever doesn't fit
+ * goes into new leaves, which are stored in `added` with their first keys
+ * in `pivots`. Returns the number of new leaves, at most two. */
+static size_t merge_leaf(BTree_be* t, BTree_be_leaf* leaf, const Key* keys, const uint8_t* ops,
+                         size_t count, void** added, Key* pivots)
+{
+    struct message batch[BUFFER];
+    for (size_t j = 0; j < count; j++) {
+        batch[j] = (struct message) { .key = keys[j], .seq = j, .op = ops[j] };
+    }
+    qsort(batch, count, sizeof *batch, cmp_message);
+
+    Key merged[LEAF + BUFFER];
+    size_t n = 0, i = 0;
+    for (size_t j = 0; j < count; j++) {
+        const Key key = batch[j].key;
+        if (j + 1 < count && batch[j + 1].key == key) {
+            continue; /* only the newest message for a key counts */
+        }
+        while (i < leaf->count && leaf->keys[i] < key) {
+            merged[n++] = leaf->keys[i++];
+        }
+        if (i < leaf->count && leaf->keys[i] == key) {
+            i++;
+        }
+        if (batch[j].op == OP_INSERT) {
+            merged[n++] = key;
+        }
+    }
+    memcpy(&merged[n], &leaf->keys[i], (leaf->count - i) * sizeof *merged);
+    n += leaf->count - i;
+
+    /* spread evenly over as few leaves as hold them */
+    const size_t pieces = n > LEAF ? (n + LEAF - 1) / LEAF : 1;
+    size_t start = 0;
+    for (size_t p = 0; p < pieces; p++) {
+        BTree_be_leaf* out = p == 0 ? leaf : new_leaf(t);
+        out->count = n / pieces + (p < n % pieces);
+        memcpy(out->keys, &merged[start], out->count * sizeof *merged);
+        if (p > 0) {
+            added[p - 1]  = out;
+            pivots[p - 1] = merged[start];
+        }
+        start += out->count;
+    }
+    return pieces - 1;
+}
+
+/* Move the buffered messages for the child of `node` with the most of them
+ * down into that child. `node` can be left with up to two children over the
+ * fanout, for its parent to split. */
+static void flush_step(BTree_be* t, BTree_be_internal* node, size_t height)
+{
+    size_t c = 0;
+    for (size_t i = 1; i < node->degree; i++) {
+        if (node->counts[i] > node->counts[c]) {
+            c = i;
+        }
+    }
+
+    if (height > 1) {
+        /* make room in the child first, which may split it */
+        BTree_be_internal* child = node->children[c];
+        while (child->buffered + node->counts[c] > BUFFER) {
+            flush_step(t, child, height - 1);
+            if (child->degree > FANOUT) {
+                split_internal(t, node, c);
+                return;
+            }
+        }
+    }
+
+    /* take the batch out, keeping the order of both parts */
+    Key     keys[BUFFER];
+    uint8_t ops[BUFFER];
+    size_t  count = 0, kept = 0;
+    for (size_t j = 0; j < node->buffered; j++) {
+        if (node->routes[j] == c) {
+            keys[count]  = node->messages[j];
+            ops[count++] = node->ops[j];
+        } else {
+            node->messages[kept] = node->messages[j];
+            node->ops[kept]      = node->ops[j];
+            node->routes[kept++] = node->routes[j];
+        }
+    }
+    node->buffered  = kept;
+    node->counts[c] = 0;
+    t->flushes++;
+
+    if (height > 1) {
+        BTree_be_internal* child = node->children[c];
+        for (size_t j = 0; j < count; j++) {
+            push(child, keys[j], ops[j]);
+        }
+    } else {
+        void* added[2];
+        Key   pivots[2];
+        const size_t n = merge_leaf(t, node->children[c], keys, ops, count, added, pivots);
+        insert_children(node, c, added, pivots, n);
+    }
+}
+
+static void apply(BTree_be* t, Key key, uint8_t op)
+{
+    if (t->height == 0) {
+        void* added[2];
+        Key   pivots[2];
+        const size_t n = merge_leaf(t, t->root, &key, &op, 1, added, pivots);
+        if (n > 0) {
+            BTree_be_internal* root = new_internal(t);
+            root->degree      = 1;
+            root->children[0] = t->root;
+            insert_children(root, 0, added, pivots, n);
+            t->root   = root;
+            t->height = 1;
+        }
+        return;
+    }
+
+    BTree_be_internal* root = t->root;
+    while (root->buffered == BUFFER) {
+        flush_step(t, root, t->height);
+        split_root(t);
+        root = t->root;
+    }
+    push(root, key, op);
+}
+
+void BTree_be_insert(BTree_be* t, Key key)
+{
+    apply(t, key, OP_INSERT);
+}
+
+void BTree_be_remove(BTree_be* t, Key key)
+{
+    apply(t, key, OP_REMOVE);
+}
+
+bool BTree_be_find(const BTree_be* t, Key key)
+{
+    const void* node = t->root;
+    for (size_t h = t->height; h > 0; h--) {
+        const BTree_be_internal* in = node;
+        /* the newest message for the key, compared without branches so
+         * the scan vectorizes */
+        size_t newest = BUFFER;
+        for (size_t j = 0; j < in->buffered; j++) {
+            newest = in->messages[j] == key ? j : newest;
+        }
+        if (newest != BUFFER) {
+            return in->ops[newest] == OP_INSERT;
+        }
+        node = in->children[route(in, key)];
+    }
+    const BTree_be_leaf* leaf = node;
+    const size_t i = BTree_keys_lower_bound(leaf->keys, leaf->count, key);
+    return i < leaf->count && leaf->keys[i] == key;
+}
+
+/* Empty the buffers of `node` and everything below it. Returns false, with
+ * work left, if `node` went over the fanout and has to be split first. */
+static bool drain(BTree_be* t, BTree_be_internal* node, size_t height)
+{
+    while (node->buffered > 0) {
+        flush_step(t, node, height);
+        if (node->degree > FANOUT) {
+            return false;
+        }
+    }
+    if (height == 1) {
+        return true;
+    }
+    for (size_t i = 0; i < node->degree; i++) {
+        while (!drain(t, node->children[i], height - 1)) {
+            split_internal(t, node, i);
+            if (node->degree > FANOUT) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void BTree_be_flush(BTree_be* t)
+{
+    while (t->height > 0 && !drain(t, t->root, t->height)) {
+        split_root(t);
+    }
+}
+
+static size_t count_keys(const void* node, size_t height)
+{
+    if (height == 0) {
+        return ((const BTree_be_leaf*)node)->count;
+    }
+    const BTree_be_internal* in = node;
+    size_t count = 0;
+    for (size_t i = 0; i < in->degree; i++) {
+        count += count_keys(in->children[i], height - 1);
+    }
+    return count;
+}
+
+size_t BTree_be_count(BTree_be* t)
+{
+    BTree_be_flush(t);
+    return count_keys(t->root, t->height);
+}
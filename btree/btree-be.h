@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "btree.h"
+
+/* Write-optimized Bε-tree of keys.
+ *
+ * Internal nodes hold a buffer of insert and remove messages on top of their
+ * pivots. A change is only appended to the root's buffer. When a buffer is
+ * full, the messages for the child with the most of them are moved down in
+ * one batch, into the child's buffer or, at the bottom, merged into the leaf.
+ * Leaves are large sorted arrays and are written once per batch instead of
+ * once per key, so random inserts turn into sequential merges.
+ *
+ * Changes are blind: there is no lookup on the way in, so inserting a
+ * present key or removing an absent one is just another message. The newest
+ * message for a key wins, and lookups check the buffers on their way down,
+ * newest first.
+ *
+ * Leaves emptied by removes are kept, the tree is meant for ingest bursts
+ * and not for shrinking. */
+
+/* children of an internal node */
+#ifndef BTREE_BE_FANOUT
+#define BTREE_BE_FANOUT 16
+#endif
+
+/* messages buffered in an internal node */
+#ifndef BTREE_BE_BUFFER
+#define BTREE_BE_BUFFER 512
+#endif
+
+/* keys in a leaf */
+#ifndef BTREE_BE_LEAF
+#define BTREE_BE_LEAF 256
+#endif
+
+_Static_assert(BTREE_BE_FANOUT >= 4 && BTREE_BE_FANOUT + 2 <= UINT8_MAX, "Bε fanout out of range");
+_Static_assert(BTREE_BE_LEAF >= 2, "Bε leaves need room for two keys");
+_Static_assert(BTREE_BE_BUFFER <= 2 * BTREE_BE_LEAF, "a Bε flush could split a leaf more than three ways");
+
+typedef struct BTree_be_leaf {
+    size_t count;
+    Key    keys[BTREE_BE_LEAF];
+} BTree_be_leaf;
+
+/* a flush into the bottom level can add two children at once, so internal
+ * nodes have room for two more than the fanout until they are split */
+typedef struct BTree_be_internal {
+    size_t  degree;   /* children */
+    size_t  buffered; /* messages */
+    Key     pivots[BTREE_BE_FANOUT + 1]; /* child i holds keys in [pivots[i-1], pivots[i]) */
+    void*   children[BTREE_BE_FANOUT + 2];
+    Key     messages[BTREE_BE_BUFFER];   /* oldest first */
+    uint8_t ops[BTREE_BE_BUFFER];
+    uint8_t routes[BTREE_BE_BUFFER];     /* the child each message goes to */
+    uint32_t counts[BTREE_BE_FANOUT + 2]; /* messages by child */
+} BTree_be_internal;
+
+typedef struct BTree_be {
+    void*         root;   /* a leaf while height is 0 */
+    size_t        height; /* internal levels above the leaves */
+    size_t        leaf_count;
+    size_t        internal_count;
+    size_t        flushes;
+    struct arena* arena;
+} BTree_be;
+
+/**
+ * Allocate a new empty tree in arena `a`.
+ * Aborts if the arena is out of memory.
+ */
+BTree_be* BTree_be_new(struct arena* a);
+
+void BTree_be_init(struct arena* a, BTree_be* t);
+
+/**
+ * Add `key`, or remove it. Neither looks at what's in the tree, so there is
+ * nothing to return.
+ * Aborts if the arena is out of memory.
+ */
+void BTree_be_insert(BTree_be* t, Key key);
+
+void BTree_be_remove(BTree_be* t, Key key);
+
+/**
+ * Returns true if `key` is in the tree.
+ */
+bool BTree_be_find(const BTree_be* t, Key key);
+
+/**
+ * Push every buffered message down into the leaves.
+ */
+void BTree_be_flush(BTree_be* t);
+
+/**
+ * Number of keys in the tree.
+ * Flushes first, since buffered messages may or may not change the count.
+ */
+size_t BTree_be_count(BTree_be* t);
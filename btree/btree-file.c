@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "arena.h"
+#include "btree.h"
+#include "btree-file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+
+static inline const BTree_file_node* file_node(const BTree_file* f, uint64_t offset)
+{
+    return (const BTree_file_node*)(f->data + offset);
+}
+
+/* All nodes in level order. The children of a node come right after the
+ * children of the node before it, which is what lets BTree_file_write
+ * compute child offsets in a single pass. */
+static BTree_node** level_order(const BTree* b, size_t* count)
+{
+    size_t cap = b->node_count > 0 ? b->node_count : 1;
+    BTree_node** nodes = malloc(cap * sizeof *nodes);
+    if (!nodes) {
+        return NULL;
+    }
+
+    size_t n = 0;
+    nodes[n++] = b->root;
+    for (size_t i = 0; i < n; i++) {
+        if (nodes[i]->is_leaf) {
+            continue;
+        }
+        for (size_t c = 0; c <= nodes[i]->degree; c++) {
+            if (n == cap) {
+                cap *= 2;
+                BTree_node** grown = realloc(nodes, cap * sizeof *nodes);
+                if (!grown) {
+                    free(nodes);
+                    return NULL;
+                }
+                nodes = grown;
+            }
+            nodes[n++] = nodes[i]->children[c];
+        }
+    }
+
+    *count = n;
+    return nodes;
+}
+
+int BTree_file_write(const BTree* b, const char* path)
+{
+    const long page = sysconf(_SC_PAGE_SIZE);
+    if (page == -1 || page % sizeof (BTree_file_node) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t count;
+    BTree_node** nodes = level_order(b, &count);
+    if (!nodes) {
+        return -1;
+    }
+
+    const size_t size = (size_t)page + count * sizeof (BTree_file_node);
+
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path) >= (int)sizeof tmp_path) {
+        errno = ENAMETOOLONG;
+        goto snprintf_failed;
+    }
+
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        goto open_failed;
+    }
+    if (ftruncate(fd, size) == -1) {
+        goto ftruncate_failed;
+    }
+    char* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        goto mmap_failed;
+    }
+
+    /* the mapping is carved up with an arena like any other node memory, a
+     * node sized allocation is already aligned so the nodes come out packed */
+    arena_t a = arena_attach(map, size);
+    BTree_file_header* header = arena_alloc(&a, page);
+    BTree_file_node*   out    = arena_alloc(&a, count * sizeof *out);
+
+    size_t next_child = 1;
+    for (size_t i = 0; i < count; i++) {
+        const BTree_node* node = nodes[i];
+        out[i] = (BTree_file_node) {
+            .degree  = node->degree,
+            .is_leaf = node->is_leaf,
+        };
+        memcpy(out[i].keys, node->keys, node->degree * sizeof node->keys[0]);
+        if (!node->is_leaf) {
+            for (size_t c = 0; c <= node->degree; c++) {
+                out[i].children[c] = page + next_child++ * sizeof *out;
+            }
+        }
+    }
+
+    size_t key_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        key_count += nodes[i]->degree;
+    }
+
+    *header = (BTree_file_header) {
+        .magic           = BTREE_FILE_MAGIC,
+        .version         = BTREE_FILE_VERSION,
+        .node_size       = sizeof (BTree_file_node),
+        .cache_line_size = CACHE_LINE_SIZE,
+        .max_key         = MAX_KEY,
+        .max_leaf_key    = MAX_LEAF_KEY,
+        .root            = page,
+        .depth           = b->depth,
+        .node_count      = count,
+        .key_count       = key_count,
+        .file_size       = size,
+    };
+
+    if (msync(map, size, MS_SYNC) == -1) {
+        goto msync_failed;
+    }
+    munmap(map, size);
+    if (fsync(fd) == -1 || close(fd) == -1) {
+        goto open_failed;
+    }
+    free(nodes);
+
+    return rename(tmp_path, path);
+
+msync_failed:
+    munmap(map, size);
+mmap_failed:
+ftruncate_failed:
+    close(fd);
+open_failed:
+    unlink(tmp_path);
+snprintf_failed:
+    free(nodes);
+    return -1;
+}
+
+int BTree_file_open(BTree_file* f, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    const size_t size = st.st_size;
+    if (size < sizeof (BTree_file_header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    const BTree_file_header* header = map;
+    if (memcmp(header->magic, BTREE_FILE_MAGIC, sizeof header->magic) != 0
+     || header->version != BTREE_FILE_VERSION
+     || header->node_size != sizeof (BTree_file_node)
+     || header->cache_line_size != CACHE_LINE_SIZE
+     || header->max_key != MAX_KEY
+     || header->max_leaf_key != MAX_LEAF_KEY
+     || header->file_size != size
+     || header->root + sizeof (BTree_file_node) > size) {
+        munmap(map, size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    *f = (BTree_file) {
+        .data   = map,
+        .size   = size,
+        .header = header,
+    };
+    return 0;
+}
+
+int BTree_file_close(BTree_file* f)
+{
+    int ok = munmap((void*)f->data, f->size);
+    f->data   = NULL;
+    f->header = NULL;
+    return ok;
+}
+
+bool BTree_file_find(const BTree_file* f, Key key)
+{
+    const BTree_file_node* node = file_node(f, f->header->root);
+    for (;;) {
+        const size_t i = BTree_keys_lower_bound(node->keys, node->degree, key);
+        if (i < node->degree && node->keys[i] == key) {
+            return true;
+        }
+        if (node->is_leaf) {
+            return false;
+        }
+        node = file_node(f, node->children[i]);
+    }
+}
+
+bool BTree_file_lower_bound(const BTree_file* f, Key key, Key* out)
+{
+    /* the smallest separator above the key seen on the way down is the
+     * answer if the leaf has nothing >= key */
+    bool found = false;
+    const BTree_file_node* node = file_node(f, f->header->root);
+    for (;;) {
+        const size_t i = BTree_keys_lower_bound(node->keys, node->degree, key);
+        if (i < node->degree) {
+            *out  = node->keys[i];
+            found = true;
+            if (node->keys[i] == key) {
+                return true;
+            }
+        }
+        if (node->is_leaf) {
+            return found;
+        }
+        node = file_node(f, node->children[i]);
+    }
+}
+
+static void collect_keys(const BTree_file* f, const BTree_file_node* node, Key* keys, size_t* n)
+{
+    for (size_t i = 0; i <= node->degree; i++) {
+        if (!node->is_leaf) {
+            collect_keys(f, file_node(f, node->children[i]), keys, n);
+        }
+        if (i < node->degree) {
+            keys[(*n)++] = node->keys[i];
+        }
+    }
+}
+
+bool BTree_file_load(const BTree_file* f, BTree* btree, double fill_factor)
+{
+    if (btree->root->degree != 0 || !btree->root->is_leaf) {
+        return false;
+    }
+
+    Key* keys = malloc((f->header->key_count + 1) * sizeof *keys);
+    if (unlikely(!keys)) {
+        abort();
+    }
+    size_t n = 0;
+    collect_keys(f, file_node(f, f->header->root), keys, &n);
+    const bool ok = BTree_bulk_load(btree, keys, n, fill_factor);
+    free(keys);
+    return ok;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "btree.h"
+
+/* On-disk BTree.
+ *
+ * The file is a header page followed by the nodes in level order, starting
+ * at a page boundary. Nodes have the same layout as BTree_node except that
+ * children are byte offsets from the start of the file, so the file can be
+ * mapped anywhere and searched in place without deserializing it. Leaves
+ * and internal nodes take slots of the same size, the larger of the two, and
+ * that size divides the page size, so no node straddles two pages. */
+
+#define BTREE_FILE_MAGIC   "BTREEIDX"
+#define BTREE_FILE_VERSION 2
+
+typedef struct BTree_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint32_t cache_line_size;
+    uint32_t max_key;
+    uint32_t max_leaf_key;
+    uint32_t reserved;
+    uint64_t root;       /* offset of the root node */
+    uint64_t depth;
+    uint64_t node_count;
+    uint64_t key_count;
+    uint64_t file_size;
+} BTree_file_header;
+
+typedef struct BTree_file_node {
+    uint16_t degree;
+    uint8_t  is_leaf;
+    uint8_t  reserved[5];
+    union {
+        Key keys[BTREE_NODE_KEYS];
+        struct {
+            Key      internal_keys_[MAX_KEY];
+            uint64_t children[MAX_CHILDREN];
+        };
+    };
+} __attribute__((aligned(CACHE_LINE_SIZE))) BTree_file_node;
+
+_Static_assert(sizeof (BTree_file_node) == sizeof (BTree_node), "file nodes should match BTree_node");
+
+typedef struct BTree_file {
+    const char*              data;
+    size_t                   size;
+    const BTree_file_header* header;
+} BTree_file;
+
+/**
+ * Write `b` to `path`.
+ * The file is written next to `path` and renamed over it once it is synced,
+ * so readers never see a partially written index.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int BTree_file_write(const BTree* b, const char* path);
+
+/**
+ * Map an index written by BTree_file_write read-only.
+ * Nothing is read up front besides the header, pages are faulted in as
+ * lookups touch them.
+ * Returns 0 on success, -1 on failure with errno set. A file that isn't an
+ * index, or was written with a different node layout, fails with EINVAL.
+ */
+int BTree_file_open(BTree_file* f, const char* path);
+
+/**
+ * Unmap an index opened with BTree_file_open.
+ * Returns 0 on success, -1 on failure.
+ */
+int BTree_file_close(BTree_file* f);
+
+bool BTree_file_find(const BTree_file* f, Key key);
+
+/**
+ * Store the first key >= `key` in `out`.
+ * Returns false if there is no such key.
+ */
+bool BTree_file_lower_bound(const BTree_file* f, Key key, Key* out);
+
+/**
+ * Rebuild an in-memory tree from the index with BTree_bulk_load.
+ * `btree` must be empty.
+ * Returns false if it isn't.
+ */
+bool BTree_file_load(const BTree_file* f, BTree* btree, double fill_factor);
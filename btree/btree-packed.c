@@ -0,0 +1,312 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "arena.h"
+#include "btree.h"
+#include "btree-packed.h"
+#include "btree-static.h"
+
+#define ARRAY_LEN(x) (sizeof x) / sizeof (*(x))
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+
+#define DELTA_BYTES BTREE_PACKED_DELTA_BYTES
+#define KEY_MAX     UINT64_MAX
+
+/* Leaf search kernels, one per delta width.
+ *
+ * Every kernel returns the number of deltas in the leaf < d, where d fits
+ * the width. Unused deltas are all ones and never count, so the whole line
+ * is compared with no masking by the leaf's key count. */
+
+#define DEFINE_RANK_SCALAR(bits)                                          \
+    static size_t rank##bits##_scalar(const uint8_t* deltas, Key d)       \
+    {                                                                     \
+        size_t count = 0;                                                 \
+        for (size_t i = 0; i < DELTA_BYTES; i += sizeof (uint##bits##_t)) { \
+            uint##bits##_t delta;                                         \
+            memcpy(&delta, &deltas[i], sizeof delta);                     \
+            count += delta < d;                                           \
+        }                                                                 \
+        return count;                                                     \
+    }
+
+DEFINE_RANK_SCALAR(8)
+DEFINE_RANK_SCALAR(16)
+DEFINE_RANK_SCALAR(32)
+DEFINE_RANK_SCALAR(64)
+
+#ifdef __x86_64__
+/* AVX2 only compares signed lanes, so both sides are offset by the sign
+ * bit. Lines are compared 32 bytes at a time with a 16 byte tail. */
+#define DEFINE_RANK_AVX2(bits, set1_256, set1_128, cmpgt_256, cmpgt_128)            \
+    __attribute__((target("avx2")))                                                 \
+    static size_t rank##bits##_avx2(const uint8_t* deltas, Key d)                   \
+    {                                                                               \
+        const __m256i sign = set1_256(INT##bits##_MIN);                             \
+        const __m256i dv   = _mm256_xor_si256(set1_256((int##bits##_t)d), sign);    \
+        size_t mask_bits = 0;                                                       \
+        size_t i = 0;                                                               \
+        for (; i + 32 <= DELTA_BYTES; i += 32) {                                    \
+            __m256i a  = _mm256_loadu_si256((const __m256i*)&deltas[i]);            \
+            __m256i lt = cmpgt_256(dv, _mm256_xor_si256(a, sign));                  \
+            mask_bits += __builtin_popcount(_mm256_movemask_epi8(lt));              \
+        }                                                                           \
+        if (i < DELTA_BYTES) {                                                      \
+            const __m128i sign128 = set1_128(INT##bits##_MIN);                      \
+            const __m128i dv128   = _mm_xor_si128(set1_128((int##bits##_t)d), sign128); \
+            __m128i a  = _mm_loadu_si128((const __m128i*)&deltas[i]);               \
+            __m128i lt = cmpgt_128(dv128, _mm_xor_si128(a, sign128));               \
+            mask_bits += __builtin_popcount(_mm_movemask_epi8(lt));                 \
+        }                                                                           \
+        return mask_bits / sizeof (uint##bits##_t);                                 \
+    }
+
+DEFINE_RANK_AVX2(8,  _mm256_set1_epi8,    _mm_set1_epi8,    _mm256_cmpgt_epi8,  _mm_cmpgt_epi8)
+DEFINE_RANK_AVX2(16, _mm256_set1_epi16,   _mm_set1_epi16,   _mm256_cmpgt_epi16, _mm_cmpgt_epi16)
+DEFINE_RANK_AVX2(32, _mm256_set1_epi32,   _mm_set1_epi32,   _mm256_cmpgt_epi32, _mm_cmpgt_epi32)
+DEFINE_RANK_AVX2(64, _mm256_set1_epi64x,  _mm_set1_epi64x,  _mm256_cmpgt_epi64, _mm_cmpgt_epi64)
+
+/* Lines are compared 64 bytes at a time, the tail with a masked load */
+#define DEFINE_RANK_AVX512(bits)                                                    \
+    __attribute__((target("avx512bw")))                                             \
+    static size_t rank##bits##_avx512(const uint8_t* deltas, Key d)                 \
+    {                                                                               \
+        const __m512i dv = _mm512_set1_epi##bits((int##bits##_t)d);                 \
+        size_t count = 0;                                                           \
+        size_t i = 0;                                                               \
+        for (; i + 64 <= DELTA_BYTES; i += 64) {                                    \
+            __m512i a = _mm512_loadu_si512(&deltas[i]);                             \
+            count += __builtin_popcountll(_mm512_cmplt_epu##bits##_mask(a, dv));    \
+        }                                                                           \
+        if (i < DELTA_BYTES) {                                                      \
+            const size_t tail = (DELTA_BYTES - i) / sizeof (uint##bits##_t);        \
+            const uint64_t bytes = ((uint64_t)1 << (DELTA_BYTES - i)) - 1;          \
+            const uint64_t used  = ((uint64_t)1 << tail) - 1;                       \
+            __m512i a = _mm512_maskz_loadu_epi8(bytes, &deltas[i]);                 \
+            count += __builtin_popcountll(_mm512_mask_cmplt_epu##bits##_mask(used, a, dv)); \
+        }                                                                           \
+        return count;                                                               \
+    }
+
+DEFINE_RANK_AVX512(8)
+DEFINE_RANK_AVX512(16)
+DEFINE_RANK_AVX512(32)
+DEFINE_RANK_AVX512(64)
+
+static bool cpu_has_avx2(void)   { return __builtin_cpu_supports("avx2"); }
+static bool cpu_has_avx512(void) { return __builtin_cpu_supports("avx512bw"); }
+#endif /* __x86_64__ */
+
+static bool cpu_has_nothing(void) { return true; }
+
+/* ordered by preference, the first supported kernel is picked at startup */
+static const struct packed_kernel {
+    size_t (*rank[4])(const uint8_t* deltas, Key d); /* indexed by delta shift */
+    bool   (*supported)(void);
+} packed_kernels[] = {
+#ifdef __x86_64__
+    { { rank8_avx512, rank16_avx512, rank32_avx512, rank64_avx512 }, cpu_has_avx512 },
+    { { rank8_avx2,   rank16_avx2,   rank32_avx2,   rank64_avx2   }, cpu_has_avx2   },
+#endif
+    { { rank8_scalar, rank16_scalar, rank32_scalar, rank64_scalar }, cpu_has_nothing },
+};
+
+static const struct packed_kernel* packed_kernel = &packed_kernels[ARRAY_LEN(packed_kernels) - 1];
+
+__attribute__((constructor))
+static void select_packed_kernel(void)
+{
+    __builtin_cpu_init();
+    for (size_t i = 0; i < ARRAY_LEN(packed_kernels); i++) {
+        if (packed_kernels[i].supported()) {
+            packed_kernel = &packed_kernels[i];
+            return;
+        }
+    }
+}
+
+static inline Key delta_max(size_t shift)
+{
+    return shift == 3 ? KEY_MAX : ((Key)1 << (8 << shift)) - 1;
+}
+
+static inline Key load_delta(const BTree_packed_leaf* leaf, size_t i)
+{
+    const uint8_t* p = &leaf->deltas[i << leaf->shift];
+    switch (leaf->shift) {
+    case 0:  return *p;
+    case 1:  { uint16_t d; memcpy(&d, p, sizeof d); return d; }
+    case 2:  { uint32_t d; memcpy(&d, p, sizeof d); return d; }
+    default: { uint64_t d; memcpy(&d, p, sizeof d); return d; }
+    }
+}
+
+static inline void store_delta(BTree_packed_leaf* leaf, size_t i, Key delta)
+{
+    uint8_t* p = &leaf->deltas[i << leaf->shift];
+    switch (leaf->shift) {
+    case 0:  *p = (uint8_t)delta; break;
+    case 1:  { uint16_t d = (uint16_t)delta; memcpy(p, &d, sizeof d); break; }
+    case 2:  { uint32_t d = (uint32_t)delta; memcpy(p, &d, sizeof d); break; }
+    default: memcpy(p, &delta, sizeof delta); break;
+    }
+}
+
+static inline Key leaf_key(const BTree_packed_leaf* leaf, size_t i)
+{
+    return i == 0 ? leaf->base : leaf->base + load_delta(leaf, i - 1);
+}
+
+/* Index of the first key >= x in `leaf`, where x >= the leaf's base */
+static inline size_t leaf_rank(const BTree_packed_leaf* leaf, Key x)
+{
+    const Key d = x - leaf->base;
+    if (d == 0) {
+        return 0;
+    }
+    if (d > delta_max(leaf->shift)) {
+        return leaf->count;
+    }
+    return 1 + packed_kernel->rank[leaf->shift](leaf->deltas, d);
+}
+
+/* Number of keys from keys[0] that fit one leaf with deltas of 1 << shift
+ * bytes */
+static size_t leaf_fit(const Key* keys, size_t n, size_t shift)
+{
+    const size_t cap = DELTA_BYTES >> shift;
+    const Key    max = delta_max(shift);
+    size_t count = 1;
+    while (count < n && count - 1 < cap && keys[count] - keys[0] <= max) {
+        count++;
+    }
+    return count;
+}
+
+/* The delta shift that fits the most keys in a leaf starting at keys[0],
+ * the narrowest on a tie */
+static size_t choose_shift(const Key* keys, size_t n, size_t* count)
+{
+    size_t best = 0;
+    *count = leaf_fit(keys, n, 0);
+    for (size_t shift = 1; shift < 4; shift++) {
+        const size_t c = leaf_fit(keys, n, shift);
+        if (c > *count) {
+            best   = shift;
+            *count = c;
+        }
+    }
+    return best;
+}
+
+void BTree_packed_init_sorted(struct arena* a, BTree_packed* p, const Key* keys, size_t n)
+{
+    *p = (BTree_packed) { .n = n };
+
+    /* pack twice, first to count the leaves */
+    size_t count;
+    for (size_t i = 0; i < n; i += count) {
+        choose_shift(&keys[i], n - i, &count);
+        p->leaf_count++;
+    }
+
+    Key* bases = malloc((p->leaf_count > 0 ? p->leaf_count : 1) * sizeof *bases);
+    if (p->leaf_count > 0) {
+        p->leaves = arena_alloc(a, p->leaf_count * sizeof *p->leaves);
+    }
+    if (unlikely(!bases || (p->leaf_count > 0 && !p->leaves))) {
+        abort();
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < n; i += count, k++) {
+        BTree_packed_leaf* leaf = &p->leaves[k];
+        const size_t shift = choose_shift(&keys[i], n - i, &count);
+        leaf->base  = bases[k] = keys[i];
+        leaf->shift = shift;
+        leaf->count = count;
+        memset(leaf->deltas, 0xff, sizeof leaf->deltas);
+        for (size_t j = 1; j < count; j++) {
+            store_delta(leaf, j - 1, keys[i + j] - keys[i]);
+        }
+        p->shift_count[shift]++;
+    }
+
+    BTree_static_init_sorted(a, &p->index, bases, p->leaf_count);
+    free(bases);
+}
+
+void BTree_packed_init(struct arena* a, BTree_packed* p, const BTree* btree)
+{
+    size_t n = 0;
+    BTree_cursor c;
+    for (bool more = BTree_first(btree, &c); more; more = BTree_next(&c)) {
+        n++;
+    }
+    Key* keys = malloc((n > 0 ? n : 1) * sizeof *keys);
+    if (unlikely(!keys)) {
+        abort();
+    }
+    size_t i = 0;
+    for (bool more = BTree_first(btree, &c); more; more = BTree_next(&c)) {
+        keys[i++] = BTree_cursor_key(&c);
+    }
+    BTree_packed_init_sorted(a, p, keys, n);
+    free(keys);
+}
+
+BTree_packed* BTree_packed_new(struct arena* a, const BTree* btree)
+{
+    BTree_packed* p = arena_alloc(a, sizeof *p);
+    if (unlikely(!p)) {
+        abort();
+    }
+    BTree_packed_init(a, p, btree);
+    return p;
+}
+
+/* Find the leaf and the index in it of the first key >= x.
+ * Returns false if there is no such key. */
+static bool locate(const BTree_packed* p, Key x, size_t* leaf, size_t* i)
+{
+    /* the index's sorted keys are the bases, the leaf to search is the
+     * last one with a base <= x */
+    const size_t r = BTree_static_rank(&p->index, x);
+    if (r == 0 || (r < p->leaf_count && p->index.keys[r] == x)) {
+        *leaf = r;
+        *i    = 0;
+        return r < p->leaf_count;
+    }
+    *leaf = r - 1;
+    *i    = leaf_rank(&p->leaves[r - 1], x);
+    if (*i < p->leaves[r - 1].count) {
+        return true;
+    }
+    /* every key in the leaf is smaller, the answer is the next base */
+    *leaf = r;
+    *i    = 0;
+    return r < p->leaf_count;
+}
+
+bool BTree_packed_find(const BTree_packed* p, Key key)
+{
+    size_t leaf, i;
+    return locate(p, key, &leaf, &i) && leaf_key(&p->leaves[leaf], i) == key;
+}
+
+bool BTree_packed_lower_bound(const BTree_packed* p, Key key, Key* out)
+{
+    size_t leaf, i;
+    if (!locate(p, key, &leaf, &i)) {
+        return false;
+    }
+    *out = leaf_key(&p->leaves[leaf], i);
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "btree.h"
+#include "btree-static.h"
+
+/* Read-only snapshot of a BTree with frame-of-reference compressed leaves.
+ *
+ * Every leaf is one cache line holding a base key and the distance of the
+ * keys after it from the base, as 8, 16, 32 or 64 bit deltas. Leaves are
+ * packed greedily with the narrowest deltas that fit the most keys, so dense
+ * ids take one byte per key and sparse ones fall back to whole keys.
+ *
+ * Leaves are searched without decoding them: the base is subtracted from the
+ * key once and the difference compared against every delta at their width.
+ * Unused deltas hold the largest value of their width, which is never less
+ * than a difference that fits the width, so full lines are compared.
+ *
+ * The bases are indexed by a BTree_static, which is small next to the
+ * leaves as it has one key per leaf. */
+
+#define BTREE_PACKED_DELTA_BYTES (CACHE_LINE_SIZE - 16)
+
+typedef struct BTree_packed_leaf {
+    Key     base;
+    uint8_t shift; /* deltas are 1 << shift bytes */
+    uint8_t count; /* keys in the leaf, the base included */
+    uint8_t deltas[BTREE_PACKED_DELTA_BYTES] __attribute__((aligned(16)));
+} __attribute__((aligned(CACHE_LINE_SIZE))) BTree_packed_leaf;
+
+_Static_assert(sizeof (BTree_packed_leaf) == CACHE_LINE_SIZE, "packed leaf spills over a cache line");
+_Static_assert(BTREE_PACKED_DELTA_BYTES + 1 <= UINT8_MAX, "packed leaf count doesn't fit a byte");
+
+typedef struct BTree_packed {
+    BTree_static       index; /* base of every leaf */
+    BTree_packed_leaf* leaves;
+    size_t             leaf_count;
+    size_t             n;
+    size_t             shift_count[4]; /* leaves by their delta shift */
+} BTree_packed;
+
+/**
+ * Allocate a packed snapshot of `btree` in arena `a`.
+ * The snapshot doesn't reference the tree, which can be changed or deleted
+ * afterwards.
+ * Aborts if the arena is out of memory.
+ */
+BTree_packed* BTree_packed_new(struct arena* a, const BTree* btree);
+
+void BTree_packed_init(struct arena* a, BTree_packed* p, const BTree* btree);
+
+/**
+ * Build a packed snapshot of `n` strictly ascending keys.
+ * Aborts if the arena is out of memory.
+ */
+void BTree_packed_init_sorted(struct arena* a, BTree_packed* p, const Key* keys, size_t n);
+
+bool BTree_packed_find(const BTree_packed* p, Key key);
+
+/**
+ * Store the first key >= `key` in `out`.
+ * Returns false if there is no such key.
+ */
+bool BTree_packed_lower_bound(const BTree_packed* p, Key key, Key* out);
+
+/**
+ * Bytes used by the leaves and their index, padding included.
+ */
+static inline size_t BTree_packed_size(const BTree_packed* p)
+{
+    return p->leaf_count * sizeof (BTree_packed_leaf) + BTree_static_size(&p->index);
+}
@@ -0,0 +1,263 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "arena.h"
+#include "btree.h"
+#include "btree-static.h"
+
+#define ARRAY_LEN(x) (sizeof x) / sizeof (*(x))
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+
+#define B        BTREE_STATIC_B
+#define KEY_MAX  UINT64_MAX
+
+/* lookups descended together by BTree_static_find_batch */
+#define BATCH 16
+
+/* Block search kernels.
+ *
+ * Blocks are always full and aligned, so unlike the BTree node kernels
+ * there are no masked lanes and the loops have a constant trip count.
+ * Every kernel returns the number of keys in the block < x. */
+
+static inline size_t rank_scalar(const Key* block, Key x)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < B; i++) {
+        count += block[i] < x;
+    }
+    return count;
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static inline size_t rank_avx2(const Key* block, Key x)
+{
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m256i xv   = _mm256_xor_si256(_mm256_set1_epi64x((long long)x), sign);
+    size_t count = 0;
+    for (size_t i = 0; i < B; i += 4) {
+        __m256i a  = _mm256_load_si256((const __m256i*)&block[i]);
+        __m256i lt = _mm256_cmpgt_epi64(xv, _mm256_xor_si256(a, sign));
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+    }
+    return count;
+}
+
+__attribute__((target("avx512f")))
+static inline size_t rank_avx512(const Key* block, Key x)
+{
+    const __m512i xv = _mm512_set1_epi64((long long)x);
+    size_t count = 0;
+    for (size_t i = 0; i < B; i += 8) {
+        __m512i a = _mm512_load_si512(&block[i]);
+        count += __builtin_popcount(_mm512_cmplt_epu64_mask(a, xv));
+    }
+    return count;
+}
+#endif /* __x86_64__ */
+
+/* Index of the first key >= x in the leaf layer, or s->n if there is none.
+ *
+ * Above the leaves the child to take is the number of separators <= x,
+ * which is the rank of x + 1. The leaf block reached holds the keys from
+ * the smallest one >= its separator, so the answer is either in it or is
+ * the first key of the next block, which is also the next index. KEY_MAX
+ * has no x + 1 and is checked against the last key directly. */
+#define DEFINE_SEARCH(name, attr, rank)                                                   \
+    attr static size_t search_##name(const BTree_static* s, Key x)                        \
+    {                                                                                     \
+        if (unlikely(x == KEY_MAX)) {                                                     \
+            return s->n > 0 && s->keys[s->n - 1] == KEY_MAX ? s->n - 1 : s->n;            \
+        }                                                                                 \
+        size_t k = 0;                                                                     \
+        for (size_t h = s->height - 1; h > 0; h--) {                                      \
+            k = k * (B + 1) + rank(&s->keys[(s->offset[h] + k) * B], x + 1);              \
+        }                                                                                 \
+        return k * B + rank(&s->keys[k * B], x);                                          \
+    }                                                                                     \
+                                                                                          \
+    attr static size_t find_batch_##name(const BTree_static* s, const Key* keys,          \
+                                         size_t n, bool* found)                           \
+    {                                                                                     \
+        size_t count = 0;                                                                 \
+        for (size_t base = 0; base < n; base += BATCH) {                                  \
+            const size_t m = n - base < BATCH ? n - base : BATCH;                         \
+            const Key* x = &keys[base];                                                   \
+            size_t k[BATCH] = { 0 };                                                      \
+            for (size_t h = s->height - 1; h > 0; h--) {                                  \
+                for (size_t q = 0; q < m; q++) {                                          \
+                    const Key y = x[q] == KEY_MAX ? KEY_MAX : x[q] + 1;                   \
+                    k[q] = k[q] * (B + 1) + rank(&s->keys[(s->offset[h] + k[q]) * B], y); \
+                    __builtin_prefetch(&s->keys[(s->offset[h - 1] + k[q]) * B]);          \
+                }                                                                         \
+            }                                                                             \
+            for (size_t q = 0; q < m; q++) {                                              \
+                size_t i = x[q] == KEY_MAX ? s->n - (s->n > 0)                            \
+                                           : k[q] * B + rank(&s->keys[k[q] * B], x[q]);   \
+                found[base + q] = i < s->n && s->keys[i] == x[q];                         \
+                count += found[base + q];                                                 \
+            }                                                                             \
+        }                                                                                 \
+        return count;                                                                     \
+    }
+
+DEFINE_SEARCH(scalar, , rank_scalar)
+#ifdef __x86_64__
+DEFINE_SEARCH(avx2,   __attribute__((target("avx2"))),    rank_avx2)
+DEFINE_SEARCH(avx512, __attribute__((target("avx512f"))), rank_avx512)
+
+static bool cpu_has_avx2(void)   { return __builtin_cpu_supports("avx2"); }
+static bool cpu_has_avx512(void) { return __builtin_cpu_supports("avx512f"); }
+#endif /* __x86_64__ */
+
+static bool cpu_has_nothing(void) { return true; }
+
+/* ordered by preference, the first supported kernel is picked at startup */
+static const struct static_kernel {
+    size_t (*search)(const BTree_static* s, Key x);
+    size_t (*find_batch)(const BTree_static* s, const Key* keys, size_t n, bool* found);
+    bool   (*supported)(void);
+} static_kernels[] = {
+#ifdef __x86_64__
+    { search_avx512, find_batch_avx512, cpu_has_avx512 },
+    { search_avx2,   find_batch_avx2,   cpu_has_avx2   },
+#endif
+    { search_scalar, find_batch_scalar, cpu_has_nothing },
+};
+
+static const struct static_kernel* static_kernel = &static_kernels[ARRAY_LEN(static_kernels) - 1];
+
+__attribute__((constructor))
+static void select_static_kernel(void)
+{
+    __builtin_cpu_init();
+    for (size_t i = 0; i < ARRAY_LEN(static_kernels); i++) {
+        if (static_kernels[i].supported()) {
+            static_kernel = &static_kernels[i];
+            return;
+        }
+    }
+}
+
+static size_t key_count(const BTree* btree)
+{
+    size_t n = 0;
+    BTree_cursor c;
+    for (bool more = BTree_first(btree, &c); more; more = BTree_next(&c)) {
+        n++;
+    }
+    return n;
+}
+
+/* Allocate the layers for `n` keys, leaving the leaf layer to be filled */
+static void alloc_layers(struct arena* a, BTree_static* s, size_t n)
+{
+    /* layer sizes in blocks, a layer has one block per B+1 blocks below it */
+    size_t blocks = n > 0 ? (n + B - 1) / B : 1;
+    size_t height = 1;
+    size_t total  = blocks;
+    size_t offset[BTREE_MAX_DEPTH] = { 0 };
+    while (blocks > 1) {
+        offset[height] = total;
+        blocks = (blocks + B) / (B + 1);
+        total += blocks;
+        height++;
+    }
+
+    *s = (BTree_static) {
+        .keys   = arena_alloc(a, total * B * sizeof (Key)),
+        .n      = n,
+        .blocks = total,
+        .height = height,
+    };
+    if (unlikely(!s->keys)) {
+        abort();
+    }
+    memcpy(s->offset, offset, sizeof offset);
+}
+
+/* Pad the filled leaf layer and build the layers above it */
+static void build_layers(BTree_static* s)
+{
+    const size_t leaves = s->height > 1 ? s->offset[1] : s->blocks;
+    for (size_t i = s->n; i < leaves * B; i++) {
+        s->keys[i] = KEY_MAX;
+    }
+
+    /* separator j of block k is the smallest key under child j+1, which is
+     * the first key of the leftmost leaf block below that child */
+    size_t span = 1; /* leaf blocks under one block of the layer below */
+    for (size_t h = 1; h < s->height; h++) {
+        const size_t end = h + 1 < s->height ? s->offset[h + 1] : s->blocks;
+        Key* layer = &s->keys[s->offset[h] * B];
+        for (size_t k = 0; k < end - s->offset[h]; k++) {
+            for (size_t j = 0; j < B; j++) {
+                const size_t leaf = (k * (B + 1) + j + 1) * span;
+                layer[k * B + j] = leaf < leaves ? s->keys[leaf * B] : KEY_MAX;
+            }
+        }
+        span *= B + 1;
+    }
+}
+
+void BTree_static_init(struct arena* a, BTree_static* s, const BTree* btree)
+{
+    alloc_layers(a, s, key_count(btree));
+    size_t i = 0;
+    BTree_cursor c;
+    for (bool more = BTree_first(btree, &c); more; more = BTree_next(&c)) {
+        s->keys[i++] = BTree_cursor_key(&c);
+    }
+    build_layers(s);
+}
+
+void BTree_static_init_sorted(struct arena* a, BTree_static* s, const Key* keys, size_t n)
+{
+    alloc_layers(a, s, n);
+    memcpy(s->keys, keys, n * sizeof *keys);
+    build_layers(s);
+}
+
+BTree_static* BTree_static_new(struct arena* a, const BTree* btree)
+{
+    BTree_static* s = arena_alloc(a, sizeof *s);
+    if (unlikely(!s)) {
+        abort();
+    }
+    BTree_static_init(a, s, btree);
+    return s;
+}
+
+size_t BTree_static_rank(const BTree_static* s, Key key)
+{
+    return static_kernel->search(s, key);
+}
+
+bool BTree_static_find(const BTree_static* s, Key key)
+{
+    const size_t i = static_kernel->search(s, key);
+    return i < s->n && s->keys[i] == key;
+}
+
+bool BTree_static_lower_bound(const BTree_static* s, Key key, Key* out)
+{
+    const size_t i = static_kernel->search(s, key);
+    if (i >= s->n) {
+        return false;
+    }
+    *out = s->keys[i];
+    return true;
+}
+
+size_t BTree_static_find_batch(const BTree_static* s, const Key* keys, size_t n, bool* found)
+{
+    return static_kernel->find_batch(s, keys, n, found);
+}
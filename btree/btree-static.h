@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "btree.h"
+
+/* Read-only snapshot of a BTree in an implicit B-tree layout (S+tree).
+ *
+ * Keys are stored in blocks of one cache line, with no pointers at all.
+ * The leaf layer is every key in order, padded to a whole block, and each
+ * layer above it holds, for every block, the smallest key of children 1..B
+ * of that block. The children of block k in the next layer down are blocks
+ * k*(B+1) .. k*(B+1)+B, so descending is a block search plus a multiply.
+ *
+ * Layers are stored leaves first, so the leaf layer doubles as a sorted
+ * array of all keys. */
+
+#define BTREE_STATIC_B (CACHE_LINE_SIZE / sizeof (Key))
+
+typedef struct BTree_static {
+    Key*   keys;
+    size_t n;      /* number of keys */
+    size_t blocks; /* blocks over all layers */
+    size_t height; /* number of layers, including the leaves */
+    size_t offset[BTREE_MAX_DEPTH]; /* first block of every layer */
+} BTree_static;
+
+/**
+ * Allocate a snapshot of `btree` in arena `a`.
+ * The snapshot doesn't reference the tree, which can be changed or deleted
+ * afterwards.
+ * Aborts if the arena is out of memory.
+ */
+BTree_static* BTree_static_new(struct arena* a, const BTree* btree);
+
+void BTree_static_init(struct arena* a, BTree_static* s, const BTree* btree);
+
+/**
+ * Build a snapshot of `n` strictly ascending keys.
+ * Aborts if the arena is out of memory.
+ */
+void BTree_static_init_sorted(struct arena* a, BTree_static* s, const Key* keys, size_t n);
+
+/**
+ * Index of the first key >= `key` in the sorted keys of the snapshot, or
+ * the number of keys if there is none.
+ */
+size_t BTree_static_rank(const BTree_static* s, Key key);
+
+bool BTree_static_find(const BTree_static* s, Key key);
+
+/**
+ * Store the first key >= `key` in `out`.
+ * Returns false if there is no such key.
+ */
+bool BTree_static_lower_bound(const BTree_static* s, Key key, Key* out);
+
+/**
+ * Look up `n` keys at once, setting found[i] if keys[i] is present.
+ * Lookups are descended one layer at a time in groups, prefetching the
+ * next block of every lookup in the group before searching any of them,
+ * so the cache misses of a group overlap.
+ * Returns the number of keys found.
+ */
+size_t BTree_static_find_batch(const BTree_static* s, const Key* keys, size_t n, bool* found);
+
+/**
+ * Bytes used by the snapshot's keys, padding included.
+ */
+static inline size_t BTree_static_size(const BTree_static* s)
+{
+    return s->blocks * BTREE_STATIC_B * sizeof (Key);
+}
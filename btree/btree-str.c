@@ -0,0 +1,372 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "btree-str.h"
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+#define likely(expr) __builtin_expect(expr, 1)
+
+#define MAX_STR_KEY BTREE_STR_MAX_KEY
+
+/* slots are bump allocated from pages of this size, so short keys don't
+ * each take up a cache line aligned arena allocation */
+#define SLOT_PAGE_SIZE (64 * 1024)
+
+static BTree_str_node* alloc_node(BTree_str* btree, bool is_leaf)
+{
+    BTree_str_node* node = arena_alloc(btree->arena, sizeof *node);
+    if (unlikely(!node)) {
+        abort();
+    }
+    node->degree     = 0;
+    node->is_leaf    = is_leaf;
+    node->fence_len  = 0;
+    node->prefix_len = 0;
+    btree->node_count++;
+    return node;
+}
+
+static BTree_str_slot* new_slot(BTree_str* btree, const char* key, size_t len)
+{
+    const size_t size = (sizeof (BTree_str_slot) + len + _Alignof (BTree_str_slot) - 1)
+                      & ~(_Alignof (BTree_str_slot) - 1);
+    if (unlikely(size > btree->slot_left)) {
+        const size_t page = size > SLOT_PAGE_SIZE ? size : SLOT_PAGE_SIZE;
+        btree->slot_next = arena_alloc(btree->arena, page);
+        btree->slot_left = page;
+        if (unlikely(!btree->slot_next)) {
+            abort();
+        }
+    }
+    BTree_str_slot* slot = (BTree_str_slot*)btree->slot_next;
+    btree->slot_next += size;
+    btree->slot_left -= size;
+
+    slot->len = len;
+    memcpy(slot->data, key, len);
+    return slot;
+}
+
+/* The first 4 bytes of a key as a big-endian integer, zero padded, so
+ * heads order like the keys do except that ties need a full compare */
+static inline uint32_t key_head(const char* key, size_t len)
+{
+    if (likely(len >= sizeof (uint32_t))) {
+        uint32_t head;
+        memcpy(&head, key, sizeof head);
+        return __builtin_bswap32(head);
+    }
+    uint32_t head = 0;
+    for (size_t i = 0; i < sizeof head; i++) {
+        head = head << 8 | (i < len ? (uint8_t)key[i] : 0);
+    }
+    return head;
+}
+
+/* Compare `key` to `slot`, skipping the first `skip` bytes they share */
+static inline int compare(const char* key, size_t len, const BTree_str_slot* slot, size_t skip)
+{
+    const size_t a = len - skip;
+    const size_t b = slot->len - skip;
+    const int c = memcmp(key + skip, slot->data + skip, a < b ? a : b);
+    return c != 0 ? c : (a > b) - (a < b);
+}
+
+static size_t common_prefix(const BTree_str_slot* a, const BTree_str_slot* b, size_t from)
+{
+    const size_t max = a->len < b->len ? a->len : b->len;
+    size_t n = from;
+    while (n < max && n < UINT16_MAX && a->data[n] == b->data[n]) {
+        n++;
+    }
+    return n;
+}
+
+/* Length of the common prefix of the fences `lo` and `hi`, either of which
+ * is NULL on the outer edge of the tree */
+static size_t fence_prefix(const BTree_str_slot* lo, const BTree_str_slot* hi)
+{
+    return lo && hi ? common_prefix(lo, hi, 0) : 0;
+}
+
+/* The keys are sorted, so what the first and last share all of them do */
+static size_t keys_prefix(const BTree_str_node* node)
+{
+    if (node->degree == 0) {
+        return node->fence_len;
+    }
+    return common_prefix(node->slots[0], node->slots[node->degree - 1], node->fence_len);
+}
+
+static void set_prefix(BTree_str_node* node, size_t prefix_len)
+{
+    node->prefix_len = prefix_len;
+    for (size_t i = 0; i < node->degree; i++) {
+        const BTree_str_slot* slot = node->slots[i];
+        node->heads[i] = key_head(slot->data + prefix_len, slot->len - prefix_len);
+    }
+}
+
+static void update_prefix(BTree_str_node* node)
+{
+    const size_t p = keys_prefix(node);
+    if (p != node->prefix_len) {
+        set_prefix(node, p);
+    }
+}
+
+/* Index of the first key >= `key` in `node`, setting `found` if it's equal.
+ * Only keys whose head ties with the key's head are read from their slot. */
+static size_t node_search(const BTree_str_node* node, const char* key, size_t len, bool* found)
+{
+    const size_t f = node->fence_len;
+    const size_t p = node->prefix_len;
+    if (p > f) {
+        /* a key without the prefix is below or above all of them */
+        const size_t n = len < p ? len : p;
+        const int c = memcmp(key + f, node->slots[0]->data + f, n - f);
+        if (c != 0 || len < p) {
+            *found = false;
+            return c > 0 ? node->degree : 0;
+        }
+    }
+
+    const uint32_t h = key_head(key + p, len - p);
+    size_t i = 0;
+    for (size_t j = 0; j < node->degree; j++) {
+        i += node->heads[j] < h;
+    }
+    size_t end = i;
+    while (end < node->degree && node->heads[end] == h) {
+        end++;
+    }
+
+    /* binary search the keys whose heads tie */
+    while (i < end) {
+        const size_t m = i + (end - i) / 2;
+        const int c = compare(key, len, node->slots[m], p);
+        if (c > 0) {
+            i = m + 1;
+        } else if (c < 0) {
+            end = m;
+        } else {
+            *found = true;
+            return m;
+        }
+    }
+    *found = false;
+    return i;
+}
+
+/* Put `slot` at keys[i] of `node`. A new first or last key can shorten the
+ * prefix the keys share, which changes every head. */
+static void insert_key(BTree_str_node* node, size_t i, BTree_str_slot* slot)
+{
+    memmove(&node->slots[i+1], &node->slots[i], (node->degree - i) * sizeof node->slots[0]);
+    memmove(&node->heads[i+1], &node->heads[i], (node->degree - i) * sizeof node->heads[0]);
+    node->slots[i] = slot;
+    node->degree++;
+    if (i == 0 || i == node->degree - 1u) {
+        const size_t p = keys_prefix(node);
+        if (p != node->prefix_len) {
+            set_prefix(node, p);
+            return;
+        }
+    }
+    const size_t p = node->prefix_len;
+    node->heads[i] = key_head(slot->data + p, slot->len - p);
+}
+
+/* Split the full children[i] of `parent` around its middle key, where `lo`
+ * and `hi` are the fences of the child. */
+static void split_child(BTree_str* btree, BTree_str_node* parent, size_t i,
+                        const BTree_str_slot* lo, const BTree_str_slot* hi)
+{
+    BTree_str_node* child = parent->children[i];
+    BTree_str_node* right = alloc_node(btree, child->is_leaf);
+    const size_t mid = MAX_STR_KEY / 2;
+    BTree_str_slot* sep = child->slots[mid];
+
+    right->degree = child->degree - mid - 1;
+    memcpy(right->slots, &child->slots[mid + 1], right->degree * sizeof right->slots[0]);
+    memcpy(right->heads, &child->heads[mid + 1], right->degree * sizeof right->heads[0]);
+    if (!child->is_leaf) {
+        memcpy(right->children, &child->children[mid + 1], (right->degree + 1) * sizeof right->children[0]);
+    }
+    child->degree = mid;
+
+    memmove(&parent->children[i+2], &parent->children[i+1], (parent->degree - i) * sizeof parent->children[0]);
+    parent->children[i+1] = right;
+    insert_key(parent, i, sep);
+
+    /* the halves have narrower fences and fewer keys, so both prefixes
+     * can only grow */
+    child->fence_len  = fence_prefix(lo, sep);
+    right->fence_len  = fence_prefix(sep, hi);
+    right->prefix_len = child->prefix_len;
+    update_prefix(child);
+    update_prefix(right);
+}
+
+void BTree_str_init(struct arena* a, BTree_str* btree)
+{
+    *btree = (BTree_str) {
+        .arena = a,
+    };
+    btree->root = alloc_node(btree, true);
+}
+
+BTree_str* BTree_str_new(struct arena* a)
+{
+    BTree_str* btree = arena_alloc(a, sizeof *btree);
+    if (unlikely(!btree)) {
+        abort();
+    }
+    BTree_str_init(a, btree);
+    return btree;
+}
+
+bool BTree_str_insert(BTree_str* btree, const char* key, size_t len)
+{
+    if (unlikely(btree->root->degree == MAX_STR_KEY)) {
+        BTree_str_node* root = alloc_node(btree, false);
+        root->children[0] = btree->root;
+        btree->root = root;
+        btree->depth++;
+        split_child(btree, root, 0, NULL, NULL);
+    }
+
+    /* split full nodes on the way down, keeping track of the fences of the
+     * node we are in */
+    BTree_str_node* node = btree->root;
+    const BTree_str_slot* lo = NULL;
+    const BTree_str_slot* hi = NULL;
+    size_t i;
+    for (;;) {
+        bool found;
+        i = node_search(node, key, len, &found);
+        if (found) {
+            return false;
+        }
+        if (node->is_leaf) {
+            break;
+        }
+
+        const BTree_str_slot* child_lo = i > 0 ? node->slots[i - 1] : lo;
+        const BTree_str_slot* child_hi = i < node->degree ? node->slots[i] : hi;
+        if (unlikely(node->children[i]->degree == MAX_STR_KEY)) {
+            split_child(btree, node, i, child_lo, child_hi);
+            const int c = compare(key, len, node->slots[i], node->fence_len);
+            if (c == 0) {
+                return false;
+            }
+            if (c > 0) {
+                child_lo = node->slots[i];
+                i++;
+            } else {
+                child_hi = node->slots[i];
+            }
+        }
+        lo   = child_lo;
+        hi   = child_hi;
+        node = node->children[i];
+    }
+
+    insert_key(node, i, new_slot(btree, key, len));
+    btree->count++;
+    return true;
+}
+
+bool BTree_str_find(const BTree_str* btree, const char* key, size_t len)
+{
+    const BTree_str_node* node = btree->root;
+    for (;;) {
+        bool found;
+        const size_t i = node_search(node, key, len, &found);
+        if (found) {
+            return true;
+        }
+        if (node->is_leaf) {
+            return false;
+        }
+        node = node->children[i];
+    }
+}
+
+static void descend_leftmost(BTree_str_cursor* c, BTree_str_node* node)
+{
+    while (!node->is_leaf) {
+        c->path[c->depth++] = (struct BTree_str_path) { .node = node, .index = 0 };
+        node = node->children[0];
+    }
+    c->path[c->depth++] = (struct BTree_str_path) { .node = node, .index = 0 };
+}
+
+bool BTree_str_first(const BTree_str* btree, BTree_str_cursor* cursor)
+{
+    cursor->depth = 0;
+    if (btree->root->degree == 0) {
+        return false;
+    }
+    descend_leftmost(cursor, btree->root);
+    return true;
+}
+
+bool BTree_str_next(BTree_str_cursor* c)
+{
+    struct BTree_str_path* top = &c->path[c->depth - 1];
+
+    if (!top->node->is_leaf) {
+        /* successor is the leftmost key in the right subtree */
+        top->index++;
+        descend_leftmost(c, top->node->children[top->index]);
+        return true;
+    }
+
+    if (likely(top->index + 1 < top->node->degree)) {
+        top->index++;
+        return true;
+    }
+
+    /* climb until we return from a child that has a key to its right */
+    while (--c->depth > 0) {
+        top = &c->path[c->depth - 1];
+        if (top->index < top->node->degree) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BTree_str_lower_bound(const BTree_str* btree, const char* key, size_t len, BTree_str_cursor* cursor)
+{
+    cursor->depth = 0;
+    BTree_str_node* node = btree->root;
+    for (;;) {
+        bool found;
+        const size_t i = node_search(node, key, len, &found);
+        cursor->path[cursor->depth++] = (struct BTree_str_path) { .node = node, .index = i };
+
+        if (found) {
+            return true;
+        }
+        if (node->is_leaf) {
+            if (i < node->degree) {
+                return true;
+            }
+            if (i == 0) {
+                /* only an empty root leaf can get here */
+                cursor->depth = 0;
+                return false;
+            }
+            /* every key in this leaf is smaller, the answer is the
+             * successor of the last one */
+            cursor->path[cursor->depth - 1].index = i - 1;
+            return BTree_str_next(cursor);
+        }
+        node = node->children[i];
+    }
+}
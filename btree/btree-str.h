@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "btree.h"
+
+/* B-tree over variable-length byte string keys, ordered like memcmp with
+ * shorter keys first.
+ *
+ * Key bytes are copied once into slots packed in the tree's arena, and
+ * nodes only point at them. Each node also keeps a 4 byte big-endian head
+ * of every key, taken after the prefix that every key in the node shares,
+ * so a node search compares integers and only reads a slot when heads tie.
+ *
+ * Part of that prefix is free to skip: the common prefix of the two
+ * separators around the node in its parent (its fences) is shared by every
+ * key that can be looked up in the node. Only when the keys share more than
+ * that is the rest of the prefix compared, against the first key's slot.
+ * Splits only narrow the fences, so the fence prefix of a node stays valid
+ * until the node itself is split. */
+
+#define BTREE_STR_NODE_SIZE (4*CACHE_LINE_SIZE)
+#define BTREE_STR_MAX_KEY   ((BTREE_STR_NODE_SIZE - 8 - sizeof (void*)) / (sizeof (uint32_t) + 2*sizeof (void*)))
+
+typedef struct BTree_str_slot {
+    uint32_t len;
+    char     data[];
+} BTree_str_slot;
+
+typedef struct BTree_str_node {
+    uint8_t                degree;
+    uint8_t                is_leaf;
+    uint16_t               fence_len;  /* bytes shared by the fences */
+    uint16_t               prefix_len; /* bytes shared by the keys, >= fence_len */
+    uint32_t               heads[BTREE_STR_MAX_KEY];
+    BTree_str_slot*        slots[BTREE_STR_MAX_KEY];
+    struct BTree_str_node* children[BTREE_STR_MAX_KEY + 1];
+} __attribute__((aligned(CACHE_LINE_SIZE))) BTree_str_node;
+
+_Static_assert(sizeof (BTree_str_node) <= BTREE_STR_NODE_SIZE, "string node spills over its size");
+
+typedef struct BTree_str {
+    BTree_str_node* root;
+    size_t          depth;
+    size_t          node_count;
+    size_t          count;
+    struct arena*   arena;
+    char*           slot_next; /* free space in the current page of slots */
+    size_t          slot_left;
+} BTree_str;
+
+typedef struct BTree_str_cursor {
+    size_t depth;
+    struct BTree_str_path {
+        BTree_str_node* node;
+        size_t          index;
+    } path[BTREE_MAX_DEPTH];
+} BTree_str_cursor;
+
+/**
+ * Allocate a new empty tree in arena `a`.
+ * Aborts if the arena is out of memory.
+ */
+BTree_str* BTree_str_new(struct arena* a);
+
+void BTree_str_init(struct arena* a, BTree_str* btree);
+
+/**
+ * Insert a copy of the `len` bytes at `key`.
+ * Returns false if the key was already present.
+ */
+bool BTree_str_insert(BTree_str* btree, const char* key, size_t len);
+
+bool BTree_str_find(const BTree_str* btree, const char* key, size_t len);
+
+/**
+ * Position a cursor at the first key >= `key`.
+ * Returns false, and leaves the cursor invalid, if there is no such key.
+ */
+bool BTree_str_lower_bound(const BTree_str* btree, const char* key, size_t len, BTree_str_cursor* cursor);
+
+/**
+ * Position a cursor at the smallest key.
+ * Returns false, and leaves the cursor invalid, if the tree is empty.
+ */
+bool BTree_str_first(const BTree_str* btree, BTree_str_cursor* cursor);
+
+/**
+ * Step to the next key in ascending order.
+ * Returns false, and invalidates the cursor, when stepping past the last key.
+ */
+bool BTree_str_next(BTree_str_cursor* cursor);
+
+static inline bool BTree_str_cursor_valid(const BTree_str_cursor* cursor)
+{
+    return cursor->depth > 0;
+}
+
+/**
+ * The key under a valid cursor, and its length in `len`.
+ * The key isn't NUL terminated.
+ */
+static inline const char* BTree_str_cursor_key(const BTree_str_cursor* cursor, size_t* len)
+{
+    const struct BTree_str_path* top = &cursor->path[cursor->depth - 1];
+    const BTree_str_slot* slot = top->node->slots[top->index];
+    *len = slot->len;
+    return slot->data;
+}
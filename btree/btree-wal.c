@@ -0,0 +1,277 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "btree.h"
+#include "btree-file.h"
+#include "btree-wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define unlikely(expr) __builtin_expect(expr, 0)
+
+static uint32_t record_checksum(uint32_t op, Key key)
+{
+    const uint64_t PRIME = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = (key ^ ((uint64_t)op << 59)) * PRIME;
+    h = (h ^ (h >> 29)) * PRIME;
+    return (uint32_t)(h >> 32) ^ BTREE_WAL_VERSION;
+}
+
+static int write_all(int fd, const void* data, size_t size)
+{
+    const char* p = data;
+    while (size > 0) {
+        const ssize_t written = write(fd, p, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p    += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static int log_path(char* out, size_t size, const char* path, const char* suffix)
+{
+    if (snprintf(out, size, "%s%s", path, suffix) >= (int)size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* Replace the log with an empty one. It is written next to the log and
+ * renamed over it, so a crash leaves either the old log or the new one. */
+static int create_log(const char* path)
+{
+    char wal[4096], tmp[4096];
+    if (log_path(wal, sizeof wal, path, ".wal") == -1 || log_path(tmp, sizeof tmp, path, ".wal.tmp") == -1) {
+        return -1;
+    }
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    const BTree_wal_header header = {
+        .magic       = BTREE_WAL_MAGIC,
+        .version     = BTREE_WAL_VERSION,
+        .record_size = sizeof (BTree_wal_record),
+    };
+    if (write_all(fd, &header, sizeof header) == -1 || fsync(fd) == -1) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    if (close(fd) == -1) {
+        unlink(tmp);
+        return -1;
+    }
+    return rename(tmp, wal);
+}
+
+static int load_checkpoint(BTree* btree, const char* path)
+{
+    BTree_file f;
+    if (BTree_file_open(&f, path) == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    BTree_file_load(&f, btree, 1.0);
+    return BTree_file_close(&f);
+}
+
+/* Replay the log over the tree. Returns the number of bytes of whole valid
+ * records after the header, or -1 with errno set. */
+static off_t replay_log(int fd, BTree* btree, uint64_t* records)
+{
+    BTree_wal_header header;
+    if (read(fd, &header, sizeof header) != sizeof header
+     || memcmp(header.magic, BTREE_WAL_MAGIC, sizeof header.magic) != 0
+     || header.version != BTREE_WAL_VERSION
+     || header.record_size != sizeof (BTree_wal_record)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    off_t valid = sizeof header;
+    BTree_wal_record buf[4096];
+    for (;;) {
+        const ssize_t got = read(fd, buf, sizeof buf);
+        if (got == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        const size_t count = (size_t)got / sizeof *buf;
+        for (size_t i = 0; i < count; i++) {
+            const BTree_wal_record* r = &buf[i];
+            if (r->checksum != record_checksum(r->op, r->key)) {
+                return valid;
+            }
+            if (r->op == BTREE_WAL_INSERT) {
+                BTree_insert(btree, r->key);
+            } else if (r->op == BTREE_WAL_REMOVE) {
+                BTree_remove(btree, r->key);
+            } else {
+                return valid;
+            }
+            valid += sizeof *r;
+            (*records)++;
+        }
+        if ((size_t)got < sizeof buf) {
+            /* a partial record at the end is torn */
+            return valid;
+        }
+    }
+}
+
+int BTree_wal_open(BTree_wal* w, BTree* btree, const char* path, size_t group)
+{
+    if (btree->root->degree != 0 || !btree->root->is_leaf) {
+        errno = EINVAL;
+        return -1;
+    }
+    *w = (BTree_wal) {
+        .btree = btree,
+        .fd    = -1,
+        .group = group > 0 ? group : 1,
+    };
+
+    char wal[4096];
+    if (log_path(wal, sizeof wal, path, ".wal") == -1) {
+        return -1;
+    }
+    w->path    = strdup(path);
+    w->pending = malloc(w->group * sizeof *w->pending);
+    if (unlikely(!w->path || !w->pending)) {
+        abort();
+    }
+
+    if (load_checkpoint(btree, path) == -1) {
+        goto failed;
+    }
+
+    int fd = open(wal, O_RDWR);
+    if (fd == -1) {
+        if (errno != ENOENT || create_log(path) == -1) {
+            goto failed;
+        }
+        fd = open(wal, O_RDWR);
+        if (fd == -1) {
+            goto failed;
+        }
+    }
+    const off_t end = replay_log(fd, btree, &w->records);
+    /* drop a torn tail so new records follow the last valid one */
+    if (end == -1 || ftruncate(fd, end) == -1 || lseek(fd, end, SEEK_SET) == -1) {
+        close(fd);
+        goto failed;
+    }
+    w->fd = fd;
+    return 0;
+
+failed:
+    free(w->path);
+    free(w->pending);
+    return -1;
+}
+
+static int flush(BTree_wal* w)
+{
+    if (w->error) {
+        errno = w->error;
+        return -1;
+    }
+    if (w->pending_count == 0) {
+        return 0;
+    }
+    if (write_all(w->fd, w->pending, w->pending_count * sizeof *w->pending) == -1
+     || fdatasync(w->fd) == -1) {
+        w->error = errno;
+        return -1;
+    }
+    w->pending_count = 0;
+    w->syncs++;
+    return 0;
+}
+
+static void append(BTree_wal* w, uint32_t op, Key key)
+{
+    w->pending[w->pending_count++] = (BTree_wal_record) {
+        .op       = op,
+        .checksum = record_checksum(op, key),
+        .key      = key,
+    };
+    w->records++;
+    if (w->pending_count == w->group) {
+        flush(w);
+        /* on failure the group is dropped, the error is what's reported */
+        w->pending_count = 0;
+    }
+}
+
+bool BTree_wal_insert(BTree_wal* w, Key key)
+{
+    if (!BTree_insert(w->btree, key)) {
+        return false;
+    }
+    append(w, BTREE_WAL_INSERT, key);
+    return true;
+}
+
+bool BTree_wal_remove(BTree_wal* w, Key key)
+{
+    if (!BTree_remove(w->btree, key)) {
+        return false;
+    }
+    append(w, BTREE_WAL_REMOVE, key);
+    return true;
+}
+
+int BTree_wal_sync(BTree_wal* w)
+{
+    return flush(w);
+}
+
+int BTree_wal_checkpoint(BTree_wal* w)
+{
+    if (flush(w) == -1 || BTree_file_write(w->btree, w->path) == -1) {
+        return -1;
+    }
+    /* the records are all in the checkpoint now, the old log is replaced
+     * with an empty one and reopened */
+    if (create_log(w->path) == -1) {
+        return -1;
+    }
+    char wal[4096];
+    log_path(wal, sizeof wal, w->path, ".wal");
+    const int fd = open(wal, O_WRONLY | O_APPEND);
+    if (fd == -1) {
+        w->error = errno;
+        return -1;
+    }
+    close(w->fd);
+    w->fd      = fd;
+    w->records = 0;
+    return 0;
+}
+
+int BTree_wal_close(BTree_wal* w)
+{
+    int ok = flush(w);
+    if (close(w->fd) == -1) {
+        ok = -1;
+    }
+    free(w->path);
+    free(w->pending);
+    w->fd = -1;
+    return ok;
+}
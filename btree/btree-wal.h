@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "btree.h"
+
+/* Write-ahead log for a BTree kept in memory.
+ *
+ * A durable tree is a checkpoint at `path`, written with BTree_file_write,
+ * and a log at `path`.wal of every insert and remove that changed the tree
+ * since. Recovery loads the checkpoint and replays the log over it.
+ *
+ * Records are buffered and written out with one fdatasync per group of
+ * `group` records, so the cost of a sync is shared by the whole group. A
+ * change is durable once its group is synced, which BTree_wal_sync forces.
+ *
+ * Replaying an insert or a remove only sets whether its key is present, so
+ * replaying a log over a checkpoint that already holds some of it gives the
+ * same tree. A checkpoint is therefore written first and the log cut after,
+ * and a crash in between leaves a log that is safe to replay. A record torn
+ * by a crash fails its checksum, and the log is cut before it on recovery. */
+
+#define BTREE_WAL_MAGIC   "BTREEWAL"
+#define BTREE_WAL_VERSION 1
+
+typedef struct BTree_wal_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} BTree_wal_header;
+
+enum BTree_wal_op {
+    BTREE_WAL_INSERT = 1,
+    BTREE_WAL_REMOVE = 2,
+};
+
+typedef struct BTree_wal_record {
+    uint32_t op;
+    uint32_t checksum; /* of op and key */
+    Key      key;
+} BTree_wal_record;
+
+typedef struct BTree_wal {
+    BTree*            btree;
+    char*             path;
+    int               fd;
+    int               error;   /* errno of the first failed write, sticky */
+    size_t            group;   /* records per fdatasync */
+    BTree_wal_record* pending; /* records not written out yet */
+    size_t            pending_count;
+    uint64_t          records; /* in the log, written out or not */
+    uint64_t          syncs;
+} BTree_wal;
+
+/**
+ * Recover the tree at `path` into the empty `btree` and open its log for
+ * appending. A missing checkpoint or log is an empty one, so a new tree is
+ * opened the same way.
+ * Returns 0 on success, -1 on failure with errno set. A non-empty `btree`,
+ * or a log or checkpoint written with a different layout, fails with EINVAL.
+ */
+int BTree_wal_open(BTree_wal* w, BTree* btree, const char* path, size_t group);
+
+/**
+ * BTree_insert and BTree_remove, logging the change if the tree changed.
+ * Failures to write the log are kept in w->error and returned by the next
+ * BTree_wal_sync, BTree_wal_checkpoint or BTree_wal_close.
+ */
+bool BTree_wal_insert(BTree_wal* w, Key key);
+
+bool BTree_wal_remove(BTree_wal* w, Key key);
+
+/**
+ * Write out and sync the pending records, making every change so far
+ * durable.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int BTree_wal_sync(BTree_wal* w);
+
+/**
+ * Write the tree as the new checkpoint and empty the log.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int BTree_wal_checkpoint(BTree_wal* w);
+
+/**
+ * Sync and close the log. The tree is left as it is.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int BTree_wal_close(BTree_wal* w);
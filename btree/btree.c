@@ -1,21 +1,3 @@
-
-//#define XCAT(a, b) a##b
-//#define CAT(a, b) XCAT(a,b)
-//
-//#ifdef BTREE_VAL
-//  #ifndef BTREE_PREFIX
-//      #error "BTREE_VAL defined but not BTREE_PREFIX"
-//  #endif
-//    #define T BTREE_VAL
-//    #define BTREE_T       CAT(Hashmap_,T)
-//    #define BTREE_NODE_T CAT(hashmap_entry_,T)
-//#else
-//    #define T void*
-//    #define BTREE_T      BTree
-//  #define BTREE_PREFIX btree
-//    #define BTREE_NODE_T btree_node
-//#endif
-
 #include <assert.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -23,49 +5,68 @@
 #include <string.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <pthread.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #include "arena.h"
+#include "btree.h"
 
 #define STR(x) #x
 #define ARRAY_LEN(x) (sizeof x) / sizeof (*(x))
 
-typedef uint64_t Key;
-#define KeyFmt PRIu64
-
-#define MAX_CHILDREN (2*(CACHE_LINE_SIZE/(sizeof(void*) + sizeof (Key))))
-#define MAX_KEY (MAX_CHILDREN-1)
-
 //#define arena_alloc(arena, size) aligned_alloc(CACHE_LINE_SIZE, size)
 
 #define unlikely(expr) __builtin_expect(expr, 0)
 #define likely(expr) __builtin_expect(expr, 1)
 
-typedef struct BTree_node {
-    uint8_t degree;
-    uint8_t is_leaf;
-    Key keys[MAX_KEY];
-    void* children[MAX_CHILDREN];
-} __attribute__((aligned(CACHE_LINE_SIZE))) BTree_node;
-
-//static_assert(sizeof (BTree_node) <= CACHE_LINE_SIZE);
+/* BTree_node.last_insert: whether the key inserted last went to the end
+ * of the node, its front, or neither */
+enum { NO_INSERT, INSERTED_LAST, INSERTED_FIRST };
 
-typedef struct BTree {
-    struct BTree_node* root;
-    size_t             depth;
-    size_t             node_count;
-    struct arena*      arena;
-} BTree;
+/* Smallest key count a node other than the root may have. Two minimal
+ * siblings and the key between them always fit in one node. */
+#define MIN_KEY      (MAX_CHILDREN/2 - 1)
+#define MIN_LEAF_KEY ((MAX_LEAF_KEY - 1)/2)
 
-static inline size_t node_key_count(BTree_node* node)
+static inline size_t node_key_count(const BTree_node* node)
 {
     return node->degree;
 }
 
-static inline size_t node_children_count(BTree_node* node)
+static inline size_t node_children_count(const BTree_node* node)
 {
     return node->degree + 1;
 }
 
+static inline size_t node_max_keys(const BTree_node* node)
+{
+    return node->is_leaf ? MAX_LEAF_KEY : MAX_KEY;
+}
+
+static inline size_t node_min_keys(const BTree_node* node)
+{
+    return node->is_leaf ? MIN_LEAF_KEY : MIN_KEY;
+}
+
+static inline bool node_full(const BTree_node* node)
+{
+    return node_key_count(node) == node_max_keys(node);
+}
+
+static inline size_t node_size(bool is_leaf)
+{
+    return is_leaf ? BTREE_LEAF_SIZE : BTREE_NODE_SIZE;
+}
+
+/* last_insert of a node whose key i of n was inserted last */
+static inline uint8_t inserted_at(size_t i, size_t n)
+{
+    return i + 1 == n ? INSERTED_LAST : i == 0 ? INSERTED_FIRST : NO_INSERT;
+}
+
 static void print_indent(int n)
 {
     for (int i = 0; i < n; i++) {
@@ -102,46 +103,522 @@ static void print_node_(BTree_node* node, int depth)
     }
 }
 
-static inline void print_node(BTree_node* node)
+void print_node(BTree_node* node)
 {
     print_node_(node, 0);
 }
 
-static void split_child(BTree* btree, BTree_node* parent, size_t i, BTree_node* child)
+/* Nodes freed by BTree_remove are kept on per-tree free lists, one for
+ * each size, linked through their first key, and handed out again before
+ * the arena grows. The node comes back with just is_leaf set. */
+static BTree_node* alloc_node(BTree* btree, bool is_leaf)
 {
-    BTree_node* new_child = arena_alloc(btree->arena, sizeof *new_child);
-    if (unlikely(!new_child)) {
-        abort();
+    BTree_node** free_list = is_leaf ? &btree->free_leaf_list : &btree->free_list;
+    BTree_node* node = *free_list;
+    if (node) {
+        memcpy(free_list, &node->keys[0], sizeof *free_list);
+    } else {
+        node = arena_alloc(btree->arena, node_size(is_leaf));
+        if (unlikely(!node)) {
+            abort();
+        }
+    }
+    node->is_leaf = is_leaf;
+    btree->node_count++;
+    return node;
+}
+
+static void push_free(BTree* btree, BTree_node* node)
+{
+    BTree_node** free_list = node->is_leaf ? &btree->free_leaf_list : &btree->free_list;
+    memcpy(&node->keys[0], free_list, sizeof *free_list);
+    *free_list = node;
+}
+
+static void retire_node(BTree* btree, BTree_node* node);
+
+static void free_node(BTree* btree, BTree_node* node)
+{
+    if (unlikely(btree->gen != 0 && node->version != btree->gen)) {
+        /* a published version may still reach it */
+        retire_node(btree, node);
+        btree->node_count--;
+        return;
     }
+    push_free(btree, node);
+    btree->node_count--;
+}
 
-    memcpy(new_child->keys, &(child->keys[MAX_KEY/2+1]), (MAX_KEY/2) * sizeof *new_child->keys);
+/* Move the keys after keys[mid] of the full children[i] of `parent` into
+ * new_child, and keys[mid] up into `parent` */
+static void split_child_into(BTree_node* parent, size_t i, BTree_node* child, BTree_node* new_child, size_t mid)
+{
+    const size_t right = node_key_count(child) - mid - 1;
+    memcpy(new_child->keys, &(child->keys[mid+1]), right * sizeof *new_child->keys);
     if (!child->is_leaf) {
-        memcpy(new_child->children, &(child->children[MAX_CHILDREN/2]), (MAX_CHILDREN/2) * sizeof *new_child->children);
+        memcpy(new_child->children, &(child->children[mid+1]), (right + 1) * sizeof *new_child->children);
     }
 
-    new_child->degree = child->degree = MAX_CHILDREN/2 - 1;
+    new_child->degree = right;
     new_child->is_leaf = child->is_leaf;
+    new_child->version = 0;
+    new_child->last_insert = child->last_insert == INSERTED_LAST && right > 0 ? INSERTED_LAST : NO_INSERT;
+    child->last_insert = child->last_insert == INSERTED_FIRST && mid > 0 ? INSERTED_FIRST : NO_INSERT;
+    child->degree = mid;
 
     /* insert new child to this parent */
     memmove(&(parent->children[i+2]), &(parent->children[i+1]), (node_children_count(parent) - i - 1) * sizeof parent->children[0]);
     memmove(&(parent->keys[i+1]), &(parent->keys[i]), (node_key_count(parent) - i) * sizeof parent->keys[0]);
-    parent->keys[i] = child->keys[MAX_KEY/2];
+    parent->keys[i] = child->keys[mid];
     parent->children[i+1] = new_child;
     parent->degree++;
+    parent->last_insert = inserted_at(i, node_key_count(parent));
+}
 
-    btree->node_count++;
+/* Where to split the full `child` that `key` is about to be inserted into.
+ *
+ * A middle split leaves both halves half full, and with keys arriving in
+ * order the left half never gets another key. So if the last key inserted
+ * into the node went at its end and this one goes there too, split at the
+ * insertion point instead: the node keeps all but what the new node needs
+ * to not be empty. Same for keys arriving in descending order at the front.
+ * A leaf split this way gets its first key from the insert right away, an
+ * internal node is given one key to keep it valid. */
+static size_t split_point(const BTree_node* child, Key key)
+{
+    const size_t n = node_key_count(child);
+    if (child->last_insert == INSERTED_LAST && key > child->keys[n - 1]) {
+        return child->is_leaf ? n - 1 : n - 2;
+    }
+    if (child->last_insert == INSERTED_FIRST && key < child->keys[0]) {
+        return child->is_leaf ? 0 : 1;
+    }
+    return n / 2;
+}
+
+static void split_child(BTree* btree, BTree_node* parent, size_t i, BTree_node* child, Key key)
+{
+    BTree_node* new_child = alloc_node(btree, child->is_leaf);
+    split_child_into(parent, i, child, new_child, split_point(child, key));
+    new_child->version = btree->gen;
+    btree->shape++;
+}
+
+/* Copy-on-write.
+ *
+ * In a tree with snapshots, BTree_node.version is the generation the node
+ * was written in, and the tree's generation moves on with every publish.
+ * Writers only change nodes of the current generation. Any other node may
+ * be reachable from a published version, so it is copied first, which
+ * means updating its parent, which is why the path is copied from the root
+ * down. Without snapshots the generation is 0 and nothing is copied. */
+static BTree_node* copy_node(BTree* btree, BTree_node* node)
+{
+    BTree_node* copy = alloc_node(btree, node->is_leaf);
+    memcpy(copy, node, node_size(node->is_leaf));
+    copy->version = btree->gen;
+    free_node(btree, node);
+    btree->shape++;
+    return copy;
+}
+
+/* children[i] of `parent`, made writable. `parent` must already be. */
+static inline BTree_node* own_child(BTree* btree, BTree_node* parent, size_t i)
+{
+    BTree_node* child = parent->children[i];
+    if (likely(child->version == btree->gen)) {
+        return child;
+    }
+    return parent->children[i] = copy_node(btree, child);
+}
+
+static inline void own_root(BTree* btree)
+{
+    if (unlikely(btree->root->version != btree->gen)) {
+        btree->root = copy_node(btree, btree->root);
+    }
 }
 
-/* TODO: SIMD optimize*/
-static inline size_t lower_bound(BTree_node* node, Key k)
+/* Node search kernels.
+ *
+ * Every kernel returns the index of the first key >= k. Since the keys in a
+ * node are sorted this is the same as the number of keys < k, so the vector
+ * kernels compare a broadcast k against a block of keys and popcount the
+ * resulting mask instead of branching on every key. Lanes past the n keys
+ * are masked off. */
+typedef size_t (*lower_bound_fn)(const Key* keys, size_t n, Key k);
+
+static size_t lower_bound_scalar(const Key* keys, size_t n, Key k)
 {
     size_t i;
-    for (i = 0; i < node_key_count(node) && node->keys[i] < k; i++)
+    for (i = 0; i < n && keys[i] < k; i++)
         /*noop*/;
     return i;
 }
 
-static bool _BTree_insert(BTree* btree, BTree_node* node, Key key)
+/* The B+tree can also be instantiated on the other key types below, see
+ * bptree.h. Each kernel has a version for each of them, with as many
+ * lanes as the key width allows. */
+#define LOWER_BOUND_SCALAR(name, K)                  \
+    static size_t name(const K* keys, size_t n, K k) \
+    {                                                \
+        size_t i;                                    \
+        for (i = 0; i < n && keys[i] < k; i++)       \
+            /*noop*/;                                \
+        return i;                                    \
+    }
+
+LOWER_BOUND_SCALAR(lower_bound_scalar_uint32,  uint32_t)
+LOWER_BOUND_SCALAR(lower_bound_scalar_int32,   int32_t)
+LOWER_BOUND_SCALAR(lower_bound_scalar_int64,   int64_t)
+LOWER_BOUND_SCALAR(lower_bound_scalar_double,  double)
+LOWER_BOUND_SCALAR(lower_bound_scalar_uint128, uint128_t)
+
+/* Signed keys are searched by the unsigned kernels, and the other way
+ * around, with `flip` set to the sign bit: a ^ flip < b ^ flip orders a
+ * and b the other way. */
+#define SIGN_BIT_64 ((Key)1 << 63)
+#define SIGN_BIT_32 ((uint32_t)1 << 31)
+
+#ifdef __x86_64__
+__attribute__((target("sse2")))
+static inline size_t lower_bound_sse2_64(const Key* keys, size_t n, Key k, Key flip)
+{
+    /* SSE2 has no 64-bit compare, so build one from 32-bit halves:
+     * a < k  <=>  hi(a) < hi(k) || (hi(a) == hi(k) && lo(a) < lo(k)).
+     * Flipping the sign bit makes the signed 32-bit compare unsigned. */
+    const __m128i bias = _mm_xor_si128(_mm_set1_epi32((int)0x80000000), _mm_set1_epi64x((long long)flip));
+    const __m128i kv   = _mm_xor_si128(_mm_set1_epi64x((long long)k), bias);
+    size_t count = 0;
+    size_t i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i a     = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&keys[i]), bias);
+        __m128i gt    = _mm_cmpgt_epi32(kv, a);
+        __m128i eq    = _mm_cmpeq_epi32(kv, a);
+        __m128i gt_hi = _mm_shuffle_epi32(gt, _MM_SHUFFLE(3, 3, 1, 1));
+        __m128i eq_hi = _mm_shuffle_epi32(eq, _MM_SHUFFLE(3, 3, 1, 1));
+        __m128i gt_lo = _mm_shuffle_epi32(gt, _MM_SHUFFLE(2, 2, 0, 0));
+        __m128i lt    = _mm_or_si128(gt_hi, _mm_and_si128(eq_hi, gt_lo));
+        count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(lt)));
+    }
+    if (i < n) {
+        count += (keys[i] ^ flip) < (k ^ flip);
+    }
+    return count;
+}
+
+__attribute__((target("sse2")))
+static size_t lower_bound_sse2(const Key* keys, size_t n, Key k)
+{
+    return lower_bound_sse2_64(keys, n, k, 0);
+}
+
+__attribute__((target("sse2")))
+static size_t lower_bound_sse2_int64(const int64_t* keys, size_t n, int64_t k)
+{
+    return lower_bound_sse2_64((const Key*)keys, n, (Key)k, SIGN_BIT_64);
+}
+
+/* the signed 32-bit compare is there, unsigned keys flip their sign bit */
+__attribute__((target("sse2")))
+static inline size_t lower_bound_sse2_32(const uint32_t* keys, size_t n, uint32_t k, uint32_t flip)
+{
+    const __m128i bias = _mm_set1_epi32((int)flip);
+    const __m128i kv   = _mm_set1_epi32((int)(k ^ flip));
+    size_t count = 0;
+    size_t i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i a  = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&keys[i]), bias);
+        __m128i lt = _mm_cmpgt_epi32(kv, a);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+    }
+    for (; i < n; i++) {
+        count += (int32_t)(keys[i] ^ flip) < (int32_t)(k ^ flip);
+    }
+    return count;
+}
+
+__attribute__((target("sse2")))
+static size_t lower_bound_sse2_uint32(const uint32_t* keys, size_t n, uint32_t k)
+{
+    return lower_bound_sse2_32(keys, n, k, SIGN_BIT_32);
+}
+
+__attribute__((target("sse2")))
+static size_t lower_bound_sse2_int32(const int32_t* keys, size_t n, int32_t k)
+{
+    return lower_bound_sse2_32((const uint32_t*)keys, n, (uint32_t)k, 0);
+}
+
+__attribute__((target("sse2")))
+static size_t lower_bound_sse2_double(const double* keys, size_t n, double k)
+{
+    const __m128d kv = _mm_set1_pd(k);
+    size_t count = 0;
+    size_t i;
+    for (i = 0; i + 2 <= n; i += 2) {
+        count += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(_mm_loadu_pd(&keys[i]), kv)));
+    }
+    if (i < n) {
+        count += keys[i] < k;
+    }
+    return count;
+}
+
+__attribute__((target("avx2")))
+static inline size_t lower_bound_avx2_64(const Key* keys, size_t n, Key k, Key flip)
+{
+    const __m256i sign = _mm256_set1_epi64x((long long)(SIGN_BIT_64 ^ flip));
+    const __m256i lane = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256i kv   = _mm256_xor_si256(_mm256_set1_epi64x((long long)k), sign);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 4) {
+        /* maskload never touches memory in masked off lanes, so this can't
+         * read past the end of the keys array */
+        __m256i valid = _mm256_cmpgt_epi64(_mm256_set1_epi64x((long long)(n - i)), lane);
+        __m256i a     = _mm256_maskload_epi64((const long long*)&keys[i], valid);
+        __m256i lt    = _mm256_cmpgt_epi64(kv, _mm256_xor_si256(a, sign));
+        lt = _mm256_and_si256(lt, valid);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+    }
+    return count;
+}
+
+__attribute__((target("avx2")))
+static size_t lower_bound_avx2(const Key* keys, size_t n, Key k)
+{
+    return lower_bound_avx2_64(keys, n, k, 0);
+}
+
+__attribute__((target("avx2")))
+static size_t lower_bound_avx2_int64(const int64_t* keys, size_t n, int64_t k)
+{
+    return lower_bound_avx2_64((const Key*)keys, n, (Key)k, SIGN_BIT_64);
+}
+
+__attribute__((target("avx2")))
+static inline size_t lower_bound_avx2_32(const uint32_t* keys, size_t n, uint32_t k, uint32_t flip)
+{
+    const __m256i bias = _mm256_set1_epi32((int)flip);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i kv   = _mm256_set1_epi32((int)(k ^ flip));
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 8) {
+        __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(n - i)), lane);
+        __m256i a     = _mm256_maskload_epi32((const int*)&keys[i], valid);
+        __m256i lt    = _mm256_cmpgt_epi32(kv, _mm256_xor_si256(a, bias));
+        lt = _mm256_and_si256(lt, valid);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+    }
+    return count;
+}
+
+__attribute__((target("avx2")))
+static size_t lower_bound_avx2_uint32(const uint32_t* keys, size_t n, uint32_t k)
+{
+    return lower_bound_avx2_32(keys, n, k, SIGN_BIT_32);
+}
+
+__attribute__((target("avx2")))
+static size_t lower_bound_avx2_int32(const int32_t* keys, size_t n, int32_t k)
+{
+    return lower_bound_avx2_32((const uint32_t*)keys, n, (uint32_t)k, 0);
+}
+
+__attribute__((target("avx2")))
+static size_t lower_bound_avx2_double(const double* keys, size_t n, double k)
+{
+    const __m256i lane = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256d kv   = _mm256_set1_pd(k);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 4) {
+        __m256i valid = _mm256_cmpgt_epi64(_mm256_set1_epi64x((long long)(n - i)), lane);
+        __m256d a     = _mm256_maskload_pd(&keys[i], valid);
+        __m256d lt    = _mm256_and_pd(_mm256_cmp_pd(a, kv, _CMP_LT_OQ), _mm256_castsi256_pd(valid));
+        count += __builtin_popcount(_mm256_movemask_pd(lt));
+    }
+    return count;
+}
+
+__attribute__((target("avx512f")))
+static size_t lower_bound_avx512(const Key* keys, size_t n, Key k)
+{
+    const __m512i kv = _mm512_set1_epi64((long long)k);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 8) {
+        const size_t  rem   = n - i;
+        const __mmask8 valid = rem >= 8 ? 0xff : (__mmask8)((1U << rem) - 1);
+        __m512i a = _mm512_maskz_loadu_epi64(valid, &keys[i]);
+        count += __builtin_popcount(_mm512_mask_cmplt_epu64_mask(valid, a, kv));
+    }
+    return count;
+}
+
+__attribute__((target("avx512f")))
+static size_t lower_bound_avx512_int64(const int64_t* keys, size_t n, int64_t k)
+{
+    const __m512i kv = _mm512_set1_epi64(k);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 8) {
+        const size_t  rem   = n - i;
+        const __mmask8 valid = rem >= 8 ? 0xff : (__mmask8)((1U << rem) - 1);
+        __m512i a = _mm512_maskz_loadu_epi64(valid, &keys[i]);
+        count += __builtin_popcount(_mm512_mask_cmplt_epi64_mask(valid, a, kv));
+    }
+    return count;
+}
+
+__attribute__((target("avx512f")))
+static size_t lower_bound_avx512_uint32(const uint32_t* keys, size_t n, uint32_t k)
+{
+    const __m512i kv = _mm512_set1_epi32((int)k);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 16) {
+        const size_t   rem   = n - i;
+        const __mmask16 valid = rem >= 16 ? 0xffff : (__mmask16)((1U << rem) - 1);
+        __m512i a = _mm512_maskz_loadu_epi32(valid, &keys[i]);
+        count += __builtin_popcount(_mm512_mask_cmplt_epu32_mask(valid, a, kv));
+    }
+    return count;
+}
+
+__attribute__((target("avx512f")))
+static size_t lower_bound_avx512_int32(const int32_t* keys, size_t n, int32_t k)
+{
+    const __m512i kv = _mm512_set1_epi32(k);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 16) {
+        const size_t   rem   = n - i;
+        const __mmask16 valid = rem >= 16 ? 0xffff : (__mmask16)((1U << rem) - 1);
+        __m512i a = _mm512_maskz_loadu_epi32(valid, &keys[i]);
+        count += __builtin_popcount(_mm512_mask_cmplt_epi32_mask(valid, a, kv));
+    }
+    return count;
+}
+
+__attribute__((target("avx512f")))
+static size_t lower_bound_avx512_double(const double* keys, size_t n, double k)
+{
+    const __m512d kv = _mm512_set1_pd(k);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 8) {
+        const size_t  rem   = n - i;
+        const __mmask8 valid = rem >= 8 ? 0xff : (__mmask8)((1U << rem) - 1);
+        __m512d a = _mm512_maskz_loadu_pd(valid, &keys[i]);
+        count += __builtin_popcount(_mm512_mask_cmp_pd_mask(valid, a, kv, _CMP_LT_OQ));
+    }
+    return count;
+}
+
+static bool cpu_has_sse2(void)   { return __builtin_cpu_supports("sse2"); }
+static bool cpu_has_avx2(void)   { return __builtin_cpu_supports("avx2"); }
+static bool cpu_has_avx512(void) { return __builtin_cpu_supports("avx512f"); }
+#endif /* __x86_64__ */
+
+static bool cpu_has_nothing(void) { return true; }
+
+/* ordered by preference, the first supported kernel is picked at startup */
+static const struct search_kernel {
+    const char*    name;
+    lower_bound_fn fn;
+    size_t       (*fn_uint32)(const uint32_t* keys, size_t n, uint32_t k);
+    size_t       (*fn_int32)(const int32_t* keys, size_t n, int32_t k);
+    size_t       (*fn_int64)(const int64_t* keys, size_t n, int64_t k);
+    size_t       (*fn_double)(const double* keys, size_t n, double k);
+    bool         (*supported)(void);
+} search_kernels[] = {
+#define SEARCH_KERNEL(isa) \
+    { STR(isa), lower_bound_##isa, lower_bound_##isa##_uint32, lower_bound_##isa##_int32, \
+      lower_bound_##isa##_int64, lower_bound_##isa##_double, cpu_has_##isa }
+#ifdef __x86_64__
+    SEARCH_KERNEL(avx512),
+    SEARCH_KERNEL(avx2),
+    SEARCH_KERNEL(sse2),
+#endif
+    { "scalar", lower_bound_scalar, lower_bound_scalar_uint32, lower_bound_scalar_int32,
+      lower_bound_scalar_int64, lower_bound_scalar_double, cpu_has_nothing },
+#undef SEARCH_KERNEL
+};
+
+static const struct search_kernel* search_kernel = &search_kernels[ARRAY_LEN(search_kernels) - 1];
+
+__attribute__((constructor))
+static void select_search_kernel(void)
+{
+    __builtin_cpu_init();
+    for (size_t i = 0; i < ARRAY_LEN(search_kernels); i++) {
+        if (search_kernels[i].supported()) {
+            search_kernel = &search_kernels[i];
+            return;
+        }
+    }
+}
+
+/* Keys a kernel scans in one go. Wider nodes are first narrowed down to
+ * this many by binary search, so a lookup reads a few lines of the node
+ * rather than all of its keys. */
+#define SCAN_KEYS 32
+
+static inline size_t lower_bound(const BTree_node* node, Key k)
+{
+    size_t base = 0;
+    size_t n    = node_key_count(node);
+    if (BTREE_NODE_KEYS > SCAN_KEYS) {
+        while (n > SCAN_KEYS) {
+            const size_t half = n / 2;
+            if (node->keys[base + half] < k) {
+                base += half + 1;
+                n    -= half + 1;
+            } else {
+                n = half;
+            }
+        }
+    }
+    return base + search_kernel->fn(&node->keys[base], n, k);
+}
+
+/* Push children[i] of the node on top of `finger`, with its share of the
+ * node's key range */
+static inline void finger_push(BTree_finger* finger, size_t i)
+{
+    const struct BTree_finger_path* top = &finger->path[finger->depth - 1];
+    const BTree_node* node = top->node;
+    /* the key being looked for lies strictly between the separators
+     * around children[i], so neither bound wraps */
+    finger->path[finger->depth++] = (struct BTree_finger_path) {
+        .node = node->children[i],
+        .lo   = i > 0 ? node->keys[i-1] + 1 : top->lo,
+        .hi   = i < node_key_count(node) ? node->keys[i] - 1 : top->hi,
+    };
+}
+
+/* How much of the path on `finger` an operation on `key` can start from:
+ * down to the lowest node whose range holds `key`, and for an insert that
+ * the insert can change without its parent, one that isn't full and is
+ * writable. 0 if the finger is of no use. */
+static size_t finger_start(const BTree* b, const BTree_finger* finger, Key key, bool insert)
+{
+    if (finger->tree != b || finger->shape != b->shape) {
+        return 0;
+    }
+    for (size_t d = finger->depth; d > 0; d--) {
+        const struct BTree_finger_path* p = &finger->path[d - 1];
+        if (p->lo <= key && key <= p->hi
+         && (!insert || (!node_full(p->node) && p->node->version == b->gen))) {
+            return d;
+        }
+    }
+    return 0;
+}
+
+static inline void finger_reset(BTree_finger* finger, const BTree* b)
+{
+    finger->path[0] = (struct BTree_finger_path) { .node = b->root, .lo = 0, .hi = UINT64_MAX };
+    finger->depth   = 1;
+}
+
+/* `finger`, when not NULL, has `node` on top and gets the path below it */
+static bool _BTree_insert(BTree* btree, BTree_node* node, Key key, BTree_finger* finger)
 {
     size_t i = lower_bound(node, key);
 
@@ -150,102 +627,1231 @@ static bool _BTree_insert(BTree* btree, BTree_node* node, Key key)
     }
 
     if (unlikely(node->is_leaf)) {
-        if (i <= node_key_count(node)) {
-            const size_t key_move_size = (node_key_count(node) - i) * sizeof node->keys[0];
-            const size_t children_move_size = (node_children_count(node) - i) * sizeof node->children[0];
-            memmove(&(node->keys[i+1]), &(node->keys[i]), key_move_size);
-            memmove(&(node->children[i+1]), &(node->children[i]), children_move_size);
-            node->keys[i] = key;
-        }
+        const size_t key_move_size = (node_key_count(node) - i) * sizeof node->keys[0];
+        memmove(&(node->keys[i+1]), &(node->keys[i]), key_move_size);
+        node->keys[i] = key;
 
         node->degree += 1;
+        node->last_insert = inserted_at(i, node_key_count(node));
     } else {
-        BTree_node* child = node->children[i];
+        BTree_node* child = own_child(btree, node, i);
         // we are about to descend to a child, split the child if it's full before descending
-        if (unlikely(node_children_count(child) == MAX_CHILDREN)) {
-            split_child(btree, node, i, child);
+        if (unlikely(node_full(child))) {
+            split_child(btree, node, i, child, key);
+            /* the key moved up may be the one being inserted */
+            if (unlikely(key == node->keys[i])) {
+                return false;
+            }
             if (key > node->keys[i]) {
                 i++;
                 child = node->children[i];
             }
         }
-        return _BTree_insert(btree, child, key);
+        if (finger) {
+            finger_push(finger, i);
+        }
+        return _BTree_insert(btree, child, key, finger);
     }
 
     return true;
 }
 
+/* Make the root writable, and split it if full */
+static void prepare_root(BTree* b, Key key)
+{
+    own_root(b);
+    if (unlikely(node_full(b->root))) {
+        BTree_node* new_root = alloc_node(b, false);
+        new_root->degree      = 0;
+        new_root->last_insert = NO_INSERT;
+        new_root->version     = b->gen;
+        new_root->children[0] = b->root;
+
+        split_child(b, new_root, 0, b->root, key);
+        b->root = new_root;
+        b->depth += 1;
+    }
+}
+
 bool BTree_insert(BTree* b, const Key key)
 {
-    if (unlikely(node_children_count(b->root) == MAX_CHILDREN)) {
-        BTree_node* new_root = arena_alloc(b->arena, sizeof *new_root);
+    prepare_root(b, key);
+    return _BTree_insert(b, b->root, key, NULL);
+}
 
-        if (unlikely(!new_root)) {
-            abort();
-        }
+/* The node a fingered insert starts from is not full, so its parent, and
+ * the range the finger has for it, stay as they are. */
+bool BTree_insert_finger(BTree* b, Key key, BTree_finger* finger)
+{
+    finger->depth = finger_start(b, finger, key, true);
+    if (finger->depth == 0) {
+        prepare_root(b, key);
+        finger_reset(finger, b);
+    }
+    const bool inserted = _BTree_insert(b, finger->path[finger->depth - 1].node, key, finger);
+    finger->tree  = b;
+    finger->shape = b->shape;
+    return inserted;
+}
 
-        *new_root = (BTree_node) {
-            .degree = 0,
-            .is_leaf = false,
-            .children[0] = b->root,
-        };
+/* Optimistic lock coupling.
+ *
+ * A node's version is odd while a writer holds it. Readers take a snapshot
+ * of an even version, read the node, and validate that the version hasn't
+ * moved. A child pointer is only followed after the parent it was read from
+ * has been validated, so a reader never dereferences a torn pointer, and the
+ * parent is validated again after the child's version is read, so a child
+ * split in between is noticed. Any failed validation restarts from the root. */
+static inline void cpu_relax(void)
+{
+#ifdef __x86_64__
+    __builtin_ia32_pause();
+#endif
+}
 
-        split_child(b, new_root, 0, b->root);
-        b->root = new_root;
-        b->depth += 1;
+static inline uint32_t read_lock(const BTree_node* node)
+{
+    uint32_t v;
+    while ((v = __atomic_load_n(&node->version, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_relax();
     }
-    return _BTree_insert(b, b->root, key);
+    return v;
 }
 
-Key random_key(uint64_t n) {
-    const Key PRIME = 0x9e3779b97f4a7c15ULL;  // a 64-bit odd constant (golden ratio scaled)
-    n = (n ^ (n >> 30)) * PRIME;
-    n = (n ^ (n >> 27)) * PRIME;
-    n = n ^ (n >> 31);
-    return (Key)n;
+static inline bool validate(const BTree_node* node, uint32_t v)
+{
+    /* keep the plain reads of the node before the version check */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&node->version, __ATOMIC_RELAXED) == v;
 }
 
-int main()
+static inline bool upgrade_lock(BTree_node* node, uint32_t v)
 {
-    printf("sizeof(BTree_node): %zu\n", sizeof(BTree_node));
-    printf("CACHE_LINE_SIZE: %zu\n", CACHE_LINE_SIZE);
-    printf("MAX_CHILDREN: %"KeyFmt"\n", MAX_CHILDREN);
+    return __atomic_compare_exchange_n(&node->version, &v, v + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
 
-    {
-        struct arena a = arena_new();
-        BTree_node* node = arena_alloc(&a, sizeof *node);
-        if (unlikely(!node)) {
-            abort();
+static inline void write_unlock(BTree_node* node)
+{
+    __atomic_fetch_add(&node->version, 1, __ATOMIC_RELEASE);
+}
+
+static BTree_node* alloc_node_concurrent(BTree* btree, bool is_leaf)
+{
+    BTree_node* node = arena_alloc(btree->arena, node_size(is_leaf));
+    if (unlikely(!node)) {
+        abort();
+    }
+    __atomic_fetch_add(&btree->node_count, 1, __ATOMIC_RELAXED);
+    return node;
+}
+
+bool BTree_find_concurrent(const BTree* b, Key key)
+{
+restart:;
+    const BTree_node* node = __atomic_load_n(&b->root, __ATOMIC_ACQUIRE);
+    uint32_t v = read_lock(node);
+    if (node != __atomic_load_n(&b->root, __ATOMIC_ACQUIRE)) {
+        goto restart;
+    }
+
+    for (;;) {
+        const size_t i = lower_bound(node, key);
+        const bool found = i < node_key_count(node) && node->keys[i] == key;
+        if (found || node->is_leaf) {
+            if (!validate(node, v)) {
+                goto restart;
+            }
+            return found;
+        }
+
+        const BTree_node* child = node->children[i];
+        if (!validate(node, v)) {
+            goto restart;
+        }
+        const uint32_t child_v = read_lock(child);
+        if (!validate(node, v)) {
+            goto restart;
+        }
+        node = child;
+        v    = child_v;
+    }
+}
+
+bool BTree_insert_concurrent(BTree* b, Key key)
+{
+restart:;
+    BTree_node* parent = NULL;
+    uint32_t    parent_v = 0;
+    size_t      parent_i = 0;
+
+    BTree_node* node = __atomic_load_n(&b->root, __ATOMIC_ACQUIRE);
+    uint32_t v = read_lock(node);
+    if (node != __atomic_load_n(&b->root, __ATOMIC_ACQUIRE)) {
+        goto restart;
+    }
+
+    for (;;) {
+        if (unlikely(node_full(node))) {
+            /* Split on the way down, like BTree_insert. The parent was seen
+             * with room for one more key at parent_v, so locking it at that
+             * version guarantees it still has room. */
+            if (parent && !upgrade_lock(parent, parent_v)) {
+                goto restart;
+            }
+            if (!upgrade_lock(node, v)) {
+                if (parent) {
+                    write_unlock(parent);
+                }
+                goto restart;
+            }
+            if (parent) {
+                split_child_into(parent, parent_i, node, alloc_node_concurrent(b, node->is_leaf),
+                                 node_key_count(node) / 2);
+                write_unlock(parent);
+            } else if (node == __atomic_load_n(&b->root, __ATOMIC_ACQUIRE)) {
+                BTree_node* new_root = alloc_node_concurrent(b, false);
+                new_root->degree      = 0;
+                new_root->is_leaf     = false;
+                new_root->last_insert = NO_INSERT;
+                new_root->version     = 0;
+                new_root->children[0] = node;
+                split_child_into(new_root, 0, node, alloc_node_concurrent(b, node->is_leaf),
+                                 node_key_count(node) / 2);
+                __atomic_fetch_add(&b->depth, 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&b->root, new_root, __ATOMIC_RELEASE);
+            }
+            write_unlock(node);
+            goto restart;
+        }
+
+        size_t i = lower_bound(node, key);
+        if (unlikely(i < node_key_count(node) && node->keys[i] == key)) {
+            if (!validate(node, v)) {
+                goto restart;
+            }
+            return false;
+        }
+
+        if (node->is_leaf) {
+            if (!upgrade_lock(node, v)) {
+                goto restart;
+            }
+            if (parent && !validate(parent, parent_v)) {
+                write_unlock(node);
+                goto restart;
+            }
+            memmove(&node->keys[i+1], &node->keys[i], (node_key_count(node) - i) * sizeof node->keys[0]);
+            node->keys[i] = key;
+            node->degree++;
+            write_unlock(node);
+            return true;
         }
-        *node = (BTree_node){
-            .keys = {0},
-            .is_leaf = true,
-            .degree = 0,
-        };
-        BTree btree = {
-            .root = node,
-            .arena = &a,
-            .node_count = 0,
-            .depth = 0,
-        };
 
-        volatile bool ok;
-        const uint64_t insert_ceil = 16 * 1024 * 1024;
-        int64_t insert_count = 0;
-        for (uint64_t n = 0; n < insert_ceil; n++) {
-            insert_count += BTree_insert(&btree, random_key(n));
-            (void)ok;
+        BTree_node* child = node->children[i];
+        if (!validate(node, v)) {
+            goto restart;
+        }
+        const uint32_t child_v = read_lock(child);
+        if (!validate(node, v)) {
+            goto restart;
         }
+        parent   = node;
+        parent_v = v;
+        parent_i = i;
+        node     = child;
+        v        = child_v;
+    }
+}
+
+static Key subtree_max(const BTree_node* node)
+{
+    while (!node->is_leaf) {
+        node = node->children[node_key_count(node)];
+    }
+    return node->keys[node_key_count(node) - 1];
+}
+
+static Key subtree_min(const BTree_node* node)
+{
+    while (!node->is_leaf) {
+        node = node->children[0];
+    }
+    return node->keys[0];
+}
 
-        //print_node(btree.root);
+/* Remove keys[i] and the child to its right */
+static void remove_key_and_right_child(BTree_node* node, size_t i)
+{
+    memmove(&node->keys[i], &node->keys[i+1], (node_key_count(node) - i - 1) * sizeof node->keys[0]);
+    if (!node->is_leaf) {
+        memmove(&node->children[i+1], &node->children[i+2], (node_children_count(node) - i - 2) * sizeof node->children[0]);
+    }
+    node->degree--;
+}
+
+/* Move parent->keys[i] and all of children[i+1] into children[i], and free
+ * children[i+1]. The caller makes sure the result fits. */
+static void merge_children(BTree* btree, BTree_node* parent, size_t i)
+{
+    BTree_node* left  = parent->children[i];
+    BTree_node* right = parent->children[i+1];
+    const size_t n = node_key_count(left);
+
+    left->keys[n] = parent->keys[i];
+    memcpy(&left->keys[n+1], right->keys, node_key_count(right) * sizeof right->keys[0]);
+    if (!left->is_leaf) {
+        memcpy(&left->children[n+1], right->children, node_children_count(right) * sizeof right->children[0]);
+    }
+    left->degree += right->degree + 1;
 
-        printf("arena allocated:   %zu\n", a.size);
-        printf("items inserted:    %zu\n", insert_count);
-        printf("depth:             %zu\n", btree.depth);
-        printf("nodes:             %zu\n", btree.node_count);
-        printf("items per node:    %.1lf\n", (double)insert_count / (double)btree.node_count);
-        printf("overhead per item: %.1lf%%\n", 100*((double)a.size / (double)insert_count) / (double)sizeof(Key));
+    remove_key_and_right_child(parent, i);
+    free_node(btree, right);
+}
+
+/* Rotate one key from children[i-1] through the parent into children[i] */
+static void borrow_from_left(BTree_node* parent, size_t i)
+{
+    BTree_node* child = parent->children[i];
+    BTree_node* left  = parent->children[i-1];
+
+    memmove(&child->keys[1], &child->keys[0], node_key_count(child) * sizeof child->keys[0]);
+    child->keys[0] = parent->keys[i-1];
+    if (!child->is_leaf) {
+        memmove(&child->children[1], &child->children[0], node_children_count(child) * sizeof child->children[0]);
+        child->children[0] = left->children[node_key_count(left)];
     }
+    child->degree++;
 
-    return EXIT_SUCCESS;
+    parent->keys[i-1] = left->keys[node_key_count(left) - 1];
+    left->degree--;
 }
+
+/* Rotate one key from children[i+1] through the parent into children[i] */
+static void borrow_from_right(BTree_node* parent, size_t i)
+{
+    BTree_node* child = parent->children[i];
+    BTree_node* right = parent->children[i+1];
+
+    child->keys[node_key_count(child)] = parent->keys[i];
+    if (!child->is_leaf) {
+        child->children[node_children_count(child)] = right->children[0];
+    }
+    child->degree++;
+
+    parent->keys[i] = right->keys[0];
+    memmove(&right->keys[0], &right->keys[1], (node_key_count(right) - 1) * sizeof right->keys[0]);
+    if (!right->is_leaf) {
+        memmove(&right->children[0], &right->children[1], (node_children_count(right) - 1) * sizeof right->children[0]);
+    }
+    right->degree--;
+}
+
+/* Make sure children[i] can lose a key before descending into it, by
+ * borrowing from a sibling or merging with one. Returns the index of the
+ * child to descend into, which moves left if it was merged into its left
+ * sibling. */
+static size_t fill_child(BTree* btree, BTree_node* parent, size_t i)
+{
+    BTree_node* child = parent->children[i];
+    const size_t min = node_min_keys(child);
+    if (likely(node_key_count(child) > min)) {
+        return i;
+    }
+
+    BTree_node* left  = i > 0 ? parent->children[i-1] : NULL;
+    BTree_node* right = i < node_key_count(parent) ? parent->children[i+1] : NULL;
+
+    if (left && node_key_count(left) > min) {
+        own_child(btree, parent, i-1);
+        own_child(btree, parent, i);
+        borrow_from_left(parent, i);
+    } else if (right && node_key_count(right) > min) {
+        own_child(btree, parent, i);
+        own_child(btree, parent, i+1);
+        borrow_from_right(parent, i);
+    } else if (right) {
+        own_child(btree, parent, i);
+        merge_children(btree, parent, i);
+    } else {
+        own_child(btree, parent, i-1);
+        merge_children(btree, parent, i-1);
+        i--;
+    }
+    return i;
+}
+
+/* Single pass top-down removal: every node we descend into has a key to
+ * spare, so removing from a leaf or merging two of its children never
+ * leaves it underfull and we never have to walk back up. */
+static bool _BTree_remove(BTree* btree, BTree_node* node, Key key)
+{
+    for (;;) {
+        size_t i = lower_bound(node, key);
+        const bool here = i < node_key_count(node) && node->keys[i] == key;
+
+        if (node->is_leaf) {
+            if (!here) {
+                return false;
+            }
+            remove_key_and_right_child(node, i);
+            return true;
+        }
+
+        if (here) {
+            const BTree_node* left  = node->children[i];
+            const BTree_node* right = node->children[i+1];
+            if (node_key_count(left) > node_min_keys(left)) {
+                /* replace with the predecessor and remove that instead */
+                key = node->keys[i] = subtree_max(left);
+                node = own_child(btree, node, i);
+            } else if (node_key_count(right) > node_min_keys(right)) {
+                key = node->keys[i] = subtree_min(right);
+                node = own_child(btree, node, i+1);
+            } else {
+                /* the key ends up in the middle of the merged node */
+                own_child(btree, node, i);
+                merge_children(btree, node, i);
+                node = node->children[i];
+            }
+            continue;
+        }
+
+        i = fill_child(btree, node, i);
+        node = own_child(btree, node, i);
+    }
+}
+
+bool BTree_remove(BTree* b, Key key)
+{
+    /* borrowing and merging move separators as well as nodes */
+    b->shape++;
+    own_root(b);
+    const bool removed = _BTree_remove(b, b->root, key);
+
+    /* a merge emptied the root, the tree gets one level shorter */
+    if (unlikely(node_key_count(b->root) == 0 && !b->root->is_leaf)) {
+        BTree_node* old_root = b->root;
+        b->root = old_root->children[0];
+        b->depth -= 1;
+        free_node(b, old_root);
+    }
+    return removed;
+}
+
+/* Snapshots.
+ *
+ * Published versions are kept newest first, each holding a reference for
+ * every reader plus one while it is the latest. Replaced nodes are retired
+ * along with the generation they were replaced in: a node retired in
+ * generation r can only be reached from versions published before r, so
+ * it is freed once no version older than r is held. Readers only touch
+ * reference counts, everything else is left to the writer. */
+struct BTree_versions {
+    char           lock;
+    BTree_version* latest;
+    struct BTree_retired {
+        BTree_node* node;
+        uint32_t    gen;
+    }*             retired;
+    size_t         retired_count;
+    size_t         retired_cap;
+};
+
+static void versions_lock(struct BTree_versions* vs)
+{
+    while (__atomic_test_and_set(&vs->lock, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+}
+
+static void versions_unlock(struct BTree_versions* vs)
+{
+    __atomic_clear(&vs->lock, __ATOMIC_RELEASE);
+}
+
+static void retire_node(BTree* btree, BTree_node* node)
+{
+    struct BTree_versions* vs = btree->versions;
+    if (unlikely(vs->retired_count == vs->retired_cap)) {
+        vs->retired_cap = vs->retired_cap ? 2 * vs->retired_cap : 1024;
+        vs->retired = realloc(vs->retired, vs->retired_cap * sizeof *vs->retired);
+        if (unlikely(!vs->retired)) {
+            abort();
+        }
+    }
+    vs->retired[vs->retired_count++] = (struct BTree_retired) { .node = node, .gen = btree->gen };
+}
+
+/* Put the retired nodes no version older than `oldest` can reach on the
+ * free list */
+static void reclaim_nodes(BTree* btree, uint32_t oldest)
+{
+    struct BTree_versions* vs = btree->versions;
+    size_t kept = 0;
+    for (size_t i = 0; i < vs->retired_count; i++) {
+        if (vs->retired[i].gen <= oldest) {
+            push_free(btree, vs->retired[i].node);
+        } else {
+            vs->retired[kept++] = vs->retired[i];
+        }
+    }
+    vs->retired_count = kept;
+}
+
+void BTree_enable_snapshots(BTree* b)
+{
+    b->versions = calloc(1, sizeof *b->versions);
+    if (unlikely(!b->versions)) {
+        abort();
+    }
+    b->gen = 1;
+    BTree_publish(b);
+}
+
+void BTree_disable_snapshots(BTree* b)
+{
+    struct BTree_versions* vs = b->versions;
+    for (BTree_version* v = vs->latest; v;) {
+        BTree_version* older = v->older;
+        free(v);
+        v = older;
+    }
+    reclaim_nodes(b, UINT32_MAX);
+    free(vs->retired);
+    free(vs);
+    b->versions = NULL;
+    b->gen      = 0;
+}
+
+void BTree_publish(BTree* b)
+{
+    struct BTree_versions* vs = b->versions;
+    BTree_version* v = malloc(sizeof *v);
+    if (unlikely(!v)) {
+        abort();
+    }
+    *v = (BTree_version) {
+        .tree = {
+            .root       = b->root,
+            .depth      = b->depth,
+            .node_count = b->node_count,
+            .arena      = b->arena,
+            .gen        = b->gen,
+        },
+        .refs = 1,
+    };
+
+    versions_lock(vs);
+    v->older = vs->latest;
+    if (v->older) {
+        v->older->refs--;
+    }
+    vs->latest = v;
+    uint32_t oldest = b->gen;
+    for (BTree_version** p = &v->older; *p;) {
+        if ((*p)->refs == 0) {
+            BTree_version* dead = *p;
+            *p = dead->older;
+            free(dead);
+        } else {
+            oldest = (*p)->tree.gen;
+            p = &(*p)->older;
+        }
+    }
+    versions_unlock(vs);
+
+    /* from here on every node of the tree is shared with `v` */
+    b->gen++;
+    reclaim_nodes(b, oldest);
+}
+
+BTree_version* BTree_snapshot(BTree* b)
+{
+    struct BTree_versions* vs = b->versions;
+    versions_lock(vs);
+    BTree_version* v = vs->latest;
+    v->refs++;
+    versions_unlock(vs);
+    return v;
+}
+
+void BTree_snapshot_release(BTree* b, BTree_version* v)
+{
+    struct BTree_versions* vs = b->versions;
+    versions_lock(vs);
+    v->refs--;
+    versions_unlock(vs);
+}
+
+static BTree_node* new_leaf(BTree* btree)
+{
+    BTree_node* node = alloc_node(btree, true);
+    node->degree      = 0;
+    node->last_insert = NO_INSERT;
+    node->version     = btree->gen;
+    return node;
+}
+
+void BTree_init(struct arena* a, BTree* btree)
+{
+    *btree = (BTree) {
+        .arena = a,
+        .node_count = 0,
+        .depth = 0,
+        .free_list = NULL,
+        .free_leaf_list = NULL,
+    };
+    btree->root = new_leaf(btree);
+}
+
+BTree* BTree_new(struct arena* a)
+{
+    BTree* btree = arena_alloc(a, sizeof *btree);
+    if (unlikely(!btree)) {
+        abort();
+    }
+    BTree_init(a, btree);
+    return btree;
+}
+
+/* Bottom-up construction.
+ *
+ * The sorted keys are cut into leaves of about `leaf_keys` keys, with one key
+ * between every pair of leaves held back as a separator for the level above.
+ * Each internal level is then built the same way out of the level below it,
+ * until a single node is left. Nodes are spread evenly within a level so the
+ * last node in a level is never left nearly empty.
+ *
+ * Where every node goes, and which keys or children it takes, follows from
+ * its index in the level alone. A level is allocated as one block and cut
+ * into contiguous ranges of nodes that threads fill independently, each in
+ * its own region of the block. */
+
+/* the j-th node of a level allocated as one block */
+static inline BTree_node* level_node(BTree_node* level, size_t j, bool is_leaf)
+{
+    return (BTree_node*)((char*)level + j * node_size(is_leaf));
+}
+
+/* one level, or one thread's range of it */
+struct bulk_level {
+    const Key*        keys;  /* the input keys, for the leaf level */
+    BTree_node*       below; /* the level below, for internal levels */
+    bool              below_leaves;
+    const Key*        seps_below;
+    size_t            count_below;
+    BTree_node*       nodes;
+    Key*              seps;  /* seps[j] is the key between nodes j and j + 1 */
+    size_t            count;
+    size_t            begin, end;
+    uint32_t          gen;
+};
+
+/* Start of the j-th of `parts` even parts of `total` items */
+static inline size_t even_start(size_t total, size_t parts, size_t j)
+{
+    return j * (total / parts) + (j < total % parts ? j : total % parts);
+}
+
+static void* build_leaves(void* arg)
+{
+    const struct bulk_level* l = arg;
+    /* every leaf but the last is followed by its separator */
+    const size_t leaf_total = l->count_below - (l->count - 1);
+    for (size_t j = l->begin; j < l->end; j++) {
+        const size_t start = even_start(leaf_total, l->count, j) + j;
+        BTree_node* leaf = level_node(l->nodes, j, true);
+        leaf->is_leaf     = true;
+        leaf->last_insert = NO_INSERT;
+        leaf->version     = l->gen;
+        leaf->degree      = even_start(leaf_total, l->count, j + 1) + j - start;
+        memcpy(leaf->keys, &l->keys[start], leaf->degree * sizeof *leaf->keys);
+        if (j + 1 < l->count) {
+            l->seps[j] = l->keys[start + leaf->degree];
+        }
+    }
+    return NULL;
+}
+
+static void* build_internal(void* arg)
+{
+    const struct bulk_level* l = arg;
+    for (size_t j = l->begin; j < l->end; j++) {
+        const size_t child = even_start(l->count_below, l->count, j);
+        const size_t c     = even_start(l->count_below, l->count, j + 1) - child;
+        BTree_node* node = level_node(l->nodes, j, false);
+        node->is_leaf     = false;
+        node->last_insert = NO_INSERT;
+        node->version     = l->gen;
+        node->degree      = c - 1;
+        for (size_t k = 0; k < c; k++) {
+            node->children[k] = level_node(l->below, child + k, l->below_leaves);
+        }
+        memcpy(node->keys, &l->seps_below[child], (c - 1) * sizeof *node->keys);
+        if (j + 1 < l->count) {
+            l->seps[j] = l->seps_below[child + c - 1];
+        }
+    }
+    return NULL;
+}
+
+/* below this many nodes per thread a level is built by the calling thread */
+#define BULK_MIN_NODES_PER_THREAD 1024
+
+static void build_level(void* (*build)(void*), struct bulk_level level, size_t threads)
+{
+    const size_t most = level.count / BULK_MIN_NODES_PER_THREAD;
+    threads = threads < most ? threads : most;
+    if (threads <= 1) {
+        level.begin = 0;
+        level.end   = level.count;
+        build(&level);
+        return;
+    }
+    pthread_t         tids[threads];
+    struct bulk_level parts[threads];
+    for (size_t t = 0; t < threads; t++) {
+        parts[t] = level;
+        parts[t].begin = even_start(level.count, threads, t);
+        parts[t].end   = even_start(level.count, threads, t + 1);
+        if (t > 0 && pthread_create(&tids[t], NULL, build, &parts[t]) != 0) {
+            abort();
+        }
+    }
+    build(&parts[0]);
+    for (size_t t = 1; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+}
+
+struct sorted_check {
+    const Key* keys;
+    size_t     begin, end;
+    bool       sorted;
+};
+
+static void* check_sorted(void* arg)
+{
+    struct sorted_check* c = arg;
+    c->sorted = true;
+    for (size_t i = c->begin + 1; i < c->end; i++) {
+        if (unlikely(c->keys[i-1] >= c->keys[i])) {
+            c->sorted = false;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Check that keys are strictly ascending with a slice per thread, the
+ * slices overlapping by one key */
+static bool keys_sorted(const Key* keys, size_t n, size_t threads)
+{
+    const size_t most = n / (BULK_MIN_NODES_PER_THREAD * MAX_LEAF_KEY);
+    threads = threads < most ? threads : most;
+    if (threads <= 1) {
+        struct sorted_check c = { .keys = keys, .begin = 0, .end = n };
+        check_sorted(&c);
+        return c.sorted;
+    }
+    pthread_t           tids[threads];
+    struct sorted_check checks[threads];
+    for (size_t t = 0; t < threads; t++) {
+        const size_t begin = even_start(n, threads, t);
+        checks[t] = (struct sorted_check) {
+            .keys  = keys,
+            .begin = begin > 0 ? begin - 1 : 0,
+            .end   = even_start(n, threads, t + 1),
+        };
+        if (t > 0 && pthread_create(&tids[t], NULL, check_sorted, &checks[t]) != 0) {
+            abort();
+        }
+    }
+    check_sorted(&checks[0]);
+    bool sorted = checks[0].sorted;
+    for (size_t t = 1; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        sorted = sorted && checks[t].sorted;
+    }
+    return sorted;
+}
+
+bool BTree_bulk_load_parallel(BTree* btree, const Key* keys, size_t n, double fill_factor, size_t threads)
+{
+    if (node_key_count(btree->root) != 0 || !btree->root->is_leaf) {
+        return false;
+    }
+    if (!keys_sorted(keys, n, threads)) {
+        return false;
+    }
+    if (n == 0) {
+        return true;
+    }
+
+    /* a leaf needs at least 2 keys, and an internal node 3 children, for
+     * the even spread to never leave a node empty */
+    size_t leaf_keys = (size_t)(fill_factor * MAX_LEAF_KEY + 0.5);
+    size_t fanout    = (size_t)(fill_factor * MAX_CHILDREN + 0.5);
+    leaf_keys = leaf_keys < 2 ? 2 : leaf_keys > MAX_LEAF_KEY ? MAX_LEAF_KEY : leaf_keys;
+    fanout    = fanout < 3 ? 3 : fanout > MAX_CHILDREN ? MAX_CHILDREN : fanout;
+
+    size_t count = (n + 1 + leaf_keys) / (leaf_keys + 1);
+    Key* seps[2] = { malloc(count * sizeof (Key)), malloc(count * sizeof (Key)) };
+    BTree_node* nodes = arena_alloc(btree->arena, count * node_size(true));
+    if (unlikely(!seps[0] || !seps[1] || !nodes)) {
+        abort();
+    }
+
+    free_node(btree, btree->root);
+    build_level(build_leaves, (struct bulk_level) {
+        .keys = keys, .count_below = n, .nodes = nodes, .seps = seps[0], .count = count, .gen = btree->gen,
+    }, threads);
+    btree->node_count += count;
+
+    /* separators are read from one buffer while the level above writes
+     * the other */
+    size_t depth = 0;
+    while (count > 1) {
+        const size_t parents = (count + fanout - 1) / fanout;
+        BTree_node* above = arena_alloc(btree->arena, parents * node_size(false));
+        if (unlikely(!above)) {
+            abort();
+        }
+        build_level(build_internal, (struct bulk_level) {
+            .below = nodes, .below_leaves = depth == 0, .seps_below = seps[depth % 2], .count_below = count,
+            .nodes = above, .seps = seps[(depth + 1) % 2], .count = parents, .gen = btree->gen,
+        }, threads);
+        btree->node_count += parents;
+        nodes = above;
+        count = parents;
+        depth++;
+    }
+
+    btree->root  = nodes;
+    btree->depth = depth;
+    btree->shape++;
+    free(seps[0]);
+    free(seps[1]);
+    return true;
+}
+
+bool BTree_bulk_load(BTree* btree, const Key* keys, size_t n, double fill_factor)
+{
+    return BTree_bulk_load_parallel(btree, keys, n, fill_factor, 1);
+}
+
+bool BTree_find(const BTree* b, Key key)
+{
+    BTree_node* node = b->root;
+    for (;;) {
+        size_t i = lower_bound(node, key);
+        if (i < node_key_count(node) && node->keys[i] == key) {
+            return true;
+        }
+        if (node->is_leaf) {
+            return false;
+        }
+        node = node->children[i];
+    }
+}
+
+bool BTree_find_finger(const BTree* b, Key key, BTree_finger* finger)
+{
+    finger->depth = finger_start(b, finger, key, false);
+    if (finger->depth == 0) {
+        finger_reset(finger, b);
+    }
+    finger->tree  = b;
+    finger->shape = b->shape;
+    for (;;) {
+        const BTree_node* node = finger->path[finger->depth - 1].node;
+        size_t i = lower_bound(node, key);
+        if (i < node_key_count(node) && node->keys[i] == key) {
+            return true;
+        }
+        if (node->is_leaf) {
+            return false;
+        }
+        finger_push(finger, i);
+    }
+}
+
+/* lookups advanced together by BTree_find_batch */
+#define FIND_BATCH 16
+
+static inline void prefetch_node(const BTree_node* node)
+{
+    __builtin_prefetch(node);
+    __builtin_prefetch((const char*)node + CACHE_LINE_SIZE);
+}
+
+size_t BTree_find_batch(const BTree* b, const Key* keys, size_t n, bool* found)
+{
+    size_t count = 0;
+    for (size_t base = 0; base < n; base += FIND_BATCH) {
+        const size_t m = n - base < FIND_BATCH ? n - base : FIND_BATCH;
+        const BTree_node* nodes[FIND_BATCH];
+        for (size_t q = 0; q < m; q++) {
+            nodes[q] = b->root;
+        }
+
+        /* all leaves are at the same depth, but a lookup that hits a key in
+         * an internal node is done early and drops out of the group */
+        size_t active = m;
+        while (active > 0) {
+            active = 0;
+            for (size_t q = 0; q < m; q++) {
+                const BTree_node* node = nodes[q];
+                if (!node) {
+                    continue;
+                }
+                const Key key = keys[base + q];
+                const size_t i = lower_bound(node, key);
+                if (i < node_key_count(node) && node->keys[i] == key) {
+                    found[base + q] = true;
+                    nodes[q] = NULL;
+                    count++;
+                } else if (node->is_leaf) {
+                    found[base + q] = false;
+                    nodes[q] = NULL;
+                } else {
+                    nodes[q] = node->children[i];
+                    prefetch_node(nodes[q]);
+                    active++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+/* Prefetch both cache lines of the node a scan will reach after the
+ * current leaf, so the walk over the parent key overlaps the load. */
+static inline void prefetch_sibling(const BTree_cursor* c, int direction)
+{
+    if (c->depth < 2) {
+        return;
+    }
+    const struct BTree_path* parent = &c->path[c->depth - 2];
+    const size_t sibling = parent->index + direction;
+    if (sibling < node_children_count(parent->node)) {
+        const char* p = parent->node->children[sibling];
+        __builtin_prefetch(p);
+        __builtin_prefetch(p + CACHE_LINE_SIZE);
+    }
+}
+
+/* push `node` and its leftmost (or rightmost) descendants onto the path */
+static void descend_leftmost(BTree_cursor* c, BTree_node* node)
+{
+    while (!node->is_leaf) {
+        c->path[c->depth++] = (struct BTree_path) { .node = node, .index = 0 };
+        node = node->children[0];
+    }
+    c->path[c->depth++] = (struct BTree_path) { .node = node, .index = 0 };
+    prefetch_sibling(c, +1);
+}
+
+static void descend_rightmost(BTree_cursor* c, BTree_node* node)
+{
+    while (!node->is_leaf) {
+        c->path[c->depth++] = (struct BTree_path) { .node = node, .index = node_key_count(node) };
+        node = node->children[node_key_count(node)];
+    }
+    c->path[c->depth++] = (struct BTree_path) { .node = node, .index = node_key_count(node) - 1 };
+    prefetch_sibling(c, -1);
+}
+
+bool BTree_first(const BTree* b, BTree_cursor* cursor)
+{
+    cursor->depth = 0;
+    if (node_key_count(b->root) == 0) {
+        return false;
+    }
+    descend_leftmost(cursor, b->root);
+    return true;
+}
+
+bool BTree_last(const BTree* b, BTree_cursor* cursor)
+{
+    cursor->depth = 0;
+    if (node_key_count(b->root) == 0) {
+        return false;
+    }
+    descend_rightmost(cursor, b->root);
+    return true;
+}
+
+bool BTree_next(BTree_cursor* c)
+{
+    struct BTree_path* top = &c->path[c->depth - 1];
+
+    if (!top->node->is_leaf) {
+        /* successor is the leftmost key in the right subtree */
+        top->index++;
+        descend_leftmost(c, top->node->children[top->index]);
+        return true;
+    }
+
+    if (likely(top->index + 1 < node_key_count(top->node))) {
+        top->index++;
+        return true;
+    }
+
+    /* climb until we return from a child that has a key to its right */
+    while (--c->depth > 0) {
+        top = &c->path[c->depth - 1];
+        if (top->index < node_key_count(top->node)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BTree_prev(BTree_cursor* c)
+{
+    struct BTree_path* top = &c->path[c->depth - 1];
+
+    if (!top->node->is_leaf) {
+        /* predecessor is the rightmost key in the left subtree */
+        descend_rightmost(c, top->node->children[top->index]);
+        return true;
+    }
+
+    if (likely(top->index > 0)) {
+        top->index--;
+        return true;
+    }
+
+    /* climb until we return from a child that has a key to its left */
+    while (--c->depth > 0) {
+        top = &c->path[c->depth - 1];
+        if (top->index > 0) {
+            top->index--;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Push the path from `node` down to the first key >= `key` in its subtree,
+ * stepping on past the subtree if every key in it is smaller */
+static bool descend_lower_bound(BTree_cursor* cursor, BTree_node* node, Key key)
+{
+    for (;;) {
+        size_t i = lower_bound(node, key);
+        cursor->path[cursor->depth++] = (struct BTree_path) { .node = node, .index = i };
+
+        if (i < node_key_count(node) && node->keys[i] == key) {
+            return true;
+        }
+        if (node->is_leaf) {
+            if (i < node_key_count(node)) {
+                return true;
+            }
+            if (i == 0) {
+                /* only an empty root leaf can get here */
+                cursor->depth = 0;
+                return false;
+            }
+            /* every key in this leaf is smaller, the answer is the
+             * successor of the last one */
+            cursor->path[cursor->depth - 1].index = i - 1;
+            return BTree_next(cursor);
+        }
+        node = node->children[i];
+    }
+}
+
+bool BTree_lower_bound(const BTree* b, Key key, BTree_cursor* cursor)
+{
+    cursor->depth = 0;
+    return descend_lower_bound(cursor, b->root, key);
+}
+
+/* Set operations.
+ *
+ * Both trees are streamed in order into a sorted array that the result is
+ * bulk loaded from. A cursor that is behind catches up with a seek, which
+ * climbs only as far as the subtree holding the target and descends from
+ * there, so runs of keys with nothing to match are skipped a subtree at a
+ * time. Runs that are kept are copied out of the leaves whole. */
+
+/* Move a valid cursor forward to the first key >= `key` */
+static bool cursor_seek(BTree_cursor* c, Key key)
+{
+    if (BTree_cursor_key(c) >= key) {
+        return true;
+    }
+    /* climb out of subtrees whose keys are all smaller, every ancestor
+     * subtree holds the current key, so a descent from it only lands on
+     * keys ahead of the cursor */
+    while (c->depth > 1) {
+        const struct BTree_path* parent = &c->path[c->depth - 2];
+        if (parent->index < node_key_count(parent->node) && parent->node->keys[parent->index] >= key) {
+            break;
+        }
+        c->depth--;
+    }
+    return descend_lower_bound(c, c->path[--c->depth].node, key);
+}
+
+struct key_vec {
+    Key*   keys;
+    size_t len;
+    size_t cap;
+};
+
+static void key_vec_append(struct key_vec* v, const Key* keys, size_t n)
+{
+    if (unlikely(v->len + n > v->cap)) {
+        do {
+            v->cap = v->cap ? 2 * v->cap : 1024;
+        } while (v->len + n > v->cap);
+        v->keys = realloc(v->keys, v->cap * sizeof *v->keys);
+        if (unlikely(!v->keys)) {
+            abort();
+        }
+    }
+    memcpy(&v->keys[v->len], keys, n * sizeof *keys);
+    v->len += n;
+}
+
+/* Append the keys from a valid cursor up to the first key >= `bound`, or
+ * the end of the tree with `to_end`, and leave the cursor there. Returns
+ * false if the cursor ran off the end. */
+static bool copy_run(struct key_vec* out, BTree_cursor* c, Key bound, bool to_end)
+{
+    for (;;) {
+        struct BTree_path* top = &c->path[c->depth - 1];
+        const BTree_node* node = top->node;
+        size_t end = node->is_leaf ? node_key_count(node) : top->index + 1;
+        if (!to_end) {
+            size_t i = top->index;
+            while (i < end && node->keys[i] < bound) {
+                i++;
+            }
+            if (i < end) {
+                key_vec_append(out, &node->keys[top->index], i - top->index);
+                top->index = i;
+                return true;
+            }
+        }
+        key_vec_append(out, &node->keys[top->index], end - top->index);
+        top->index = end - 1;
+        if (!BTree_next(c)) {
+            return false;
+        }
+    }
+}
+
+enum set_op { SET_UNION, SET_INTERSECT, SET_DIFFERENCE };
+
+static void merge_keys(struct key_vec* out, const BTree* a, const BTree* b, enum set_op op)
+{
+    BTree_cursor ca, cb;
+    bool more_a = BTree_first(a, &ca);
+    bool more_b = BTree_first(b, &cb);
+    while (more_a && more_b) {
+        const Key ka = BTree_cursor_key(&ca);
+        const Key kb = BTree_cursor_key(&cb);
+        if (ka < kb) {
+            more_a = op == SET_INTERSECT ? cursor_seek(&ca, kb) : copy_run(out, &ca, kb, false);
+        } else if (kb < ka) {
+            more_b = op == SET_UNION ? copy_run(out, &cb, ka, false) : cursor_seek(&cb, ka);
+        } else {
+            if (op != SET_DIFFERENCE) {
+                key_vec_append(out, &ka, 1);
+            }
+            more_a = BTree_next(&ca);
+            more_b = BTree_next(&cb);
+        }
+    }
+    if (more_a && op != SET_INTERSECT) {
+        copy_run(out, &ca, 0, true);
+    }
+    if (more_b && op == SET_UNION) {
+        copy_run(out, &cb, 0, true);
+    }
+}
+
+static bool set_op(BTree* out, const BTree* a, const BTree* b, double fill_factor, enum set_op op)
+{
+    if (node_key_count(out->root) != 0 || !out->root->is_leaf) {
+        return false;
+    }
+    struct key_vec keys = { 0 };
+    merge_keys(&keys, a, b, op);
+    const bool ok = BTree_bulk_load(out, keys.keys, keys.len, fill_factor);
+    free(keys.keys);
+    return ok;
+}
+
+bool BTree_union(BTree* out, const BTree* a, const BTree* b, double fill_factor)
+{
+    return set_op(out, a, b, fill_factor, SET_UNION);
+}
+
+bool BTree_intersect(BTree* out, const BTree* a, const BTree* b, double fill_factor)
+{
+    return set_op(out, a, b, fill_factor, SET_INTERSECT);
+}
+
+bool BTree_difference(BTree* out, const BTree* a, const BTree* b, double fill_factor)
+{
+    return set_op(out, a, b, fill_factor, SET_DIFFERENCE);
+}
+
+size_t BTree_search_kernel_count(void)
+{
+    return ARRAY_LEN(search_kernels);
+}
+
+const char* BTree_search_kernel_name(size_t i)
+{
+    return search_kernels[i].name;
+}
+
+bool BTree_search_kernel_supported(size_t i)
+{
+    return search_kernels[i].supported();
+}
+
+bool BTree_search_kernel_select(size_t i)
+{
+    if (!search_kernels[i].supported()) {
+        return false;
+    }
+    search_kernel = &search_kernels[i];
+    return true;
+}
+
+size_t BTree_search_kernel_selected(void)
+{
+    return (size_t)(search_kernel - search_kernels);
+}
+
+/* arrays can be longer than a node, narrow them down like lower_bound */
+#define KEYS_LOWER_BOUND(name, K, scan)                   \
+    size_t name(const K* keys, size_t n, K k)             \
+    {                                                     \
+        size_t base = 0;                                  \
+        while (n > SCAN_KEYS) {                           \
+            const size_t half = n / 2;                    \
+            if (keys[base + half] < k) {                  \
+                base += half + 1;                         \
+                n    -= half + 1;                         \
+            } else {                                      \
+                n = half;                                 \
+            }                                             \
+        }                                                 \
+        return base + scan(&keys[base], n, k);            \
+    }
+
+KEYS_LOWER_BOUND(BTree_keys_lower_bound,           Key,       search_kernel->fn)
+KEYS_LOWER_BOUND(BTree_keys_lower_bound_uint32_t,  uint32_t,  search_kernel->fn_uint32)
+KEYS_LOWER_BOUND(BTree_keys_lower_bound_int32_t,   int32_t,   search_kernel->fn_int32)
+KEYS_LOWER_BOUND(BTree_keys_lower_bound_int64_t,   int64_t,   search_kernel->fn_int64)
+KEYS_LOWER_BOUND(BTree_keys_lower_bound_double,    double,    search_kernel->fn_double)
+/* no vector compare is 128 bits wide */
+KEYS_LOWER_BOUND(BTree_keys_lower_bound_uint128_t, uint128_t, lower_bound_scalar_uint128)
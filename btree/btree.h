@@ -0,0 +1,343 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "arena.h"
+
+typedef uint64_t Key;
+#define KeyFmt PRIu64
+
+/* the widest key type a B+tree can be instantiated with, see bptree.h */
+typedef unsigned __int128 uint128_t;
+
+/* Node size in bytes, a multiple of the cache line size. Wider nodes make
+ * the tree shallower at the cost of reading more of each node, which pays
+ * off when the hardware prefetcher streams the lines in. Build with e.g.
+ * -DBTREE_NODE_SIZE=4096 to change it, see `make matrix`. */
+#ifndef BTREE_NODE_SIZE
+#define BTREE_NODE_SIZE (2*CACHE_LINE_SIZE)
+#endif
+
+/* Leaf size in bytes, the same as the node size unless built with e.g.
+ * -DBTREE_LEAF_SIZE=512. Leaves have no children, so a leaf of either size
+ * holds about twice the keys of an internal node. */
+#ifndef BTREE_LEAF_SIZE
+#define BTREE_LEAF_SIZE BTREE_NODE_SIZE
+#endif
+
+#define MAX_CHILDREN (BTREE_NODE_SIZE/(sizeof(void*) + sizeof (Key)))
+#define MAX_KEY (MAX_CHILDREN-1)
+
+/* the node header takes the place of the key an internal node goes without */
+#define MAX_LEAF_KEY ((BTREE_LEAF_SIZE - sizeof (Key))/sizeof (Key))
+
+#define BTREE_NODE_KEYS (MAX_LEAF_KEY > MAX_KEY ? MAX_LEAF_KEY : MAX_KEY)
+
+/* Every node but the root has at least MAX_CHILDREN/2 children, so this is
+ * enough for 2^64 keys with the smallest supported node size. */
+#define BTREE_MAX_DEPTH 32
+
+/* Leaves and internal nodes share the header and differ in what follows
+ * it: a leaf is MAX_LEAF_KEY keys, an internal node MAX_KEY keys and
+ * MAX_CHILDREN children. Each is allocated at its own size, so only the
+ * fields of its kind may be touched, and a leaf's children never. */
+typedef struct BTree_node {
+    uint16_t degree;
+    uint8_t is_leaf;
+    uint8_t last_insert; /* which end of the node the key inserted last went to, picks the split point */
+    uint32_t version; /* odd while write locked by the concurrent functions, or with
+                         snapshots enabled, the generation the node was written in */
+    union {
+        Key keys[BTREE_NODE_KEYS];
+        struct {
+            Key internal_keys_[MAX_KEY];
+            void* children[MAX_CHILDREN];
+        };
+    };
+} __attribute__((aligned(CACHE_LINE_SIZE))) BTree_node;
+
+_Static_assert(BTREE_NODE_SIZE % CACHE_LINE_SIZE == 0, "node size should be whole cache lines");
+_Static_assert(BTREE_LEAF_SIZE % CACHE_LINE_SIZE == 0, "leaf size should be whole cache lines");
+_Static_assert(sizeof (BTree_node) == (BTREE_LEAF_SIZE > BTREE_NODE_SIZE ? BTREE_LEAF_SIZE : BTREE_NODE_SIZE),
+               "node doesn't fill its size");
+_Static_assert(MAX_CHILDREN >= 8, "node too small for BTREE_MAX_DEPTH");
+_Static_assert(MAX_LEAF_KEY >= 7, "leaf too small to split and merge");
+_Static_assert(BTREE_NODE_KEYS <= UINT16_MAX, "key count doesn't fit BTree_node.degree");
+
+typedef struct BTree {
+    struct BTree_node* root;
+    size_t             depth;
+    size_t             node_count;
+    struct arena*      arena;
+    struct BTree_node* free_list;      /* internal nodes */
+    struct BTree_node* free_leaf_list;
+    uint32_t           gen;      /* copy-on-write generation, 0 without snapshots */
+    struct BTree_versions* versions;
+    uint64_t           shape;    /* changes whenever a node splits, moves or is freed */
+} BTree;
+
+/* A published version of a tree, readable with any function that takes a
+ * const BTree*. See BTree_snapshot. */
+typedef struct BTree_version {
+    BTree                 tree;
+    size_t                refs;
+    struct BTree_version* older;
+} BTree_version;
+
+/* A position in the tree.
+ *
+ * The cursor keeps the whole root-to-node path, so stepping to the next or
+ * previous key only walks up or down from where it is and never re-descends
+ * from the root. For ancestors `index` is the child that was descended into,
+ * for the last entry it is the index of the current key. */
+typedef struct BTree_cursor {
+    size_t depth;
+    struct BTree_path {
+        BTree_node* node;
+        size_t      index;
+    } path[BTREE_MAX_DEPTH];
+} BTree_cursor;
+
+/* The path of the last fingered operation on a tree.
+ *
+ * Along with each node the finger keeps the range of keys its subtree can
+ * hold, [lo, hi], bounded by the separators in its ancestors. The next
+ * operation starts from the lowest node on the path whose range holds its
+ * key, so a stream of nearby keys mostly starts in the leaf it ends in. The
+ * finger is dropped, and the operation starts from the root, if the tree
+ * changed shape since. A zeroed finger is empty. */
+typedef struct BTree_finger {
+    const BTree* tree;
+    uint64_t     shape;
+    size_t       depth;
+    struct BTree_finger_path {
+        BTree_node* node;
+        Key         lo;
+        Key         hi;
+    } path[BTREE_MAX_DEPTH];
+} BTree_finger;
+
+/**
+ * Allocate a new empty tree in arena `a`.
+ * Aborts if the arena is out of memory.
+ */
+BTree* BTree_new(struct arena* a);
+
+/**
+ * Initialize an empty tree allocating its nodes from arena `a`.
+ * Aborts if the arena is out of memory.
+ */
+void BTree_init(struct arena* a, BTree* btree);
+
+/**
+ * Insert `key`.
+ * Returns false if the key was already present.
+ */
+bool BTree_insert(BTree* b, const Key key);
+
+/**
+ * Remove `key`.
+ * Returns false if the key wasn't present.
+ */
+bool BTree_remove(BTree* b, Key key);
+
+/**
+ * Build the tree bottom-up from `n` strictly ascending keys.
+ * Leaves and internal nodes are filled to about `fill_factor` (0, 1] of their
+ * capacity; 1.0 packs every node full.
+ * Returns false, without touching the tree, if it isn't empty or the keys
+ * aren't strictly ascending.
+ */
+bool BTree_bulk_load(BTree* btree, const Key* keys, size_t n, double fill_factor);
+
+/**
+ * BTree_bulk_load with the checking of the keys and every level of the tree
+ * split across up to `threads` threads. Builds the same tree as
+ * BTree_bulk_load. Small levels are built by the calling thread alone.
+ */
+bool BTree_bulk_load_parallel(BTree* btree, const Key* keys, size_t n, double fill_factor, size_t threads);
+
+/**
+ * Returns true if `key` is in the tree.
+ */
+bool BTree_find(const BTree* b, Key key);
+
+/**
+ * BTree_insert and BTree_find starting from `finger`, which is left on the
+ * path to `key`. Near-sequential keys take O(1) node visits each instead of
+ * one per level. Fingers don't mix with the concurrent functions, which
+ * change the tree without changing its shape count.
+ */
+bool BTree_insert_finger(BTree* b, Key key, BTree_finger* finger);
+
+bool BTree_find_finger(const BTree* b, Key key, BTree_finger* finger);
+
+/**
+ * Look up `n` keys at once, setting found[i] if keys[i] is in the tree.
+ * Lookups are advanced in groups one level at a time, and the next node of
+ * every lookup in a group is prefetched before any of them is searched, so
+ * the cache misses of the group overlap instead of happening one by one.
+ * Returns the number of keys found.
+ */
+size_t BTree_find_batch(const BTree* b, const Key* keys, size_t n, bool* found);
+
+/**
+ * Thread safe insert and lookup using optimistic lock coupling.
+ *
+ * Readers never write to the nodes they pass through. They read a node's
+ * version, read the node and check that the version is unchanged, and
+ * restart from the root if it isn't. Writers only lock the leaf they insert
+ * into, or the node being split and its parent.
+ *
+ * These may be called from any number of threads at once, but not at the
+ * same time as any other function that modifies the tree. The tree's arena
+ * must have the ARENA_SHARED flag set. Nodes are never taken from the free
+ * list, since a reader may still be looking at a node after it is freed.
+ */
+bool BTree_insert_concurrent(BTree* b, Key key);
+
+bool BTree_find_concurrent(const BTree* b, Key key);
+
+/**
+ * Copy-on-write snapshots.
+ *
+ * With snapshots enabled the writer never changes a node that a published
+ * version can reach. The first change to such a node after a publish copies
+ * it, and the path down to it from the root, into the arena. Nodes written
+ * since the last publish are changed in place, so publishing after a batch
+ * of changes copies each path once per batch.
+ *
+ * BTree_snapshot hands out the latest published version in O(1), from any
+ * thread, and it can be read without locks while the writer carries on.
+ * Nodes replaced by copies go back on the free list at the first publish
+ * after every version that reaches them is released.
+ *
+ * Only one thread may change the tree. Snapshots don't mix with the
+ * concurrent functions, which use the node version for their locks.
+ * Aborts if out of memory.
+ */
+void BTree_enable_snapshots(BTree* b);
+
+/**
+ * Free the published versions, which must all have been released, and go
+ * back to changing nodes in place.
+ */
+void BTree_disable_snapshots(BTree* b);
+
+/**
+ * Make the changes so far visible to BTree_snapshot.
+ */
+void BTree_publish(BTree* b);
+
+/**
+ * The latest published version, which stays valid and unchanged until it
+ * is given back with BTree_snapshot_release.
+ */
+BTree_version* BTree_snapshot(BTree* b);
+
+void BTree_snapshot_release(BTree* b, BTree_version* v);
+
+/**
+ * Position a cursor at the first key >= `key`.
+ * Returns false, and leaves the cursor invalid, if there is no such key.
+ */
+bool BTree_lower_bound(const BTree* b, Key key, BTree_cursor* cursor);
+
+/**
+ * Position a cursor at the smallest key.
+ * Returns false, and leaves the cursor invalid, if the tree is empty.
+ */
+bool BTree_first(const BTree* b, BTree_cursor* cursor);
+
+/**
+ * Position a cursor at the largest key.
+ * Returns false, and leaves the cursor invalid, if the tree is empty.
+ */
+bool BTree_last(const BTree* b, BTree_cursor* cursor);
+
+/**
+ * Step to the next key in ascending order.
+ * Returns false, and invalidates the cursor, when stepping past the last key.
+ */
+bool BTree_next(BTree_cursor* cursor);
+
+/**
+ * Step to the previous key in ascending order.
+ * Returns false, and invalidates the cursor, when stepping past the first key.
+ */
+bool BTree_prev(BTree_cursor* cursor);
+
+static inline bool BTree_cursor_valid(const BTree_cursor* cursor)
+{
+    return cursor->depth > 0;
+}
+
+/**
+ * The key under a valid cursor.
+ */
+static inline Key BTree_cursor_key(const BTree_cursor* cursor)
+{
+    const struct BTree_path* top = &cursor->path[cursor->depth - 1];
+    return top->node->keys[top->index];
+}
+
+/**
+ * Bulk load the empty tree `out` with the keys in `a` or `b`, in both, or in
+ * `a` but not `b`. Both trees are merged in one ordered pass, skipping whole
+ * subtrees with no keys to match, and nodes are filled as by
+ * BTree_bulk_load. `out` must be a different tree from `a` and `b`.
+ * Returns false, without touching `out`, if it isn't empty.
+ */
+bool BTree_union(BTree* out, const BTree* a, const BTree* b, double fill_factor);
+
+bool BTree_intersect(BTree* out, const BTree* a, const BTree* b, double fill_factor);
+
+bool BTree_difference(BTree* out, const BTree* a, const BTree* b, double fill_factor);
+
+/**
+ * Node search kernels.
+ * One is selected at startup from cpuid, the benchmark can select the others.
+ */
+size_t BTree_search_kernel_count(void);
+
+const char* BTree_search_kernel_name(size_t i);
+
+bool BTree_search_kernel_supported(size_t i);
+
+/**
+ * Returns false, and keeps the current kernel, if the CPU lacks support.
+ */
+bool BTree_search_kernel_select(size_t i);
+
+size_t BTree_search_kernel_selected(void);
+
+/**
+ * Index of the first of the `n` sorted `keys` that is >= k, using the
+ * selected kernel. Longer arrays are narrowed down by binary search first.
+ */
+size_t BTree_keys_lower_bound(const Key* keys, size_t n, Key k);
+
+/**
+ * BTree_keys_lower_bound for the key types a B+tree can be instantiated
+ * with, named after the type so bptree.h can paste it together. Signed
+ * keys and doubles are ordered by value. Doubles must not be NaN.
+ */
+size_t BTree_keys_lower_bound_uint32_t(const uint32_t* keys, size_t n, uint32_t k);
+
+size_t BTree_keys_lower_bound_int32_t(const int32_t* keys, size_t n, int32_t k);
+
+size_t BTree_keys_lower_bound_int64_t(const int64_t* keys, size_t n, int64_t k);
+
+size_t BTree_keys_lower_bound_double(const double* keys, size_t n, double k);
+
+size_t BTree_keys_lower_bound_uint128_t(const uint128_t* keys, size_t n, uint128_t k);
+
+static inline size_t BTree_keys_lower_bound_uint64_t(const uint64_t* keys, size_t n, uint64_t k)
+{
+    return BTree_keys_lower_bound(keys, n, k);
+}
+
+void print_node(BTree_node* node);
@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_double
+#define BTREE_VAL double
+#include "../bptree.c"
@@ -0,0 +1,6 @@
+#pragma once
+#define BTREE_PREFIX bptree_double
+#define BTREE_VAL double
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_PREFIX
@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_float
+#define BTREE_VAL float
+#include "../bptree.c"
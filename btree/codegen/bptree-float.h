@@ -0,0 +1,6 @@
+#pragma once
+#define BTREE_PREFIX bptree_float
+#define BTREE_VAL float
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_PREFIX
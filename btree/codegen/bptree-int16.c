@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_int16
+#define BTREE_VAL int16_t
+#include "../bptree.c"
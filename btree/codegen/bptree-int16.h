@@ -0,0 +1,6 @@
+#pragma once
+#define BTREE_PREFIX bptree_int16
+#define BTREE_VAL int16_t
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_PREFIX
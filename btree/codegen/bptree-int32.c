@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_int32
+#define BTREE_VAL int32_t
+#include "../bptree.c"
@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_int64
+#define BTREE_VAL int64_t
+#include "../bptree.c"
@@ -0,0 +1,6 @@
+#pragma once
+#define BTREE_PREFIX bptree_int64
+#define BTREE_VAL int64_t
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_PREFIX
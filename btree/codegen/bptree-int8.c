@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_int8
+#define BTREE_VAL int8_t
+#include "../bptree.c"
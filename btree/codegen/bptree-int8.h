@@ -0,0 +1,6 @@
+#pragma once
+#define BTREE_PREFIX bptree_int8
+#define BTREE_VAL int8_t
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_PREFIX
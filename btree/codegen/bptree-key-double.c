@@ -0,0 +1,4 @@
+#define BTREE_PREFIX bptree_key_double
+#define BTREE_KEY double
+#define BTREE_VAL uintptr_t
+#include "../bptree.c"
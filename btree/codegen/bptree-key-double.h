@@ -0,0 +1,8 @@
+#pragma once
+#define BTREE_PREFIX bptree_key_double
+#define BTREE_KEY double
+#define BTREE_VAL uintptr_t
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_KEY
+#undef BTREE_PREFIX
@@ -0,0 +1,4 @@
+#define BTREE_PREFIX bptree_key_int32
+#define BTREE_KEY int32_t
+#define BTREE_VAL uintptr_t
+#include "../bptree.c"
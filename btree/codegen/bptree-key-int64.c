@@ -0,0 +1,4 @@
+#define BTREE_PREFIX bptree_key_int64
+#define BTREE_KEY int64_t
+#define BTREE_VAL uintptr_t
+#include "../bptree.c"
@@ -0,0 +1,4 @@
+#define BTREE_PREFIX bptree_key_uint128
+#define BTREE_KEY uint128_t
+#define BTREE_VAL uintptr_t
+#include "../bptree.c"
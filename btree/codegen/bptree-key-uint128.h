@@ -0,0 +1,8 @@
+#pragma once
+#define BTREE_PREFIX bptree_key_uint128
+#define BTREE_KEY uint128_t
+#define BTREE_VAL uintptr_t
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_KEY
+#undef BTREE_PREFIX
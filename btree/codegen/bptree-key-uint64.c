@@ -0,0 +1,4 @@
+#define BTREE_PREFIX bptree_key_uint64
+#define BTREE_KEY uint64_t
+#define BTREE_VAL uintptr_t
+#include "../bptree.c"
@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_uint16
+#define BTREE_VAL uint16_t
+#include "../bptree.c"
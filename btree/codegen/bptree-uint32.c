@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_uint32
+#define BTREE_VAL uint32_t
+#include "../bptree.c"
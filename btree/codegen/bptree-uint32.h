@@ -0,0 +1,6 @@
+#pragma once
+#define BTREE_PREFIX bptree_uint32
+#define BTREE_VAL uint32_t
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_PREFIX
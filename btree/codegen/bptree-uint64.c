@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_uint64
+#define BTREE_VAL uint64_t
+#include "../bptree.c"
@@ -0,0 +1,6 @@
+#pragma once
+#define BTREE_PREFIX bptree_uint64
+#define BTREE_VAL uint64_t
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_PREFIX
@@ -0,0 +1,3 @@
+#define BTREE_PREFIX bptree_uint8
+#define BTREE_VAL uint8_t
+#include "../bptree.c"
@@ -0,0 +1,6 @@
+#pragma once
+#define BTREE_PREFIX bptree_uint8
+#define BTREE_VAL uint8_t
+#include "../bptree.h"
+#undef BTREE_VAL
+#undef BTREE_PREFIX
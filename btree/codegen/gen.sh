@@ -0,0 +1,69 @@
+#!/bin/sh
+
+types="
+	int64_t
+	int32_t
+	int16_t
+	int8_t
+	uint64_t
+	uint32_t
+	uint16_t
+	uint8_t
+	float
+	double
+"
+
+# key types, each instantiated with uintptr_t values for row ids or pointers
+keys="
+	uint32_t
+	int32_t
+	uint64_t
+	int64_t
+	double
+	uint128_t
+"
+
+for t in $types; do
+	postfix=$(echo "$t" | sed 's/_t//g')
+
+	echo $postfix
+
+	cat > "bptree-$postfix.c" <<- EOM
+		#define BTREE_PREFIX bptree_$postfix
+		#define BTREE_VAL $t
+		#include "../bptree.c"
+	EOM
+
+	cat > "bptree-$postfix.h" <<- EOM
+		#pragma once
+		#define BTREE_PREFIX bptree_$postfix
+		#define BTREE_VAL $t
+		#include "../bptree.h"
+		#undef BTREE_VAL
+		#undef BTREE_PREFIX
+	EOM
+done
+
+for k in $keys; do
+	postfix=$(echo "$k" | sed 's/_t//g')
+
+	echo "key $postfix"
+
+	cat > "bptree-key-$postfix.c" <<- EOM
+		#define BTREE_PREFIX bptree_key_$postfix
+		#define BTREE_KEY $k
+		#define BTREE_VAL uintptr_t
+		#include "../bptree.c"
+	EOM
+
+	cat > "bptree-key-$postfix.h" <<- EOM
+		#pragma once
+		#define BTREE_PREFIX bptree_key_$postfix
+		#define BTREE_KEY $k
+		#define BTREE_VAL uintptr_t
+		#include "../bptree.h"
+		#undef BTREE_VAL
+		#undef BTREE_KEY
+		#undef BTREE_PREFIX
+	EOM
+done
@@ -0,0 +1,366 @@
+#include "bptree.c"
+
+#define BTREE_VAL int64_t
+#define BTREE_PREFIX bptree_int64
+#include "bptree.c"
+
+#define BTREE_VAL double
+#define BTREE_PREFIX bptree_double
+#include "bptree.c"
+
+#define BTREE_VAL int64_t
+#define BTREE_PREFIX bptree_summed_int64
+#define BTREE_SUM int64_t
+#include "bptree.c"
+
+#define BTREE_VAL uint32_t
+#define BTREE_PREFIX bptree_ranked_uint32
+#define BTREE_AUGMENT
+#include "bptree.c"
+
+/* one tree for each key type, the values count the inserts */
+#define BTREE_KEY uint32_t
+#define BTREE_VAL uint32_t
+#define BTREE_PREFIX bptree_key_uint32
+#include "bptree.c"
+
+#define BTREE_KEY int32_t
+#define BTREE_VAL uint32_t
+#define BTREE_PREFIX bptree_key_int32
+#include "bptree.c"
+
+#define BTREE_KEY int64_t
+#define BTREE_VAL uint32_t
+#define BTREE_PREFIX bptree_key_int64
+#include "bptree.c"
+
+#define BTREE_KEY double
+#define BTREE_VAL uint32_t
+#define BTREE_PREFIX bptree_key_double
+#include "bptree.c"
+
+#define BTREE_KEY uint128_t
+#define BTREE_VAL uint32_t
+#define BTREE_PREFIX bptree_key_uint128
+#include "bptree.c"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static Key random_key(uint64_t n)
+{
+    const Key PRIME = 0x9e3779b97f4a7c15ULL;
+    n = (n ^ (n >> 30)) * PRIME;
+    n = (n ^ (n >> 27)) * PRIME;
+    n = n ^ (n >> 31);
+    return n;
+}
+
+static int cmp_key(const void* a, const void* b)
+{
+    const Key x = *(const Key*)a;
+    const Key y = *(const Key*)b;
+    return (x > y) - (x < y);
+}
+
+static int64_t val_of(Key key)
+{
+    return (int64_t)(key % 1001) - 500;
+}
+
+/* Inserts `n` keys made by `make_key`, which spread over the negative and
+ * positive range of signed types, and checks that the tree orders them by
+ * value like the comparison operators do */
+#define TEST_KEYED(K, name, make_key)                                                     \
+    static int cmp_##name(const void* a, const void* b)                                   \
+    {                                                                                     \
+        const K x = *(const K*)a;                                                         \
+        const K y = *(const K*)b;                                                         \
+        return (x > y) - (x < y);                                                         \
+    }                                                                                     \
+                                                                                          \
+    static bool test_##name(struct arena* a, size_t n)                                    \
+    {                                                                                     \
+        CAT(CAT(BPTree_,K),_uint32_t)* bt = bptree_##name##_new(a);                       \
+        CAT(CAT(BPTree_cursor_,K),_uint32_t) c;                                           \
+        K* keys = malloc(n * sizeof *keys);                                               \
+        for (size_t i = 0; i < n; i++) {                                                  \
+            keys[i] = make_key(i);                                                        \
+            *bptree_##name##_insert(bt, keys[i]) += 1;                                    \
+        }                                                                                 \
+        qsort(keys, n, sizeof *keys, cmp_##name);                                         \
+        size_t m = 0;                                                                     \
+        for (size_t i = 0; i < n; i++) {                                                  \
+            if (m == 0 || keys[m - 1] != keys[i]) {                                       \
+                keys[m++] = keys[i];                                                      \
+            }                                                                             \
+        }                                                                                 \
+                                                                                          \
+        bool ok = bt->count == m;                                                         \
+        bool more = bptree_##name##_first(bt, &c);                                        \
+        for (size_t i = 0; ok && i < m; i++) {                                            \
+            ok = more && bptree_##name##_cursor_key(&c) == keys[i];                       \
+            more = bptree_##name##_next(&c);                                              \
+        }                                                                                 \
+        ok = ok && !more;                                                                 \
+        for (size_t i = 0; ok && i < m; i += 7) {                                         \
+            ok = bptree_##name##_lower_bound(bt, keys[i], &c)                             \
+              && bptree_##name##_cursor_key(&c) == keys[i]                                \
+              && (i + 1 == m || (bptree_##name##_next(&c)                                 \
+                                 && bptree_##name##_cursor_key(&c) == keys[i + 1]));      \
+        }                                                                                 \
+        for (size_t i = 0; ok && i < m; i += 2) {                                         \
+            ok = bptree_##name##_remove(bt, keys[i]);                                     \
+        }                                                                                 \
+        for (size_t i = 0; ok && i < m; i++) {                                            \
+            ok = bptree_##name##_contains(bt, keys[i]) == (i % 2 == 1);                   \
+        }                                                                                 \
+        free(keys);                                                                       \
+        arena_reset(a);                                                                   \
+        return ok;                                                                        \
+    }
+
+#define KEY_UINT32(i)  ((uint32_t)random_key(i))
+#define KEY_INT32(i)   ((int32_t)random_key(i))
+#define KEY_INT64(i)   ((int64_t)random_key(i))
+#define KEY_DOUBLE(i)  ((double)(int64_t)random_key(i) / 1e6)
+#define KEY_UINT128(i) (((uint128_t)random_key(i) << 64) | random_key(~(uint64_t)(i)))
+
+TEST_KEYED(uint32_t,  key_uint32,  KEY_UINT32)
+TEST_KEYED(int32_t,   key_int32,   KEY_INT32)
+TEST_KEYED(int64_t,   key_int64,   KEY_INT64)
+TEST_KEYED(double,    key_double,  KEY_DOUBLE)
+TEST_KEYED(uint128_t, key_uint128, KEY_UINT128)
+
+int main()
+{
+    int status = EXIT_SUCCESS;
+    const size_t n = 100 * 1000;
+
+    struct arena a = arena_new();
+    {
+        BPTree* bt = bptree_new(&a);
+
+        { /* test insert and get */
+            char val[] = "value";
+            *bptree_insert(bt, 42) = val;
+            bool ok = bptree_get(bt, 42, NULL) == val && bptree_get(bt, 43, NULL) == NULL;
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree) insert and get - %s\n", ok ? "OK" : "FAILED");
+        }
+        arena_reset(&a);
+    }
+
+    {
+        BPTree_int64_t* bt = bptree_int64_new(&a);
+        Key* keys = malloc(n * sizeof *keys);
+
+        { /* test insert and get */
+            for (size_t i = 0; i < n; i++) {
+                keys[i] = random_key(i + 1) & ~(Key)1;
+                *bptree_int64_insert(bt, keys[i]) = (int64_t)i;
+            }
+            bool ok = bt->count == n;
+            for (size_t i = 0; i < n; i++) {
+                ok = ok && bptree_int64_get(bt, keys[i], -1) == (int64_t)i
+                        && !bptree_int64_contains(bt, keys[i] | 1);
+            }
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_int64) insert and get - %s\n", ok ? "OK" : "FAILED");
+        }
+
+        { /* test insert of existing key returns the old value */
+            int64_t* v = bptree_int64_insert(bt, keys[7]);
+            bool ok = *v == 7 && bt->count == n;
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_int64) insert existing key - %s\n", ok ? "OK" : "FAILED");
+        }
+
+        qsort(keys, n, sizeof *keys, cmp_key);
+
+        { /* test scans over the leaf chain */
+            BPTree_cursor_int64_t c;
+            bool more = bptree_int64_first(bt, &c);
+            size_t i = 0;
+            while (more && i < n && bptree_int64_cursor_key(&c) == keys[i]
+                   && bptree_int64_get(bt, keys[i], -1) == *bptree_int64_cursor_val(&c)) {
+                i++;
+                more = bptree_int64_next(&c);
+            }
+            bool ok = i == n && !more;
+
+            more = bptree_int64_last(bt, &c);
+            while (more && i > 0 && bptree_int64_cursor_key(&c) == keys[i - 1]) {
+                i--;
+                more = bptree_int64_prev(&c);
+            }
+            ok = ok && i == 0 && !more;
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_int64) forward and backward scan - %s\n", ok ? "OK" : "FAILED");
+        }
+
+        { /* test lower_bound */
+            BPTree_cursor_int64_t c;
+            bool ok = true;
+            for (size_t i = 0; i < n; i += 7) {
+                ok = ok && bptree_int64_lower_bound(bt, keys[i], &c) && bptree_int64_cursor_key(&c) == keys[i];
+                ok = ok && bptree_int64_lower_bound(bt, keys[i] - 1, &c) && bptree_int64_cursor_key(&c) == keys[i];
+            }
+            ok = ok && !bptree_int64_lower_bound(bt, keys[n - 1] + 1, &c);
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_int64) lower_bound - %s\n", ok ? "OK" : "FAILED");
+        }
+
+        { /* test remove, down to an empty tree */
+            bool ok = true;
+            for (size_t i = 0; i < n; i += 2) {
+                ok = ok && bptree_int64_remove(bt, keys[i]) && !bptree_int64_remove(bt, keys[i]);
+            }
+            BPTree_cursor_int64_t c;
+            bool more = bptree_int64_first(bt, &c);
+            for (size_t i = 1; i < n; i += 2) {
+                ok = ok && more && bptree_int64_cursor_key(&c) == keys[i] && !bptree_int64_contains(bt, keys[i - 1]);
+                more = bptree_int64_next(&c);
+            }
+            ok = ok && !more && bt->count == n / 2;
+            for (size_t i = n; i > 0; i--) {
+                ok = ok && bptree_int64_remove(bt, keys[i - 1]) == (i - 1) % 2;
+            }
+            ok = ok && bt->count == 0 && bt->depth == 0 && !bptree_int64_first(bt, &c)
+                    && !bptree_int64_last(bt, &c) && !bptree_int64_lower_bound(bt, 0, &c);
+            ok = ok && bptree_int64_put(bt, keys[0], 1) && bptree_int64_get(bt, keys[0], 0) == 1;
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_int64) remove - %s\n", ok ? "OK" : "FAILED");
+        }
+
+        free(keys);
+        arena_reset(&a);
+    }
+
+    {
+        BPTree_double* bt = bptree_double_new(&a);
+        BPTree_cursor_double c;
+
+        { /* test empty tree */
+            bool ok = !bptree_double_first(bt, &c) && !bptree_double_last(bt, &c)
+                   && !bptree_double_lower_bound(bt, 0, &c) && isnan(bptree_double_get(bt, 1, NAN));
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_double) empty tree - %s\n", ok ? "OK" : "FAILED");
+        }
+
+        { /* test sequential insert and get */
+            for (size_t i = 0; i < n; i++) {
+                *bptree_double_insert(bt, i) = (double)i / 2;
+            }
+            bool ok = true;
+            for (size_t i = 0; i < n; i++) {
+                ok = ok && bptree_double_get(bt, i, NAN) == (double)i / 2;
+            }
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_double) sequential insert and get - %s\n", ok ? "OK" : "FAILED");
+        }
+        arena_reset(&a);
+    }
+
+    {
+        BPTree_summed_int64_t* bt = bptree_summed_int64_new(&a);
+        Key* keys = malloc(n * sizeof *keys);
+
+        /* a third of the keys are removed again, so nodes split and merge */
+        for (size_t i = 0; i < n; i++) {
+            keys[i] = random_key(i + 1) & ~(Key)1;
+            bptree_summed_int64_put(bt, keys[i], val_of(keys[i]) + 1);
+            bptree_summed_int64_put(bt, keys[i], val_of(keys[i]));
+        }
+        size_t m = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (i % 3 == 0) {
+                bptree_summed_int64_remove(bt, keys[i]);
+            } else {
+                keys[m++] = keys[i];
+            }
+        }
+        qsort(keys, m, sizeof *keys, cmp_key);
+        int64_t* prefix = malloc((m + 1) * sizeof *prefix);
+        prefix[0] = 0;
+        for (size_t i = 0; i < m; i++) {
+            prefix[i + 1] = prefix[i] + val_of(keys[i]);
+        }
+
+        { /* test rank and select */
+            bool ok = bt->count == m;
+            BPTree_cursor_summed_int64_t c;
+            for (size_t i = 0; ok && i < m; i++) {
+                ok = bptree_summed_int64_rank(bt, keys[i]) == i
+                  && bptree_summed_int64_rank(bt, keys[i] + 1) == i + 1
+                  && bptree_summed_int64_select(bt, i, &c) && bptree_summed_int64_cursor_key(&c) == keys[i];
+            }
+            ok = ok && !bptree_summed_int64_select(bt, m, &c) && bptree_summed_int64_rank(bt, UINT64_MAX) == m;
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_summed_int64) rank and select - %s\n", ok ? "OK" : "FAILED");
+        }
+
+        { /* test range count and sum */
+            bool ok = bptree_summed_int64_count_range(bt, 0, UINT64_MAX) == m
+                   && bptree_summed_int64_sum_range(bt, 0, UINT64_MAX) == prefix[m];
+            for (size_t i = 0; ok && i < 1000; i++) {
+                const size_t lo = random_key(2 * i) % m;
+                const size_t hi = random_key(2 * i + 1) % m;
+                ok = bptree_summed_int64_count_range(bt, keys[lo], keys[hi]) == (lo < hi ? hi - lo : 0)
+                  && bptree_summed_int64_sum_range(bt, keys[lo], keys[hi]) == (lo < hi ? prefix[hi] - prefix[lo] : 0)
+                  && bptree_summed_int64_count_range(bt, keys[lo] + 1, keys[hi] + 1) == (lo < hi ? hi - lo : 0);
+            }
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_summed_int64) range count and sum - %s\n", ok ? "OK" : "FAILED");
+        }
+
+        free(prefix);
+        free(keys);
+        arena_reset(&a);
+    }
+
+    {
+        BPTree_ranked_uint32_t* bt = bptree_ranked_uint32_new(&a);
+
+        { /* test ranks after ordered inserts and removes */
+            for (size_t i = 0; i < n; i++) {
+                *bptree_ranked_uint32_insert(bt, i) = i;
+            }
+            for (size_t i = n; i > n / 2; i--) {
+                bptree_ranked_uint32_remove(bt, i - 1);
+            }
+            for (size_t i = 0; i < n / 2; i += 2) {
+                bptree_ranked_uint32_remove(bt, i);
+            }
+            /* the odd keys below n/2 are left */
+            bool ok = bt->count == n / 4;
+            BPTree_cursor_ranked_uint32_t c;
+            for (size_t i = 1; ok && i < n / 2; i += 2) {
+                ok = bptree_ranked_uint32_rank(bt, i) == i / 2
+                  && bptree_ranked_uint32_select(bt, i / 2, &c) && *bptree_ranked_uint32_cursor_val(&c) == i;
+            }
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_ranked_uint32) rank after ordered removes - %s\n", ok ? "OK" : "FAILED");
+        }
+        arena_reset(&a);
+    }
+
+    { /* test ordering of every key type with every search kernel */
+        const size_t selected = BTree_search_kernel_selected();
+        for (size_t i = 0; i < BTree_search_kernel_count(); i++) {
+            if (!BTree_search_kernel_select(i)) {
+                continue;
+            }
+            bool ok = test_key_uint32(&a, n) && test_key_int32(&a, n) && test_key_int64(&a, n)
+                   && test_key_double(&a, n) && test_key_uint128(&a, n);
+            status = ok ? status : EXIT_FAILURE;
+            printf("(bptree_key) %s kernel orders uint32, int32, int64, double and uint128 keys - %s\n",
+                   BTree_search_kernel_name(i), ok ? "OK" : "FAILED");
+        }
+        BTree_search_kernel_select(selected);
+    }
+
+    arena_delete(&a);
+    return status;
+}
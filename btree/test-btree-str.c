@@ -0,0 +1,209 @@
+#include "btree-str.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int status = EXIT_SUCCESS;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        status = EXIT_FAILURE;
+    }
+    printf("(btree-str) %s - %s\n", what, ok ? "OK" : "FAILED");
+}
+
+static uint64_t random_key(uint64_t n)
+{
+    const uint64_t PRIME = 0x9e3779b97f4a7c15ULL;
+    n = (n ^ (n >> 30)) * PRIME;
+    n = (n ^ (n >> 27)) * PRIME;
+    n = n ^ (n >> 31);
+    return n;
+}
+
+struct key {
+    char*  data;
+    size_t len;
+};
+
+static int cmp_key(const void* a, const void* b)
+{
+    const struct key* x = a;
+    const struct key* y = b;
+    const int c = memcmp(x->data, y->data, x->len < y->len ? x->len : y->len);
+    return c != 0 ? c : (x->len > y->len) - (x->len < y->len);
+}
+
+/* Paths that share long prefixes and differ deep in the key, the case
+ * the head and prefix truncation are for */
+static struct key* make_paths(size_t n)
+{
+    struct key* keys = malloc(n * sizeof *keys);
+    for (size_t i = 0; i < n; i++) {
+        const uint64_t r = random_key(i + 1);
+        char buf[128];
+        const int len = snprintf(buf, sizeof buf, "/usr/share/doc/package-%u/examples/%u/file-%"PRIu64".txt",
+                                 (unsigned)(r % 64), (unsigned)(r >> 8) % 16, r >> 16);
+        keys[i] = (struct key) { .data = malloc(len), .len = len };
+        memcpy(keys[i].data, buf, len);
+    }
+    return keys;
+}
+
+static void free_keys(struct key* keys, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        free(keys[i].data);
+    }
+    free(keys);
+}
+
+static bool scan_matches(const BTree_str* btree, const struct key* sorted, size_t n)
+{
+    BTree_str_cursor c;
+    bool more = BTree_str_first(btree, &c);
+    for (size_t i = 0; i < n; i++) {
+        size_t len;
+        const char* key = more ? BTree_str_cursor_key(&c, &len) : NULL;
+        if (!key || len != sorted[i].len || memcmp(key, sorted[i].data, len) != 0) {
+            return false;
+        }
+        more = BTree_str_next(&c);
+    }
+    return !more;
+}
+
+static void test_empty(void)
+{
+    struct arena a = arena_new();
+    BTree_str* btree = BTree_str_new(&a);
+    BTree_str_cursor c;
+    check(!BTree_str_find(btree, "", 0) && !BTree_str_first(btree, &c)
+          && !BTree_str_lower_bound(btree, "a", 1, &c), "empty tree");
+    arena_delete(&a);
+}
+
+static void test_paths(size_t n)
+{
+    struct arena a = arena_new();
+    BTree_str* btree = BTree_str_new(&a);
+    struct key* keys = make_paths(n);
+
+    size_t inserted = 0;
+    for (size_t i = 0; i < n; i++) {
+        inserted += BTree_str_insert(btree, keys[i].data, keys[i].len);
+    }
+    qsort(keys, n, sizeof *keys, cmp_key);
+    size_t unique = n > 0;
+    for (size_t i = 1; i < n; i++) {
+        if (cmp_key(&keys[i - 1], &keys[i]) != 0) {
+            keys[unique++] = keys[i];
+        } else {
+            free(keys[i].data);
+        }
+    }
+
+    char what[128];
+    snprintf(what, sizeof what, "insert %zu paths", n);
+    check(inserted == unique && btree->count == unique, what);
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < unique; i++) {
+        ok = BTree_str_find(btree, keys[i].data, keys[i].len)
+          && !BTree_str_insert(btree, keys[i].data, keys[i].len)
+          && !BTree_str_find(btree, keys[i].data, keys[i].len - 1);
+    }
+    check(ok, "find paths");
+    check(scan_matches(btree, keys, unique), "scan paths in order");
+
+    ok = true;
+    BTree_str_cursor c;
+    for (size_t i = 0; ok && i < unique; i++) {
+        /* a proper prefix of a key sorts before it and after its predecessor */
+        size_t len;
+        const char* key;
+        ok = BTree_str_lower_bound(btree, keys[i].data, keys[i].len - 1, &c)
+          && (key = BTree_str_cursor_key(&c, &len), len == keys[i].len)
+          && memcmp(key, keys[i].data, len) == 0;
+    }
+    ok = ok && (unique == 0 || !BTree_str_lower_bound(btree, "\xff", 1, &c));
+    check(ok, "lower_bound paths");
+
+    free_keys(keys, unique);
+    arena_delete(&a);
+}
+
+/* Keys that are prefixes of each other, contain NUL bytes, or tie on the
+ * head, and one larger than a page of slots */
+static void test_edge_keys(void)
+{
+    struct arena a = arena_new();
+    BTree_str* btree = BTree_str_new(&a);
+
+    static char big[100 * 1000];
+    memset(big, 'x', sizeof big);
+
+    struct key keys[] = {
+        { "",            0 },
+        { "\0",          1 },
+        { "\0\0\0\0\0",  5 },
+        { "a",           1 },
+        { "a\0",         2 },
+        { "ab",          2 },
+        { "abcd",        4 },
+        { "abcd\0",      5 },
+        { "abcde",       5 },
+        { "abcdf",       5 },
+        { "\xff\xff",    2 },
+        { big,           sizeof big },
+    };
+    const size_t n = sizeof keys / sizeof *keys;
+
+    /* enough filler around them to split nodes several levels up */
+    bool ok = true;
+    for (size_t i = 0; i < 10 * 1000; i++) {
+        char buf[32];
+        const int len = snprintf(buf, sizeof buf, "abc%08zu", i);
+        ok = ok && BTree_str_insert(btree, buf, len);
+    }
+    for (size_t i = 0; i < n; i++) {
+        ok = ok && BTree_str_insert(btree, keys[i].data, keys[i].len);
+    }
+    for (size_t i = 0; i < n; i++) {
+        ok = ok && BTree_str_find(btree, keys[i].data, keys[i].len)
+                && !BTree_str_insert(btree, keys[i].data, keys[i].len);
+    }
+    ok = ok && !BTree_str_find(btree, "abc", 3) && !BTree_str_find(btree, big, sizeof big - 1);
+    check(ok, "edge case keys");
+
+    /* everything in order, with the filler between "ab" and "abcd" */
+    BTree_str_cursor c;
+    bool more = BTree_str_first(btree, &c);
+    size_t prev_len = 0;
+    const char* prev = NULL;
+    size_t count = 0;
+    while (ok && more) {
+        size_t len;
+        const char* key = BTree_str_cursor_key(&c, &len);
+        ok = !prev || cmp_key(&(struct key) { (char*)prev, prev_len }, &(struct key) { (char*)key, len }) < 0;
+        prev = key;
+        prev_len = len;
+        count++;
+        more = BTree_str_next(&c);
+    }
+    check(ok && count == btree->count && count == n + 10 * 1000, "edge case keys in order");
+
+    arena_delete(&a);
+}
+
+int main()
+{
+    test_empty();
+    test_edge_keys();
+    test_paths(1);
+    test_paths(100);
+    test_paths(100 * 1000);
+    return status;
+}
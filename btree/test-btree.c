@@ -0,0 +1,1121 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "btree.h"
+#include "btree-be.h"
+#include "btree-file.h"
+#include "btree-packed.h"
+#include "btree-static.h"
+#include "btree-wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int status = EXIT_SUCCESS;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        status = EXIT_FAILURE;
+    }
+    printf("(btree) %s - %s\n", what, ok ? "OK" : "FAILED");
+}
+
+static Key random_key(uint64_t n)
+{
+    const Key PRIME = 0x9e3779b97f4a7c15ULL;
+    n = (n ^ (n >> 30)) * PRIME;
+    n = (n ^ (n >> 27)) * PRIME;
+    n = n ^ (n >> 31);
+    return n;
+}
+
+static int cmp_key(const void* a, const void* b)
+{
+    const Key x = *(const Key*)a;
+    const Key y = *(const Key*)b;
+    return (x > y) - (x < y);
+}
+
+/* Inserts `n` keys and returns them sorted. Keys are even so that odd keys
+ * are known to be absent. */
+static Key* fill(BTree* btree, size_t n)
+{
+    Key* keys = malloc(n * sizeof *keys);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = random_key(i + 1) & ~(Key)1;
+        BTree_insert(btree, keys[i]);
+    }
+    qsort(keys, n, sizeof *keys, cmp_key);
+    return keys;
+}
+
+/* Checks ordering, that every leaf is at the same depth and that no node
+ * but the root is empty or over its capacity. Returns the number of keys in
+ * the subtree. */
+static size_t check_node(const BTree_node* node, size_t depth, size_t leaf_depth,
+                         const Key* lo, const Key* hi, bool* ok)
+{
+    size_t count = node->degree;
+    *ok = *ok && count <= (node->is_leaf ? MAX_LEAF_KEY : MAX_KEY);
+    for (size_t i = 0; i < node->degree; i++) {
+        if ((lo && node->keys[i] <= *lo) || (hi && node->keys[i] >= *hi)
+         || (i > 0 && node->keys[i] <= node->keys[i-1])) {
+            *ok = false;
+        }
+    }
+    if (node->is_leaf) {
+        *ok = *ok && depth == leaf_depth;
+        return count;
+    }
+    *ok = *ok && node->degree > 0;
+    for (size_t i = 0; i <= node->degree; i++) {
+        const BTree_node* child = node->children[i];
+        *ok = *ok && child->degree > 0;
+        count += check_node(child, depth + 1, leaf_depth,
+                            i > 0 ? &node->keys[i-1] : lo,
+                            i < node->degree ? &node->keys[i] : hi, ok);
+    }
+    return count;
+}
+
+static bool check_tree(const BTree* btree, size_t expected_keys)
+{
+    bool ok = true;
+    return check_node(btree->root, 0, btree->depth, NULL, NULL, &ok) == expected_keys && ok;
+}
+
+/* Keys the nodes of the subtree have room for */
+static size_t node_capacity(const BTree_node* node)
+{
+    if (node->is_leaf) {
+        return MAX_LEAF_KEY;
+    }
+    size_t capacity = MAX_KEY;
+    for (size_t i = 0; i <= node->degree; i++) {
+        capacity += node_capacity(node->children[i]);
+    }
+    return capacity;
+}
+
+static void test_empty(void)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    BTree_cursor c;
+
+    check(!BTree_find(btree, 0), "find in empty tree");
+    check(!BTree_first(btree, &c) && !BTree_cursor_valid(&c), "first in empty tree");
+    check(!BTree_last(btree, &c) && !BTree_cursor_valid(&c), "last in empty tree");
+    check(!BTree_lower_bound(btree, 0, &c), "lower_bound in empty tree");
+
+    arena_delete(&a);
+}
+
+static void test_find(size_t n)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    Key* keys = fill(btree, n);
+
+    bool present = true;
+    bool absent  = true;
+    for (size_t i = 0; i < n; i++) {
+        present = present && BTree_find(btree, keys[i]);
+        absent  = absent && !BTree_find(btree, keys[i] | 1);
+    }
+    check(present, "find inserted keys");
+    check(check_tree(btree, n), "tree is valid after inserts");
+    check(absent, "don't find absent keys");
+    check(!BTree_insert(btree, keys[n / 2]), "reject duplicate insert");
+
+    /* every other lookup is a miss */
+    Key*  lookups = malloc(2 * n * sizeof *lookups);
+    bool* hits    = malloc(2 * n * sizeof *hits);
+    for (size_t i = 0; i < n; i++) {
+        lookups[2 * i]     = keys[i];
+        lookups[2 * i + 1] = keys[i] | 1;
+    }
+    bool ok = BTree_find_batch(btree, lookups, 2 * n, hits) == n;
+    for (size_t i = 0; ok && i < 2 * n; i++) {
+        ok = hits[i] == (i % 2 == 0);
+    }
+    check(ok, "batched find");
+    free(lookups);
+    free(hits);
+
+    free(keys);
+    arena_delete(&a);
+}
+
+static void test_cursor(size_t n)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    Key* keys = fill(btree, n);
+    BTree_cursor c;
+
+    bool ok = BTree_first(btree, &c);
+    size_t i = 0;
+    while (ok && i < n && BTree_cursor_key(&c) == keys[i]) {
+        i++;
+        ok = BTree_next(&c);
+    }
+    check(i == n && !ok && !BTree_cursor_valid(&c), "forward scan visits all keys in order");
+
+    ok = BTree_last(btree, &c);
+    i = n;
+    while (ok && i > 0 && BTree_cursor_key(&c) == keys[i - 1]) {
+        i--;
+        ok = BTree_prev(&c);
+    }
+    check(i == 0 && !ok && !BTree_cursor_valid(&c), "backward scan visits all keys in order");
+
+    ok = true;
+    for (size_t j = 0; j < n; j += 7) {
+        /* exact hit, then a probe just below the key */
+        ok = ok && BTree_lower_bound(btree, keys[j], &c) && BTree_cursor_key(&c) == keys[j];
+        ok = ok && BTree_lower_bound(btree, keys[j] - 1, &c) && BTree_cursor_key(&c) == keys[j];
+    }
+    ok = ok && !BTree_lower_bound(btree, keys[n - 1] + 1, &c);
+    ok = ok && BTree_lower_bound(btree, 0, &c) && BTree_cursor_key(&c) == keys[0];
+    check(ok, "lower_bound finds first key >= probe");
+
+    ok = true;
+    for (size_t j = 1; j + 1 < n; j += 13) {
+        BTree_lower_bound(btree, keys[j], &c);
+        ok = ok && BTree_next(&c) && BTree_cursor_key(&c) == keys[j + 1];
+        ok = ok && BTree_prev(&c) && BTree_cursor_key(&c) == keys[j];
+        ok = ok && BTree_prev(&c) && BTree_cursor_key(&c) == keys[j - 1];
+        ok = ok && BTree_next(&c) && BTree_cursor_key(&c) == keys[j];
+    }
+    check(ok, "mixed next and prev");
+
+    free(keys);
+    arena_delete(&a);
+}
+
+static void test_remove(size_t n)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    Key* keys = fill(btree, n);
+
+    bool ok = true;
+    for (size_t i = 0; i < n; i += 2) {
+        ok = ok && BTree_remove(btree, keys[i]);
+    }
+    check(ok, "remove present keys");
+    check(!BTree_remove(btree, keys[0]) && !BTree_remove(btree, keys[n - 1] | 1), "don't remove absent keys");
+    check(check_tree(btree, n / 2), "tree is valid after removing half the keys");
+
+    ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok = ok && BTree_find(btree, keys[i]) == (i % 2 == 1);
+    }
+    check(ok, "find after remove");
+
+    BTree_cursor c;
+    ok = BTree_first(btree, &c);
+    size_t i = 1;
+    while (ok && i < n && BTree_cursor_key(&c) == keys[i]) {
+        i += 2;
+        ok = BTree_next(&c);
+    }
+    check(i >= n && !ok, "forward scan after remove");
+
+    ok = true;
+    for (size_t i = 1; i < n; i += 2) {
+        ok = ok && BTree_remove(btree, keys[i]);
+    }
+    check(ok && check_tree(btree, 0) && btree->root->is_leaf && btree->depth == 0
+          && btree->node_count == 1, "remove every key");
+
+    free(keys);
+    arena_delete(&a);
+}
+
+/* With a constant number of live keys the arena should stop growing once
+ * the free list has warmed up */
+static void test_churn(size_t live)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+
+    for (uint64_t n = 0; n < live; n++) {
+        BTree_insert(btree, random_key(n));
+    }
+
+    size_t warm = 0;
+    for (uint64_t round = 0; round < 8; round++) {
+        for (uint64_t n = (round + 1) * live; n < (round + 2) * live; n++) {
+            BTree_insert(btree, random_key(n));
+            BTree_remove(btree, random_key(n - live));
+        }
+        if (round == 1) {
+            warm = a.size;
+        }
+    }
+    check(check_tree(btree, live), "tree is valid after churn");
+    check(a.size <= warm + warm / 16, "arena is stable under churn");
+
+    arena_delete(&a);
+}
+
+/* Inserts and removes of keys from a small range, so most of them hit
+ * present keys, against a bitmap */
+static void test_repeated_keys(size_t range)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    bool* present = calloc(range, sizeof *present);
+    size_t live = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < 8 * range; i++) {
+        const Key k = random_key(i) % range;
+        if (i % 3 == 2) {
+            ok = BTree_remove(btree, k) == present[k];
+            live -= present[k];
+            present[k] = false;
+        } else {
+            ok = BTree_insert(btree, k) == !present[k];
+            live += !present[k];
+            present[k] = true;
+        }
+    }
+    check(ok && check_tree(btree, live), "insert and remove keys that are already present or absent");
+    free(present);
+    arena_delete(&a);
+}
+
+/* Fingered inserts and lookups of a key stream that mostly moves in small
+ * steps, against a bitmap, with jumps and removes in between that the
+ * finger has to notice */
+static void test_finger(size_t n, bool snapshots)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    if (snapshots) {
+        BTree_enable_snapshots(btree);
+    }
+    const size_t range = 4 * n + 8;
+    bool* present = calloc(range, sizeof *present);
+    BTree_finger finger = {0};
+    size_t live = 0;
+    size_t pos  = range / 2;
+    bool ok = true;
+    for (size_t i = 0; ok && i < 4 * n; i++) {
+        pos = i % 512 == 511 ? random_key(i) % range : (pos + range + random_key(i) % 8 - 3) % range;
+        if (i % 50 == 49) {
+            ok = BTree_remove(btree, pos) == present[pos];
+            live -= present[pos];
+            present[pos] = false;
+        } else if (i % 7 == 6) {
+            ok = BTree_find_finger(btree, pos, &finger) == present[pos];
+        } else {
+            ok = BTree_insert_finger(btree, pos, &finger) == !present[pos];
+            live += !present[pos];
+            present[pos] = true;
+        }
+        if (snapshots && i % 100 == 0) {
+            BTree_publish(btree);
+        }
+    }
+    check(ok && check_tree(btree, live), snapshots ? "fingered inserts with snapshots" : "fingered inserts");
+
+    for (size_t k = 0; ok && k < range; k++) {
+        ok = BTree_find_finger(btree, k, &finger) == present[k];
+    }
+    check(ok, "fingered lookups in order");
+
+    if (snapshots) {
+        BTree_disable_snapshots(btree);
+    }
+    free(present);
+    arena_delete(&a);
+}
+
+static void test_bulk_load(size_t n, double fill_factor, size_t threads)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    Key* keys = malloc((n + 1) * sizeof *keys);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = 2 * i + 2;
+    }
+
+    char what[128];
+    snprintf(what, sizeof what, "bulk load %zu keys at fill %.2lf on %zu threads", n, fill_factor, threads);
+    bool ok = BTree_bulk_load_parallel(btree, keys, n, fill_factor, threads) && check_tree(btree, n);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_find(btree, keys[i]) && !BTree_find(btree, keys[i] + 1);
+    }
+    BTree_cursor c;
+    bool more = BTree_first(btree, &c);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = more && BTree_cursor_key(&c) == keys[i];
+        more = BTree_next(&c);
+    }
+    check(ok && !more, what);
+
+    /* the loaded tree must keep working as a normal tree */
+    ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok = ok && BTree_insert(btree, keys[i] + 1);
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        ok = ok && BTree_remove(btree, keys[i]);
+    }
+    check(ok && check_tree(btree, n + n / 2), "insert and remove after bulk load");
+
+    check(!BTree_bulk_load(btree, keys, n, fill_factor) || n == 0, "reject bulk load into non-empty tree");
+
+    free(keys);
+    arena_delete(&a);
+}
+
+static void test_bulk_load_unsorted(void)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    const Key unsorted[]   = { 1, 3, 2 };
+    const Key duplicates[] = { 1, 2, 2, 3 };
+    check(!BTree_bulk_load(btree, unsorted, 3, 1.0)
+          && !BTree_bulk_load(btree, duplicates, 4, 1.0)
+          && check_tree(btree, 0), "reject unsorted bulk load");
+    arena_delete(&a);
+}
+
+/* The parallel build must lay out the same tree as the sequential one, and
+ * catch keys out of order where the threads' slices meet */
+static void test_bulk_load_parallel(size_t n, size_t threads)
+{
+    Key* keys = malloc(n * sizeof *keys);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = 2 * i + 2;
+    }
+    struct arena a = arena_new();
+    BTree* sequential = BTree_new(&a);
+    BTree* parallel   = BTree_new(&a);
+    bool ok = BTree_bulk_load(sequential, keys, n, 0.8)
+           && BTree_bulk_load_parallel(parallel, keys, n, 0.8, threads)
+           && sequential->depth == parallel->depth
+           && sequential->node_count == parallel->node_count;
+    BTree_cursor c, d;
+    bool more = BTree_first(sequential, &c);
+    for (bool more_d = BTree_first(parallel, &d); ok && (more || more_d); more_d = BTree_next(&d)) {
+        ok = more == more_d && BTree_cursor_key(&c) == BTree_cursor_key(&d);
+        more = BTree_next(&c);
+    }
+    check(ok, "parallel bulk load builds the same tree");
+
+    ok = true;
+    for (size_t t = 1; t < threads; t++) {
+        const size_t boundary = t * (n / threads) + (t < n % threads ? t : n % threads);
+        const Key saved = keys[boundary];
+        keys[boundary] = keys[boundary - 1];
+        BTree* btree = BTree_new(&a);
+        ok = ok && !BTree_bulk_load_parallel(btree, keys, n, 0.8, threads) && check_tree(btree, 0);
+        keys[boundary] = saved;
+    }
+    check(ok, "parallel bulk load rejects unsorted keys between slices");
+
+    free(keys);
+    arena_delete(&a);
+}
+
+/* True if a scan of `btree` sees exactly `keys` */
+static bool scan_equals(const BTree* btree, const Key* keys, size_t n)
+{
+    BTree_cursor c;
+    size_t i = 0;
+    for (bool more = BTree_first(btree, &c); more; more = BTree_next(&c)) {
+        if (i == n || BTree_cursor_key(&c) != keys[i++]) {
+            return false;
+        }
+    }
+    return i == n;
+}
+
+/* Sets of `n` and `m` keys from every `stride_a`-th and `stride_b`-th key,
+ * starting at `offset` for the second, against the same merge on arrays */
+static void test_set_ops(size_t n, size_t stride_a, size_t m, size_t stride_b, Key offset)
+{
+    struct arena a = arena_new();
+    BTree* x = BTree_new(&a);
+    BTree* y = BTree_new(&a);
+    Key* xs = malloc((n + 1) * sizeof *xs);
+    Key* ys = malloc((m + 1) * sizeof *ys);
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = i * stride_a;
+        BTree_insert(x, xs[n - 1 - i] = (n - 1 - i) * stride_a);
+    }
+    for (size_t i = 0; i < m; i++) {
+        ys[i] = offset + i * stride_b;
+        BTree_insert(y, ys[i]);
+    }
+
+    Key* expected[3];
+    size_t counts[3] = { 0 };
+    for (size_t k = 0; k < 3; k++) {
+        expected[k] = malloc((n + m + 1) * sizeof **expected);
+    }
+    size_t i = 0, j = 0;
+    while (i < n || j < m) {
+        if (j == m || (i < n && xs[i] < ys[j])) {
+            expected[0][counts[0]++] = xs[i];
+            expected[2][counts[2]++] = xs[i++];
+        } else if (i == n || ys[j] < xs[i]) {
+            expected[0][counts[0]++] = ys[j++];
+        } else {
+            expected[0][counts[0]++] = xs[i];
+            expected[1][counts[1]++] = xs[i];
+            i++, j++;
+        }
+    }
+
+    bool (*const ops[3])(BTree*, const BTree*, const BTree*, double) = {
+        BTree_union, BTree_intersect, BTree_difference,
+    };
+    const char* names[3] = { "union", "intersection", "difference" };
+    for (size_t k = 0; k < 3; k++) {
+        BTree* out = BTree_new(&a);
+        bool ok = ops[k](out, x, y, 1.0) && check_tree(out, counts[k]) && scan_equals(out, expected[k], counts[k]);
+        ok = ok && (counts[k] == 0 || !ops[k](out, x, y, 1.0));
+        char what[128];
+        snprintf(what, sizeof what, "%s of %zu and %zu keys with strides %zu and %zu",
+                 names[k], n, m, stride_a, stride_b);
+        check(ok, what);
+        free(expected[k]);
+    }
+
+    free(xs);
+    free(ys);
+    arena_delete(&a);
+}
+
+struct concurrent_job {
+    BTree*   btree;
+    size_t   thread;
+    size_t   threads;
+    size_t   n;
+    bool     ok;
+};
+
+/* Every thread inserts its own slice of the keys and immediately looks up
+ * both the key it inserted and one from another thread's slice */
+static void* concurrent_worker(void* arg)
+{
+    struct concurrent_job* job = arg;
+    job->ok = true;
+    for (size_t i = job->thread; i < job->n; i += job->threads) {
+        const Key k = random_key(i + 1) | 1;
+        job->ok = job->ok && BTree_insert_concurrent(job->btree, k);
+        job->ok = job->ok && BTree_find_concurrent(job->btree, k);
+        job->ok = job->ok && !BTree_find_concurrent(job->btree, k & ~(Key)1);
+        BTree_find_concurrent(job->btree, random_key(i + 2) | 1);
+    }
+    return NULL;
+}
+
+static void test_concurrent(size_t n, size_t threads)
+{
+    struct arena a = arena_new();
+    a.flags |= ARENA_SHARED;
+    BTree* btree = BTree_new(&a);
+
+    pthread_t             tids[threads];
+    struct concurrent_job jobs[threads];
+    for (size_t t = 0; t < threads; t++) {
+        jobs[t] = (struct concurrent_job) { .btree = btree, .thread = t, .threads = threads, .n = n };
+        pthread_create(&tids[t], NULL, concurrent_worker, &jobs[t]);
+    }
+    bool ok = true;
+    for (size_t t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        ok = ok && jobs[t].ok;
+    }
+    check(ok, "concurrent insert and find");
+
+    ok = check_tree(btree, n);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_find(btree, random_key(i + 1) | 1);
+    }
+    check(ok, "tree is valid after concurrent inserts");
+
+    arena_delete(&a);
+}
+
+/* True if a scan of `btree` sees exactly the keys 1..n */
+static bool scan_is(const BTree* btree, size_t n)
+{
+    BTree_cursor c;
+    size_t i = 0;
+    for (bool more = BTree_first(btree, &c); more; more = BTree_next(&c)) {
+        if (BTree_cursor_key(&c) != ++i) {
+            return false;
+        }
+    }
+    return i == n;
+}
+
+static void test_snapshots(size_t n)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    for (size_t i = 0; i < n; i++) {
+        BTree_insert(btree, i + 1);
+    }
+    BTree_enable_snapshots(btree);
+    BTree_version* before = BTree_snapshot(btree);
+
+    bool ok = true;
+    for (size_t i = n; i < 2 * n; i++) {
+        ok = ok && BTree_insert(btree, i + 1);
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        ok = ok && BTree_remove(btree, i + 1);
+    }
+    check(ok && check_tree(btree, n + n / 2), "tree is valid after changes with snapshots");
+    check(check_tree(&before->tree, n) && scan_is(&before->tree, n), "snapshot is unchanged by later inserts and removes");
+
+    BTree_version* unpublished = BTree_snapshot(btree);
+    check(unpublished == before, "changes aren't visible before they are published");
+    BTree_snapshot_release(btree, unpublished);
+
+    BTree_publish(btree);
+    BTree_version* after = BTree_snapshot(btree);
+    ok = check_tree(&after->tree, n + n / 2);
+    for (size_t i = 0; ok && i < 2 * n; i++) {
+        ok = BTree_find(&after->tree, i + 1) == (i >= n || i % 2 == 1);
+    }
+    check(ok && scan_is(&before->tree, n), "published snapshot sees the changes");
+    BTree_snapshot_release(btree, before);
+    BTree_snapshot_release(btree, after);
+
+    /* with every snapshot released, replaced nodes go back on the free
+     * list and churn stops growing the arena */
+    size_t warm = 0;
+    for (uint64_t round = 0; round < 8; round++) {
+        for (size_t i = 0; i < n; i++) {
+            const Key k = random_key(round * n + i) | ((Key)1 << 63);
+            BTree_insert(btree, k);
+            BTree_remove(btree, k);
+            if (i % 100 == 0) {
+                BTree_publish(btree);
+            }
+        }
+        if (round == 1) {
+            warm = a.size;
+        }
+    }
+    check(a.size <= warm + warm / 16, "arena is stable under churn with snapshots");
+
+    BTree_disable_snapshots(btree);
+    ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok = ok && BTree_remove(btree, 2 * n - i);
+    }
+    check(ok && check_tree(btree, n / 2), "changes in place after disabling snapshots");
+
+    arena_delete(&a);
+}
+
+struct snapshot_job {
+    BTree*   btree;
+    size_t   n;
+    bool     ok;
+};
+
+/* Readers only ever see whole batches of the writer's inserts */
+static void* snapshot_reader(void* arg)
+{
+    struct snapshot_job* job = arg;
+    job->ok = true;
+    size_t seen = 0;
+    while (seen < job->n) {
+        BTree_version* v = BTree_snapshot(job->btree);
+        size_t count = 0;
+        BTree_cursor c;
+        for (bool more = BTree_first(&v->tree, &c); more; more = BTree_next(&c)) {
+            job->ok = job->ok && BTree_cursor_key(&c) == ++count;
+        }
+        job->ok = job->ok && count % 1000 == 0 && count >= seen;
+        seen = count;
+        BTree_snapshot_release(job->btree, v);
+    }
+    return NULL;
+}
+
+static void test_snapshots_concurrent(size_t n, size_t readers)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    BTree_enable_snapshots(btree);
+
+    pthread_t           tids[readers];
+    struct snapshot_job jobs[readers];
+    for (size_t t = 0; t < readers; t++) {
+        jobs[t] = (struct snapshot_job) { .btree = btree, .n = n };
+        pthread_create(&tids[t], NULL, snapshot_reader, &jobs[t]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        BTree_insert(btree, i + 1);
+        if ((i + 1) % 1000 == 0) {
+            BTree_publish(btree);
+        }
+    }
+    bool ok = true;
+    for (size_t t = 0; t < readers; t++) {
+        pthread_join(tids[t], NULL);
+        ok = ok && jobs[t].ok;
+    }
+    check(ok, "concurrent readers see whole published batches");
+
+    BTree_disable_snapshots(btree);
+    check(check_tree(btree, n), "tree is valid after concurrent snapshots");
+    arena_delete(&a);
+}
+
+static void test_file(size_t n)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    Key* keys = fill(btree, n);
+
+    char path[] = "/tmp/test-btree-XXXXXX";
+    int fd = mkstemp(path);
+    close(fd);
+
+    char what[128];
+    snprintf(what, sizeof what, "write and open index with %zu keys", n);
+    BTree_file f;
+    bool ok = BTree_file_write(btree, path) == 0 && BTree_file_open(&f, path) == 0;
+    check(ok && f.header->key_count == n && f.header->node_count == btree->node_count, what);
+    if (!ok) {
+        unlink(path);
+        free(keys);
+        arena_delete(&a);
+        return;
+    }
+
+    ok = true;
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_file_find(&f, keys[i]) && !BTree_file_find(&f, keys[i] + 1);
+    }
+    check(ok, "find in index");
+
+    Key found;
+    ok = !BTree_file_lower_bound(&f, n > 0 ? keys[n - 1] + 1 : 0, &found);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_file_lower_bound(&f, keys[i], &found) && found == keys[i]
+          && BTree_file_lower_bound(&f, keys[i] - 1, &found) && found == keys[i];
+    }
+    check(ok, "lower_bound in index");
+
+    struct arena b = arena_new();
+    BTree* loaded = BTree_new(&b);
+    ok = BTree_file_load(&f, loaded, 1.0) && check_tree(loaded, n);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_find(loaded, keys[i]);
+    }
+    check(ok, "load index into a tree");
+    arena_delete(&b);
+
+    check(BTree_file_close(&f) == 0, "close index");
+
+    /* a file that isn't an index is rejected */
+    fd = open(path, O_WRONLY);
+    ok = fd != -1 && pwrite(fd, "NOTANIDX", 8, 0) == 8;
+    close(fd);
+    ok = ok && BTree_file_open(&f, path) == -1 && errno == EINVAL;
+    check(ok, "reject index with bad magic");
+
+    unlink(path);
+    check(BTree_file_open(&f, path) == -1 && errno == ENOENT, "reject missing index");
+
+    free(keys);
+    arena_delete(&a);
+}
+
+/* True if `btree` holds exactly the keys of `expected` */
+static bool same_keys(const BTree* btree, const BTree* expected)
+{
+    BTree_cursor c, d;
+    bool more_c = BTree_first(btree, &c);
+    bool more_d = BTree_first(expected, &d);
+    while (more_c && more_d) {
+        if (BTree_cursor_key(&c) != BTree_cursor_key(&d)) {
+            return false;
+        }
+        more_c = BTree_next(&c);
+        more_d = BTree_next(&d);
+    }
+    return !more_c && !more_d;
+}
+
+static void test_wal(size_t n, size_t group)
+{
+    char dir[] = "/tmp/test-btree-wal-XXXXXX";
+    char path[64], wal_path[64];
+    if (!mkdtemp(dir)) {
+        check(false, "make wal directory");
+        return;
+    }
+    snprintf(path, sizeof path, "%s/index", dir);
+    snprintf(wal_path, sizeof wal_path, "%s/index.wal", dir);
+
+    struct arena a = arena_new();
+    BTree* expected = BTree_new(&a);
+    BTree* btree    = BTree_new(&a);
+    BTree_wal w;
+    bool ok = BTree_wal_open(&w, btree, path, group) == 0 && check_tree(btree, 0);
+    check(ok, "open new wal");
+    if (!ok) {
+        arena_delete(&a);
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const Key k = random_key(i) % (n / 2 + 1);
+        if (i % 3 == 2) {
+            ok = ok && BTree_wal_remove(&w, k) == BTree_remove(expected, k);
+        } else {
+            ok = ok && BTree_wal_insert(&w, k) == BTree_insert(expected, k);
+        }
+    }
+    check(ok && w.syncs == w.records / w.group, "wal syncs once per group");
+    ok = BTree_wal_close(&w) == 0;
+
+    BTree* recovered = BTree_new(&a);
+    ok = ok && BTree_wal_open(&w, recovered, path, group) == 0 && same_keys(recovered, expected);
+    check(ok, "recover from the log");
+
+    /* a checkpoint empties the log, and what follows is replayed over it */
+    ok = ok && BTree_wal_checkpoint(&w) == 0 && w.records == 0;
+    for (size_t i = 0; i < n / 2; i++) {
+        const Key k = random_key(i + n) % (n / 2 + 1);
+        ok = ok && BTree_wal_remove(&w, k) == BTree_remove(expected, k);
+    }
+    ok = ok && BTree_wal_sync(&w) == 0;
+
+    /* unsynced changes die with the process, synced ones survive it. The
+     * log is reopened without closing it first, as after a crash. */
+    for (size_t i = 0; i + 1 < group; i++) {
+        BTree_wal_insert(&w, (Key)1 << 62 | i);
+    }
+    recovered = BTree_new(&a);
+    BTree_wal crashed;
+    ok = ok && BTree_wal_open(&crashed, recovered, path, group) == 0 && same_keys(recovered, expected);
+    check(ok, "recover from a checkpoint and the log after a crash");
+    ok = ok && BTree_wal_close(&crashed) == 0;
+    /* the crashed writer's buffer is lost with it */
+    w.pending_count = 0;
+    ok = ok && BTree_wal_close(&w) == 0;
+
+    /* a record torn by a crash is cut off, the ones before it are kept */
+    BTree_wal_record torn = { .op = BTREE_WAL_INSERT, .key = 12345 };
+    int fd = open(wal_path, O_WRONLY | O_APPEND);
+    ok = ok && fd != -1 && write(fd, &torn, sizeof torn - 3) == sizeof torn - 3;
+    close(fd);
+    recovered = BTree_new(&a);
+    ok = ok && BTree_wal_open(&w, recovered, path, group) == 0 && same_keys(recovered, expected);
+    ok = ok && BTree_wal_insert(&w, 1) == BTree_insert(expected, 1) && BTree_wal_close(&w) == 0;
+    recovered = BTree_new(&a);
+    ok = ok && BTree_wal_open(&w, recovered, path, group) == 0 && same_keys(recovered, expected)
+         && BTree_wal_close(&w) == 0;
+    check(ok, "drop a torn record on recovery");
+
+    fd = open(wal_path, O_WRONLY);
+    ok = fd != -1 && pwrite(fd, "NOTAWAL!", 8, 0) == 8;
+    close(fd);
+    ok = ok && BTree_wal_open(&w, BTree_new(&a), path, group) == -1 && errno == EINVAL;
+    check(ok, "reject log with bad magic");
+
+    unlink(wal_path);
+    unlink(path);
+    rmdir(dir);
+    arena_delete(&a);
+}
+
+static void test_static(size_t n)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    Key* keys = fill(btree, n);
+    BTree_static* s = BTree_static_new(&a, btree);
+
+    char what[128];
+    snprintf(what, sizeof what, "static snapshot of %zu keys", n);
+    bool ok = s->n == n;
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_static_find(s, keys[i]) && !BTree_static_find(s, keys[i] + 1);
+    }
+    check(ok, what);
+
+    Key found;
+    ok = !BTree_static_lower_bound(s, n > 0 ? keys[n - 1] + 1 : 0, &found);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_static_lower_bound(s, keys[i], &found) && found == keys[i]
+          && BTree_static_lower_bound(s, keys[i] - 1, &found) && found == keys[i];
+    }
+    check(ok, "static lower_bound");
+
+    /* every other lookup is a miss */
+    Key*  lookups = malloc((2 * n + 1) * sizeof *lookups);
+    bool* hits    = malloc((2 * n + 1) * sizeof *hits);
+    for (size_t i = 0; i < n; i++) {
+        lookups[2 * i]     = keys[i];
+        lookups[2 * i + 1] = keys[i] | 1;
+    }
+    ok = BTree_static_find_batch(s, lookups, 2 * n, hits) == n;
+    for (size_t i = 0; ok && i < 2 * n; i++) {
+        ok = hits[i] == (i % 2 == 0);
+    }
+    check(ok, "static batched find");
+    free(lookups);
+    free(hits);
+
+    /* the largest key doubles as the padding value */
+    BTree_insert(btree, UINT64_MAX);
+    s = BTree_static_new(&a, btree);
+    bool hit;
+    ok = BTree_static_find(s, UINT64_MAX) && BTree_static_find_batch(s, &(Key){ UINT64_MAX }, 1, &hit) && hit
+      && BTree_static_lower_bound(s, n > 0 ? keys[n - 1] + 1 : 0, &found) && found == UINT64_MAX;
+    check(ok, "static snapshot with the largest key");
+
+    free(keys);
+    arena_delete(&a);
+}
+
+/* Keys inserted in ascending or descending order should fill nodes
+ * nearly full instead of leaving every node split at the middle behind */
+/* Checks every key of the packed snapshot and the gaps around them against
+ * the sorted `keys` */
+static bool packed_matches(const BTree_packed* p, const Key* keys, size_t n)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < p->leaf_count; i++) {
+        count += p->leaves[i].count;
+    }
+    bool ok = p->n == n && count == n;
+
+    Key found;
+    ok = ok && (n == 0 || keys[0] == 0 || !BTree_packed_find(p, keys[0] - 1));
+    ok = ok && (n == 0 ? !BTree_packed_lower_bound(p, 0, &found)
+                       : BTree_packed_lower_bound(p, 0, &found) && found == keys[0]);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_packed_find(p, keys[i])
+          && BTree_packed_lower_bound(p, keys[i], &found) && found == keys[i];
+        if (ok && keys[i] != UINT64_MAX && (i + 1 == n || keys[i + 1] != keys[i] + 1)) {
+            const bool next = BTree_packed_lower_bound(p, keys[i] + 1, &found);
+            ok = !BTree_packed_find(p, keys[i] + 1)
+              && (i + 1 < n ? next && found == keys[i + 1] : !next);
+        }
+    }
+    return ok;
+}
+
+/* Keys in runs whose gaps need each of the delta widths, from 0 up to the
+ * largest key */
+static Key* mixed_keys(size_t n)
+{
+    const Key gaps[] = { 1, 3, 200, 50 * 1000, (Key)1 << 30, (Key)1 << 40 };
+    Key* keys = malloc(n * sizeof *keys);
+    Key  key  = 0;
+    for (size_t i = 0; i + 1 < n; i++) {
+        const Key gap = gaps[random_key(i / 100) % (sizeof gaps / sizeof *gaps)];
+        keys[i] = key;
+        key += 1 + random_key(i) % gap;
+    }
+    if (n > 0) {
+        keys[n - 1] = UINT64_MAX;
+    }
+    return keys;
+}
+
+/* Random inserts and removes over a key range, against a bitmap, checked
+ * with the messages still buffered and again after flushing them */
+static void test_be(size_t n, size_t range)
+{
+    struct arena a = arena_new();
+    BTree_be* t = BTree_be_new(&a);
+    bool* present = calloc(range, sizeof *present);
+    for (size_t i = 0; i < n; i++) {
+        const Key k = random_key(i) % range;
+        if (i % 4 == 3) {
+            BTree_be_remove(t, k);
+            present[k] = false;
+        } else {
+            BTree_be_insert(t, k);
+            present[k] = true;
+        }
+    }
+
+    char what[128];
+    snprintf(what, sizeof what, "Bε-tree find with %zu buffered changes over %zu keys", n, range);
+    bool ok = true;
+    size_t live = 0;
+    for (size_t k = 0; k < range; k++) {
+        ok = ok && BTree_be_find(t, k) == present[k];
+        live += present[k];
+    }
+    check(ok && (range <= BTREE_BE_LEAF || t->height > 0), what);
+
+    ok = BTree_be_count(t) == live;
+    for (size_t k = 0; k < range; k++) {
+        ok = ok && BTree_be_find(t, k) == present[k];
+    }
+    check(ok, "Bε-tree find after flushing");
+
+    /* removing everything empties the leaves, which stay */
+    for (size_t k = 0; k < range; k++) {
+        BTree_be_remove(t, k);
+    }
+    check(BTree_be_count(t) == 0 && !BTree_be_find(t, 0), "Bε-tree remove every key");
+
+    free(present);
+    arena_delete(&a);
+}
+
+static void test_packed(size_t n)
+{
+    struct arena a = arena_new();
+    char what[128];
+
+    BTree* btree = BTree_new(&a);
+    Key* keys = fill(btree, n);
+    BTree_packed* p = BTree_packed_new(&a, btree);
+    snprintf(what, sizeof what, "packed snapshot of %zu random keys", n);
+    check(packed_matches(p, keys, n), what);
+    free(keys);
+
+    keys = malloc((n > 0 ? n : 1) * sizeof *keys);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = 1000 * 1000 + 2 * i + random_key(i) % 2;
+    }
+    BTree_packed dense;
+    BTree_packed_init_sorted(&a, &dense, keys, n);
+    snprintf(what, sizeof what, "packed snapshot of %zu dense keys", n);
+    check(packed_matches(&dense, keys, n) && dense.shift_count[0] == dense.leaf_count, what);
+    free(keys);
+
+    keys = mixed_keys(n);
+    BTree_packed mixed;
+    BTree_packed_init_sorted(&a, &mixed, keys, n);
+    snprintf(what, sizeof what, "packed snapshot of %zu mixed keys", n);
+    bool ok = packed_matches(&mixed, keys, n);
+    for (size_t shift = 0; ok && n >= 100 * 1000 && shift < 4; shift++) {
+        ok = mixed.shift_count[shift] > 0;
+    }
+    check(ok, what);
+    free(keys);
+
+    arena_delete(&a);
+}
+
+static void test_ordered_fill(size_t n, bool ascending)
+{
+    struct arena a = arena_new();
+    BTree* btree = BTree_new(&a);
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok = ok && BTree_insert(btree, ascending ? i + 1 : n - i);
+    }
+    ok = ok && check_tree(btree, n);
+    for (size_t i = 0; ok && i < n; i++) {
+        ok = BTree_find(btree, i + 1);
+    }
+
+    const double fill = (double)n / (double)node_capacity(btree->root);
+    char what[128];
+    snprintf(what, sizeof what, "%s inserts fill %.0lf%% of node capacity",
+             ascending ? "ascending" : "descending", 100 * fill);
+    check(ok && fill > 0.75, what);
+
+    /* the lopsided nodes must still take random inserts and removes */
+    for (size_t i = 0; i < n; i++) {
+        ok = ok && BTree_insert(btree, random_key(i + 1) | ((Key)1 << 63));
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        ok = ok && BTree_remove(btree, i + 1);
+    }
+    check(ok && check_tree(btree, n + n / 2), "random inserts and removes after ordered inserts");
+
+    arena_delete(&a);
+}
+
+int main()
+{
+    test_empty();
+    const size_t selected = BTree_search_kernel_selected();
+    for (size_t i = 0; i < BTree_search_kernel_count(); i++) {
+        if (!BTree_search_kernel_select(i)) {
+            continue;
+        }
+        printf("search kernel: %s\n", BTree_search_kernel_name(i));
+        test_find(1);
+        test_find(100 * 1000);
+    }
+    BTree_search_kernel_select(selected);
+    test_cursor(1);
+    test_cursor(2);
+    test_cursor(100 * 1000);
+    test_remove(1);
+    test_remove(2);
+    test_remove(100 * 1000);
+    test_churn(100 * 1000);
+    test_repeated_keys(100);
+    test_repeated_keys(100 * 1000);
+    test_finger(1, false);
+    test_finger(100 * 1000, false);
+    test_finger(100 * 1000, true);
+    test_ordered_fill(100 * 1000, true);
+    test_ordered_fill(100 * 1000, false);
+    const size_t bulk_sizes[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 63, 64, 65, 100 * 1000 };
+    const double fill_factors[] = { 0.0, 0.5, 0.7, 1.0 };
+    for (size_t i = 0; i < sizeof bulk_sizes / sizeof *bulk_sizes; i++) {
+        for (size_t j = 0; j < sizeof fill_factors / sizeof *fill_factors; j++) {
+            test_bulk_load(bulk_sizes[i], fill_factors[j], 1);
+        }
+    }
+    test_bulk_load(2 * 1000 * 1000, 0.7, 3);
+    test_bulk_load(2 * 1000 * 1000, 1.0, 8);
+    test_bulk_load_unsorted();
+    test_bulk_load_parallel(2 * 1000 * 1000, 4);
+    test_set_ops(0, 1, 0, 1, 0);
+    test_set_ops(1000, 1, 0, 1, 0);
+    test_set_ops(0, 1, 1000, 1, 0);
+    test_set_ops(100 * 1000, 2, 100 * 1000, 3, 0);
+    test_set_ops(100 * 1000, 1, 1000, 97, 5);
+    test_set_ops(1000, 97, 100 * 1000, 1, 5);
+    test_set_ops(100 * 1000, 1, 100 * 1000, 1, 50 * 1000);
+    test_set_ops(100 * 1000, 1, 100 * 1000, 1, 0);
+    test_concurrent(200 * 1000, 4);
+    test_snapshots(1);
+    test_snapshots(100 * 1000);
+    test_snapshots_concurrent(100 * 1000, 3);
+    test_file(0);
+    test_file(1);
+    test_file(100 * 1000);
+    test_wal(0, 1);
+    test_wal(100 * 1000, 1000);
+    const size_t static_sizes[] = { 0, 1, 7, 8, 9, 72, 80, 81, 648, 100 * 1000 };
+    for (size_t i = 0; i < sizeof static_sizes / sizeof *static_sizes; i++) {
+        test_static(static_sizes[i]);
+    }
+    test_be(0, 1);
+    test_be(100, 10);
+    test_be(200 * 1000, 1000);
+    test_be(1000 * 1000, 1000 * 1000);
+    const size_t packed_sizes[] = { 0, 1, 2, 48, 49, 50, 100 * 1000 };
+    for (size_t i = 0; i < sizeof packed_sizes / sizeof *packed_sizes; i++) {
+        test_packed(packed_sizes[i]);
+    }
+
+    return status;
+}
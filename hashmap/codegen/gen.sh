@@ -30,5 +30,18 @@ for t in $types; do
 		#define HASHMAP_VAL $t
 		#include "hashmap.h"
 	EOM
+
+	cat > "swisstable-$postfix.c" <<- EOM
+		#define HASHMAP_PREFIX swisstable_$postfix
+		#define HASHMAP_VAL $t
+		#include "swisstable.c"
+	EOM
+
+	cat > "swisstable-$postfix.h" <<- EOM
+		#pragma once
+		#define HASHMAP_PREFIX swisstable_$postfix
+		#define HASHMAP_VAL $t
+		#include "swisstable.h"
+	EOM
 done
 
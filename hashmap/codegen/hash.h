@@ -0,0 +1 @@
+../src/hash.h
\ No newline at end of file
@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_double
+#define HASHMAP_VAL double
+#include "swisstable.c"
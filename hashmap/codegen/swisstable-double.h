@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_double
+#define HASHMAP_VAL double
+#include "swisstable.h"
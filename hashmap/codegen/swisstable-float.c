@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_float
+#define HASHMAP_VAL float
+#include "swisstable.c"
@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_float
+#define HASHMAP_VAL float
+#include "swisstable.h"
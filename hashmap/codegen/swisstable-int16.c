@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_int16
+#define HASHMAP_VAL int16_t
+#include "swisstable.c"
@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_int16
+#define HASHMAP_VAL int16_t
+#include "swisstable.h"
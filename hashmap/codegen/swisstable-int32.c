@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_int32
+#define HASHMAP_VAL int32_t
+#include "swisstable.c"
@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_int32
+#define HASHMAP_VAL int32_t
+#include "swisstable.h"
@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_int64
+#define HASHMAP_VAL int64_t
+#include "swisstable.c"
@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_int64
+#define HASHMAP_VAL int64_t
+#include "swisstable.h"
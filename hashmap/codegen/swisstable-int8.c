@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_int8
+#define HASHMAP_VAL int8_t
+#include "swisstable.c"
@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_int8
+#define HASHMAP_VAL int8_t
+#include "swisstable.h"
@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_uint16
+#define HASHMAP_VAL uint16_t
+#include "swisstable.c"
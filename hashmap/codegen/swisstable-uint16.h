@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_uint16
+#define HASHMAP_VAL uint16_t
+#include "swisstable.h"
@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_uint32
+#define HASHMAP_VAL uint32_t
+#include "swisstable.c"
@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_uint32
+#define HASHMAP_VAL uint32_t
+#include "swisstable.h"
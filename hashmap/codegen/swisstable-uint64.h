@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_uint64
+#define HASHMAP_VAL uint64_t
+#include "swisstable.h"
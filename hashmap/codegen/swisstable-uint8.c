@@ -0,0 +1,3 @@
+#define HASHMAP_PREFIX swisstable_uint8
+#define HASHMAP_VAL uint8_t
+#include "swisstable.c"
@@ -0,0 +1,4 @@
+#pragma once
+#define HASHMAP_PREFIX swisstable_uint8
+#define HASHMAP_VAL uint8_t
+#include "swisstable.h"
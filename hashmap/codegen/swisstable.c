@@ -0,0 +1 @@
+../src/swisstable.c
\ No newline at end of file
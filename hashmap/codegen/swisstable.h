@@ -0,0 +1 @@
+../src/swisstable.h
\ No newline at end of file
@@ -0,0 +1,43 @@
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ < 202112L
+    #define constexpr const
+#endif
+
+static size_t hash_djb2(const void* key, size_t len)
+{
+    /* djb2 inspired hash */
+    constexpr size_t seed  = 5381;
+    constexpr size_t magic = 33;
+
+    size_t n = seed;
+
+    const uint8_t* key_bytewise = key;
+
+    for (size_t i = 0; i < len; i++) {
+        n = n * magic + key_bytewise[i];
+    }
+    return n;
+}
+
+static size_t jenkins_one_at_a_time_hash(const void* data, size_t len) {
+    size_t i = 0;
+    size_t h = 0;
+    const uint8_t* key = data;
+    while (i != len) {
+        h += key[i++];
+        h += h << 10;
+        h ^= h >> 6;
+    }
+    h += h << 3;
+    h ^= h >> 11;
+    h += h << 15;
+    return h;
+}
+
+#endif
@@ -1,11 +1,8 @@
 
 #define _POSIX_C_SOURCE 200809L
 
-#if defined(__STDC_VERSION__) && __STDC_VERSION__ < 202112L
-    #define constexpr const
-#endif
-
 #include "arena.h"
+#include "hash.h"
 #include "hashmap.h"
 
 #include <stdint.h>
@@ -17,71 +14,108 @@
 #ifndef HASHMAP_HASHES
 #define HASHMAP_HASHES
 
-static size_t hash_djb2(const void* key, size_t len)
-{
-    /* djb2 inspired hash */
-    constexpr size_t seed  = 5381;
-    constexpr size_t magic = 33;
-
-    size_t n = seed;
-
-    const uint8_t* key_bytewise = key;
+/* Buckets moved, or ten times as many empty ones skipped, per operation
+ * while a rehash is in progress */
+#define REHASH_STEP 4
 
-    for (size_t i = 0; i < len; i++) {
-        n = n * magic + key_bytewise[i];
-    }
-    return n;
+/* Fibonacci hashing. The top bits of the product depend on every bit of
+ * the hash, where the low bits of djb2 only depend on the low bits of the
+ * key bytes. */
+static inline size_t bucket_of(size_t hash, size_t shift)
+{
+    return (size_t)(((uint64_t)hash * 0x9e3779b97f4a7c15ULL) >> shift);
 }
 
-static size_t jenkins_one_at_a_time_hash(const void* data, size_t len) {
-    size_t i = 0;
-    size_t h = 0;
-    const uint8_t* key = data;
-    while (i != len) {
-        h += key[i++];
-        h += h << 10;
-        h ^= h >> 6;
-    }
-    h += h << 3;
-    h ^= h >> 11;
-    h += h << 15;
-    return h;
+static inline size_t bucket_count(size_t shift)
+{
+    return (size_t)1 << (64 - shift);
 }
 #endif /* ifdef HASHMAP_HASHES */
 
 // Returns a pointer pointer to the entry matching the key. If the dereferenced
 // return value is null it can simply be malloced with no additional
 // linked-list logic.
-//
-// This interface is kind of horrible but it's only used internally. The
-// parameter `dummy` must be defined for the duration of the return value of
-// this function.
-static inline HASHMAP_ENTRY_T** HASHMAP_METHOD(at)(HASHMAP_T* hashmap, const void* key, size_t key_len, HASHMAP_ENTRY_T* dummy)
+static inline HASHMAP_ENTRY_T** HASHMAP_METHOD(chain)(HASHMAP_ENTRY_T** indirect, const void* key, size_t key_len, size_t h)
 {
-    size_t h = hash_djb2(key, key_len);
-    HASHMAP_ENTRY_T* e = &(hashmap->entries[h % ENTRY_COUNT]);
-	dummy->next = e;
-    HASHMAP_ENTRY_T** indirect = &(dummy->next);
-
+    HASHMAP_ENTRY_T* e;
     while ((e = *indirect) /* implicitly tests e == NULL */
-		   && (e->key_len != key_len
-		   || memcmp(e->key, key, key_len) != 0))
+           && (e->hash != h
+           || e->key_len != key_len
+           || memcmp(e->key, key, key_len) != 0))
     {
         indirect = &(e->next);
     }
-
     return indirect;
 }
 
+// Like chain, over the bucket for `h`. Buckets of the old table that
+// haven't moved yet are searched first, and a new entry goes at the end of
+// the bucket in the new table.
+static inline HASHMAP_ENTRY_T** HASHMAP_METHOD(at)(HASHMAP_T* hashmap, const void* key, size_t key_len, size_t h)
+{
+    if (hashmap->old_buckets) {
+        const size_t i = bucket_of(h, hashmap->old_shift);
+        if (i >= hashmap->rehash_index) {
+            HASHMAP_ENTRY_T** indirect = HASHMAP_METHOD(chain)(&hashmap->old_buckets[i], key, key_len, h);
+            if (*indirect) {
+                return indirect;
+            }
+        }
+    }
+    return HASHMAP_METHOD(chain)(&hashmap->buckets[bucket_of(h, hashmap->shift)], key, key_len, h);
+}
+
+static void HASHMAP_METHOD(rehash_step)(HASHMAP_T* hashmap)
+{
+    const size_t old_count = bucket_count(hashmap->old_shift);
+    size_t moved   = 0;
+    size_t visited = 0;
+    while (hashmap->rehash_index < old_count && moved < REHASH_STEP && visited < 10 * REHASH_STEP) {
+        HASHMAP_ENTRY_T* e = hashmap->old_buckets[hashmap->rehash_index++];
+        visited++;
+        moved += e != NULL;
+        while (e) {
+            HASHMAP_ENTRY_T*  next = e->next;
+            HASHMAP_ENTRY_T** head = &hashmap->buckets[bucket_of(e->hash, hashmap->shift)];
+            e->next = *head;
+            *head   = e;
+            e       = next;
+        }
+    }
+    if (hashmap->rehash_index == old_count) {
+        hashmap->old_buckets = NULL;
+    }
+}
+
+// Start moving the entries to a table with 2^(64 - shift) buckets
+static void HASHMAP_METHOD(resize)(HASHMAP_T* hashmap, size_t shift)
+{
+    hashmap->old_buckets  = hashmap->buckets;
+    hashmap->old_shift    = hashmap->shift;
+    hashmap->rehash_index = 0;
+    hashmap->buckets      = arena_calloc(hashmap->arena, bucket_count(shift), sizeof *hashmap->buckets);
+    hashmap->shift        = shift;
+}
+
 T* HASHMAP_METHOD(insert)(HASHMAP_T* hashmap, const void* key, size_t key_len)
 {
-	HASHMAP_ENTRY_T dummy = {0};
-    HASHMAP_ENTRY_T** entry_indirect = HASHMAP_METHOD(at)(hashmap, key, key_len, &dummy);
+    if (hashmap->old_buckets) {
+        HASHMAP_METHOD(rehash_step)(hashmap);
+    }
+    const size_t h = hash_djb2(key, key_len);
+    HASHMAP_ENTRY_T** entry_indirect = HASHMAP_METHOD(at)(hashmap, key, key_len, h);
 
     if (*entry_indirect == NULL) {
         *entry_indirect = arena_calloc(hashmap->arena, sizeof **entry_indirect, 1);
         (*entry_indirect)->key = arena_copy(hashmap->arena, key, key_len);
         (*entry_indirect)->key_len = key_len;
+        (*entry_indirect)->hash = h;
+        hashmap->count++;
+        if (hashmap->count > bucket_count(hashmap->shift) && !hashmap->old_buckets) {
+            HASHMAP_ENTRY_T* entry = *entry_indirect;
+            HASHMAP_METHOD(resize)(hashmap, hashmap->shift - 1);
+            return &(entry->val);
+        }
     }
 
     return &((*entry_indirect)->val);
@@ -89,8 +123,10 @@ T* HASHMAP_METHOD(insert)(HASHMAP_T* hashmap, const void* key, size_t key_len)
 
 T HASHMAP_METHOD(get)(HASHMAP_T* hashmap, const void* key, size_t key_len, T otherwise)
 {
-	HASHMAP_ENTRY_T dummy = {0};
-    HASHMAP_ENTRY_T** entry_indirect = HASHMAP_METHOD(at)(hashmap, key, key_len, &dummy);
+    if (hashmap->old_buckets) {
+        HASHMAP_METHOD(rehash_step)(hashmap);
+    }
+    HASHMAP_ENTRY_T** entry_indirect = HASHMAP_METHOD(at)(hashmap, key, key_len, hash_djb2(key, key_len));
     if (*entry_indirect == NULL) {
         return otherwise;
     }
@@ -101,19 +137,43 @@ HASHMAP_T* HASHMAP_METHOD(new)(struct arena* a)
 {
     HASHMAP_T* hm = arena_calloc(a, sizeof *hm, 1);
 
-    hm->arena = a;
+    HASHMAP_METHOD(init)(a, hm);
 
     return hm;
 }
 
 void HASHMAP_METHOD(init)(struct arena* a, HASHMAP_T* hashmap)
 {
-	hashmap->arena = a;
+    *hashmap = (HASHMAP_T) {
+        .arena   = a,
+        .buckets = arena_calloc(a, ENTRY_COUNT, sizeof *hashmap->buckets),
+        .shift   = 64 - __builtin_ctzll(ENTRY_COUNT),
+    };
+}
+
+void HASHMAP_METHOD(reserve)(HASHMAP_T* hashmap, size_t n)
+{
+    while (hashmap->old_buckets) {
+        HASHMAP_METHOD(rehash_step)(hashmap);
+    }
+    size_t shift = hashmap->shift;
+    while (bucket_count(shift) < n) {
+        shift--;
+    }
+    if (shift == hashmap->shift) {
+        return;
+    }
+    HASHMAP_METHOD(resize)(hashmap, shift);
+    while (hashmap->old_buckets) {
+        HASHMAP_METHOD(rehash_step)(hashmap);
+    }
 }
 
 bool HASHMAP_METHOD(contains)(HASHMAP_T* hashmap, const void* key, size_t key_len)
 {
-	HASHMAP_ENTRY_T dummy = {0};
-    HASHMAP_ENTRY_T** entry_indirect = HASHMAP_METHOD(at)(hashmap, key, key_len, &dummy);
-	return *entry_indirect != NULL;
+    if (hashmap->old_buckets) {
+        HASHMAP_METHOD(rehash_step)(hashmap);
+    }
+    HASHMAP_ENTRY_T** entry_indirect = HASHMAP_METHOD(at)(hashmap, key, key_len, hash_djb2(key, key_len));
+    return *entry_indirect != NULL;
 }
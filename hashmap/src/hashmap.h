@@ -23,18 +23,31 @@
 
 /* ==== */
 
+/* Buckets a new map starts with. The bucket count doubles whenever there
+ * are more entries than buckets. */
 #define ENTRY_COUNT 256
 
 typedef struct HASHMAP_ENTRY_T {
     struct HASHMAP_ENTRY_T* next;
+    size_t                  hash;
     size_t                  key_len;
     const void*             key;
     T                       val;
 } HASHMAP_ENTRY_T;
 
+/* When the table grows, the entries aren't all moved at once. Every
+ * operation after it moves a few buckets of the old table to the new one,
+ * and lookups look in the old buckets not yet moved as well. Entries are
+ * relinked, never copied, so value pointers stay valid. Old tables stay in
+ * the arena. */
 typedef struct HASHMAP_T {
-    struct arena*           arena;
-    struct HASHMAP_ENTRY_T  entries[ENTRY_COUNT];
+    struct arena*            arena;
+    struct HASHMAP_ENTRY_T** buckets;
+    size_t                   shift;        /* 64 - log2 of the bucket count */
+    size_t                   count;
+    struct HASHMAP_ENTRY_T** old_buckets;  /* NULL unless a rehash is in progress */
+    size_t                   old_shift;
+    size_t                   rehash_index; /* the next old bucket to move */
 } HASHMAP_T;
 
 HASHMAP_T* HASHMAP_METHOD(new)(struct arena* a);
@@ -55,4 +68,10 @@ static inline T HASHMAP_METHOD(sget)(HASHMAP_T* hashmap, const char* key, T othe
 
 void HASHMAP_METHOD(init)(struct arena* a, HASHMAP_T* hashmap);
 
+/**
+ * Grow the table to hold `n` entries without growing again. Unlike growth
+ * on insert, every entry is moved right away.
+ */
+void HASHMAP_METHOD(reserve)(HASHMAP_T* hashmap, size_t n);
+
 bool HASHMAP_METHOD(contains)(HASHMAP_T* hashmap, const void* key, size_t key_len);
@@ -0,0 +1,248 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "arena.h"
+#include "hash.h"
+#include "swisstable.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Because this file might be included several times in tests (to test static functions),
+ * non-templated functions are in a "header guard" */
+#ifndef SWISSTABLE_GROUPS
+#define SWISSTABLE_GROUPS
+
+#define CTRL_EMPTY 0x80
+
+_Static_assert(SWISSTABLE_SLOT_COUNT % SWISSTABLE_GROUP_WIDTH == 0, "a table is whole groups");
+
+/* The tag and the group both come from the low bits, which djb2 doesn't
+ * mix well, so the hash goes through the MurmurHash3 finalizer first */
+static inline size_t swisstable_hash(const void* key, size_t len)
+{
+    uint64_t h = hash_djb2(key, len);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+/* A group mask has a bit set for every slot in the group matching the
+ * query. group_index() gives the lowest one, `m &= m - 1` clears it. */
+#if SWISSTABLE_GROUP_WIDTH == 16
+
+#include <emmintrin.h>
+
+typedef uint32_t group_mask;
+
+static inline group_mask group_match(const uint8_t* ctrl, uint8_t tag)
+{
+    const __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (group_mask)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+}
+
+static inline group_mask group_empty(const uint8_t* ctrl)
+{
+    return (group_mask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+
+static inline size_t group_index(group_mask m)
+{
+    return (size_t)__builtin_ctz(m);
+}
+
+#elif SWISSTABLE_GROUP_WIDTH == 8
+
+typedef uint64_t group_mask;
+
+#define GROUP_LSB 0x0101010101010101ULL
+#define GROUP_MSB 0x8080808080808080ULL
+
+static inline uint64_t group_load(const uint8_t* ctrl)
+{
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof group);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group);
+#endif
+    return group;
+}
+
+/* Sets the high bit of every zero byte of group ^ tag. A byte right above
+ * a match may be set as well, which only costs a key comparison. */
+static inline group_mask group_match(const uint8_t* ctrl, uint8_t tag)
+{
+    const uint64_t x = group_load(ctrl) ^ (GROUP_LSB * tag);
+    return (x - GROUP_LSB) & ~x & GROUP_MSB;
+}
+
+static inline group_mask group_empty(const uint8_t* ctrl)
+{
+    return group_load(ctrl) & GROUP_MSB;
+}
+
+static inline size_t group_index(group_mask m)
+{
+    return (size_t)__builtin_ctzll(m) / 8;
+}
+
+#else
+    #error "SWISSTABLE_GROUP_WIDTH must be 8 or 16"
+#endif
+
+static inline uint8_t ctrl_tag(size_t hash)
+{
+    return hash & 0x7f;
+}
+
+static inline size_t max_count(size_t slots)
+{
+    return slots - slots / 8;
+}
+#endif /* ifdef SWISSTABLE_GROUPS */
+
+// Returns the index of the slot holding the key, or if there is none, of
+// the empty slot it goes in. The probe steps 1, 2, 3, ... groups at a
+// time, which visits every group since the group count is a power of two.
+static inline size_t HASHMAP_METHOD(at)(HASHMAP_T* hashmap, const void* key, size_t key_len, size_t h, bool* found)
+{
+    const uint8_t tag = ctrl_tag(h);
+    size_t group = (h >> 7) & hashmap->group_mask;
+
+    for (size_t stride = 1;; stride++) {
+        const size_t   base = group * SWISSTABLE_GROUP_WIDTH;
+        const uint8_t* ctrl = &hashmap->ctrl[base];
+
+        for (group_mask m = group_match(ctrl, tag); m; m &= m - 1) {
+            const size_t i = base + group_index(m);
+            const HASHMAP_ENTRY_T* s = &hashmap->slots[i];
+            if (s->hash == h
+                && s->key_len == key_len
+                && memcmp(key_len <= sizeof s->short_key ? s->short_key : s->key, key, key_len) == 0)
+            {
+                *found = true;
+                return i;
+            }
+        }
+
+        /* There are no removals, so the key can't be past an empty slot */
+        const group_mask empty = group_empty(ctrl);
+        if (empty) {
+            *found = false;
+            return base + group_index(empty);
+        }
+
+        group = (group + stride) & hashmap->group_mask;
+    }
+}
+
+// Move every slot to a new table of `slots` slots
+static void HASHMAP_METHOD(resize)(HASHMAP_T* hashmap, size_t slots)
+{
+    const size_t           old_slots = (hashmap->group_mask + 1) * SWISSTABLE_GROUP_WIDTH;
+    const uint8_t*         old_ctrl  = hashmap->ctrl;
+    const HASHMAP_ENTRY_T* old       = hashmap->slots;
+
+    hashmap->ctrl       = arena_alloc(hashmap->arena, slots);
+    hashmap->slots      = arena_alloc(hashmap->arena, slots * sizeof *hashmap->slots);
+    hashmap->group_mask = slots / SWISSTABLE_GROUP_WIDTH - 1;
+    memset(hashmap->ctrl, CTRL_EMPTY, slots);
+
+    for (size_t i = 0; i < old_slots; i++) {
+        if (old_ctrl[i] & CTRL_EMPTY) {
+            continue;
+        }
+        /* Keys are unique, so the slot is the first empty one on the probe
+         * sequence */
+        size_t group = (old[i].hash >> 7) & hashmap->group_mask;
+        group_mask empty;
+        for (size_t stride = 1; !(empty = group_empty(&hashmap->ctrl[group * SWISSTABLE_GROUP_WIDTH])); stride++) {
+            group = (group + stride) & hashmap->group_mask;
+        }
+        const size_t j = group * SWISSTABLE_GROUP_WIDTH + group_index(empty);
+        hashmap->ctrl[j]  = ctrl_tag(old[i].hash);
+        hashmap->slots[j] = old[i];
+    }
+
+    hashmap->growth_left = max_count(slots) - hashmap->count;
+}
+
+T* HASHMAP_METHOD(insert)(HASHMAP_T* hashmap, const void* key, size_t key_len)
+{
+    const size_t h = swisstable_hash(key, key_len);
+    bool found;
+    size_t i = HASHMAP_METHOD(at)(hashmap, key, key_len, h, &found);
+
+    if (!found) {
+        if (hashmap->growth_left == 0) {
+            HASHMAP_METHOD(resize)(hashmap, 2 * (hashmap->group_mask + 1) * SWISSTABLE_GROUP_WIDTH);
+            i = HASHMAP_METHOD(at)(hashmap, key, key_len, h, &found);
+        }
+        HASHMAP_ENTRY_T* s = &hashmap->slots[i];
+        hashmap->ctrl[i] = ctrl_tag(h);
+        *s = (HASHMAP_ENTRY_T) { .hash = h, .key_len = key_len };
+        if (key_len <= sizeof s->short_key) {
+            memcpy(s->short_key, key, key_len);
+        } else {
+            s->key = arena_copy(hashmap->arena, key, key_len);
+        }
+        hashmap->count++;
+        hashmap->growth_left--;
+    }
+
+    return &(hashmap->slots[i].val);
+}
+
+T HASHMAP_METHOD(get)(HASHMAP_T* hashmap, const void* key, size_t key_len, T otherwise)
+{
+    bool found;
+    const size_t i = HASHMAP_METHOD(at)(hashmap, key, key_len, swisstable_hash(key, key_len), &found);
+    if (!found) {
+        return otherwise;
+    }
+    return hashmap->slots[i].val;
+}
+
+HASHMAP_T* HASHMAP_METHOD(new)(struct arena* a)
+{
+    HASHMAP_T* hm = arena_calloc(a, sizeof *hm, 1);
+
+    HASHMAP_METHOD(init)(a, hm);
+
+    return hm;
+}
+
+void HASHMAP_METHOD(init)(struct arena* a, HASHMAP_T* hashmap)
+{
+    *hashmap = (HASHMAP_T) {
+        .arena       = a,
+        .ctrl        = arena_alloc(a, SWISSTABLE_SLOT_COUNT),
+        .slots       = arena_alloc(a, SWISSTABLE_SLOT_COUNT * sizeof *hashmap->slots),
+        .group_mask  = SWISSTABLE_SLOT_COUNT / SWISSTABLE_GROUP_WIDTH - 1,
+        .growth_left = max_count(SWISSTABLE_SLOT_COUNT),
+    };
+    memset(hashmap->ctrl, CTRL_EMPTY, SWISSTABLE_SLOT_COUNT);
+}
+
+void HASHMAP_METHOD(reserve)(HASHMAP_T* hashmap, size_t n)
+{
+    const size_t old_slots = (hashmap->group_mask + 1) * SWISSTABLE_GROUP_WIDTH;
+    size_t slots = old_slots;
+    while (max_count(slots) < n) {
+        slots *= 2;
+    }
+    if (slots != old_slots) {
+        HASHMAP_METHOD(resize)(hashmap, slots);
+    }
+}
+
+bool HASHMAP_METHOD(contains)(HASHMAP_T* hashmap, const void* key, size_t key_len)
+{
+    bool found;
+    HASHMAP_METHOD(at)(hashmap, key, key_len, swisstable_hash(key, key_len), &found);
+    return found;
+}
@@ -0,0 +1,90 @@
+#define XCAT(a, b) a##b
+#define CAT(a, b) XCAT(a,b)
+
+#ifdef HASHMAP_VAL
+	#ifndef HASHMAP_PREFIX
+		#error "HASHMAP_VAL defined but not HASHMAP_PREFIX"
+	#endif
+    #define T HASHMAP_VAL
+    #define HASHMAP_T       CAT(Swisstable_,T)
+    #define HASHMAP_ENTRY_T CAT(swisstable_slot_,T)
+#else
+    #define T void*
+    #define HASHMAP_T       Swisstable
+	#define HASHMAP_PREFIX  swisstable
+    #define HASHMAP_ENTRY_T swisstable_slot
+#endif
+
+#define HASHMAP_METHOD(x) CAT(CAT(HASHMAP_PREFIX,_), x)
+
+/* ==== */
+
+#include <stdint.h>
+#include <string.h>
+
+/* ==== */
+
+/* Control bytes are probed a group at a time: 16 with SSE2, otherwise 8
+ * packed in a uint64_t */
+#ifndef SWISSTABLE_GROUP_WIDTH
+    #if defined(__SSE2__) && !defined(SWISSTABLE_NO_SSE2)
+        #define SWISSTABLE_GROUP_WIDTH 16
+    #else
+        #define SWISSTABLE_GROUP_WIDTH 8
+    #endif
+#endif
+
+/* Slots a new table starts with */
+#define SWISSTABLE_SLOT_COUNT 256
+
+/* Keys no longer than a pointer are kept in the slot instead of the arena,
+ * so comparing them doesn't take another cache miss */
+typedef struct HASHMAP_ENTRY_T {
+    size_t hash;
+    size_t key_len;
+    union {
+        const void* key;
+        uint8_t     short_key[sizeof(const void*)];
+    };
+    T val;
+} HASHMAP_ENTRY_T;
+
+/* Open addressing with a control byte per slot. An empty slot has its
+ * control byte's high bit set, a full slot holds 7 bits of its hash, so a
+ * lookup compares a whole group of tags at once and only touches the slots
+ * whose tag matches. The table grows (all at once) past 7/8 full. Growing
+ * moves the slots, so pointers returned by insert are only valid until the
+ * next insert. */
+typedef struct HASHMAP_T {
+    struct arena*           arena;
+    uint8_t*                ctrl;
+    struct HASHMAP_ENTRY_T* slots;
+    size_t                  group_mask; /* the group count - 1 */
+    size_t                  count;
+    size_t                  growth_left;
+} HASHMAP_T;
+
+HASHMAP_T* HASHMAP_METHOD(new)(struct arena* a);
+
+T* HASHMAP_METHOD(insert)(HASHMAP_T* hashmap, const void* key, size_t key_len);
+
+static inline T* HASHMAP_METHOD(sinsert)(HASHMAP_T* hashmap, const char* key)
+{
+    return HASHMAP_METHOD(insert)(hashmap, key, strlen(key));
+}
+
+T HASHMAP_METHOD(get)(HASHMAP_T* hashmap, const void* key, size_t key_len, T otherwise);
+
+static inline T HASHMAP_METHOD(sget)(HASHMAP_T* hashmap, const char* key, T otherwise)
+{
+	return HASHMAP_METHOD(get)(hashmap, key, strlen(key), otherwise);
+}
+
+void HASHMAP_METHOD(init)(struct arena* a, HASHMAP_T* hashmap);
+
+/**
+ * Grow the table to hold `n` entries without growing again.
+ */
+void HASHMAP_METHOD(reserve)(HASHMAP_T* hashmap, size_t n);
+
+bool HASHMAP_METHOD(contains)(HASHMAP_T* hashmap, const void* key, size_t key_len);
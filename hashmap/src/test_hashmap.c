@@ -9,11 +9,20 @@
 #define HASHMAP_PREFIX hashmap_double
 #include "hashmap.c"
 
+#undef HASHMAP_VAL
+#undef HASHMAP_PREFIX
+#include "swisstable.c"
+
+#define HASHMAP_VAL int64_t
+#define HASHMAP_PREFIX swisstable_int64
+#include "swisstable.c"
+
 #pragma GCC diagnostic ignored "-Wunused-variable"
 
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -223,6 +232,61 @@ static struct distribution hash_distribution_uneven_rand(hash_func hash)
     };
 }
 
+#ifndef BENCH_MAX_KEYS
+    /* -DBENCH_MAX_KEYS=100000000 adds the 100M run, which needs about 16 GB */
+    #define BENCH_MAX_KEYS 10000000
+#endif
+
+static double seconds_since(struct timespec start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const struct timespec elapsed = timediff(start, end);
+    return (double)elapsed.tv_sec + (double)elapsed.tv_nsec/1e9;
+}
+
+/* Insert n 8-byte keys, then look each of them up, then look up n keys
+ * that aren't there. Prints nanoseconds per operation. Hits aren't in
+ * insertion order, which would walk the chained map's entries through the
+ * arena in order. */
+#define BENCH_MAP(name, new, insert, get)                                        \
+    do {                                                                         \
+        struct timespec start;                                                   \
+        volatile int64_t sink = 0;                                               \
+        arena_reset(a);                                                          \
+        clock_gettime(CLOCK_MONOTONIC, &start);                                  \
+        typeof(new(a)) m = new(a);                                               \
+        for (int64_t i = 0; i < n; i++) {                                        \
+            const uint64_t k = i * 0x9e3779b97f4a7c15ULL;                        \
+            *insert(m, &k, sizeof k) = i;                                        \
+        }                                                                        \
+        const double t_insert = seconds_since(start);                            \
+        clock_gettime(CLOCK_MONOTONIC, &start);                                  \
+        for (int64_t i = 0; i < n; i++) {                                        \
+            const uint64_t k = (i * 1000003 % n) * 0x9e3779b97f4a7c15ULL;        \
+            sink += get(m, &k, sizeof k, -1);                                    \
+        }                                                                        \
+        const double t_hit = seconds_since(start);                               \
+        clock_gettime(CLOCK_MONOTONIC, &start);                                  \
+        for (int64_t i = n; i < 2 * n; i++) {                                    \
+            const uint64_t k = i * 0x9e3779b97f4a7c15ULL;                        \
+            sink += get(m, &k, sizeof k, -1);                                    \
+        }                                                                        \
+        const double t_miss = seconds_since(start);                              \
+        printf("  %-10s %10" PRId64 " keys: insert %6.1f ns, hit %6.1f ns, miss %6.1f ns\n", \
+               name, n, 1e9 * t_insert / n, 1e9 * t_hit / n, 1e9 * t_miss / n);  \
+    } while (0)
+
+static void bench_maps(struct arena* a)
+{
+    printf("chained vs swiss table (%d-wide groups):\n", SWISSTABLE_GROUP_WIDTH);
+    for (int64_t n = 1000000; n <= BENCH_MAX_KEYS; n *= 10) {
+        BENCH_MAP("chained", hashmap_int64_new, hashmap_int64_insert, hashmap_int64_get);
+        BENCH_MAP("swisstable", swisstable_int64_new, swisstable_int64_insert, swisstable_int64_get);
+    }
+    arena_reset(a);
+}
+
 int main()
 {
 	int status = EXIT_SUCCESS;
@@ -299,6 +363,105 @@ int main()
 		arena_reset(&a);
 	}
 
+	{
+		const int64_t n = 200000;
+		Hashmap_int64_t* hm = hashmap_int64_new(&a);
+		{ /* test growth with lookups while rehashing */
+			int64_t* first = hashmap_int64_insert(hm, &(int64_t){-1}, sizeof(int64_t));
+			*first = -1;
+			bool ok = true;
+			for (int64_t i = 0; i < n; i++) {
+				*hashmap_int64_insert(hm, &i, sizeof i) = i * 2;
+				const int64_t j = i / 2;
+				ok = ok && hashmap_int64_get(hm, &j, sizeof j, -1) == j * 2;
+			}
+			for (int64_t i = 0; i < n; i++) {
+				ok = ok && hashmap_int64_get(hm, &i, sizeof i, -1) == i * 2;
+			}
+			ok = ok && !hashmap_int64_contains(hm, &n, sizeof n);
+			ok = ok && hm->count == (size_t)n + 1;
+			ok = ok && hm->shift < 64 - __builtin_ctzll(ENTRY_COUNT);
+			ok = ok && first == hashmap_int64_insert(hm, &(int64_t){-1}, sizeof(int64_t)) && *first == -1;
+			status = ok ? status : EXIT_FAILURE;
+			printf("(hashmap_int64) growth - %s\n", ok ? "OK" : "FAILED");
+		}
+		arena_reset(&a);
+
+		hm = hashmap_int64_new(&a);
+		{ /* test reserve */
+			hashmap_int64_reserve(hm, n);
+			const size_t shift = hm->shift;
+			bool ok = (size_t)1 << (64 - shift) >= (size_t)n;
+			for (int64_t i = 0; i < n; i++) {
+				*hashmap_int64_insert(hm, &i, sizeof i) = i;
+				ok = ok && hm->old_buckets == NULL;
+			}
+			for (int64_t i = 0; i < n; i++) {
+				ok = ok && hashmap_int64_get(hm, &i, sizeof i, -1) == i;
+			}
+			ok = ok && hm->shift == shift;
+			status = ok ? status : EXIT_FAILURE;
+			printf("(hashmap_int64) reserve - %s\n", ok ? "OK" : "FAILED");
+		}
+		arena_reset(&a);
+	}
+
+	{
+		Swisstable* st = swisstable_new(&a);
+		{ /* test sinsert and sget */
+			char key[] = "hello";
+			char val[] = "world";
+			*swisstable_sinsert(st, key) = val;
+			bool ok = memcmp(swisstable_sget(st, key, "(not found)"), val, sizeof val) == 0;
+			ok = ok && swisstable_sget(st, "world", NULL) == NULL;
+			status = ok ? status : EXIT_FAILURE;
+			printf("(swisstable) sinsert and sget - %s\n", ok ? "OK" : "FAILED");
+		}
+		arena_reset(&a);
+	}
+
+	{
+		const int64_t n = 200000;
+		Swisstable_int64_t* st = swisstable_int64_new(&a);
+		{ /* test growth, and keys of different lengths with equal prefixes */
+			bool ok = true;
+			for (int64_t i = 0; i < n; i++) {
+				*swisstable_int64_insert(st, &i, sizeof i) = i * 2;
+				*swisstable_int64_insert(st, &i, sizeof i - 1) = -i;
+				const int64_t j = i / 2;
+				ok = ok && swisstable_int64_get(st, &j, sizeof j, -1) == j * 2;
+			}
+			for (int64_t i = 0; i < n; i++) {
+				ok = ok && swisstable_int64_get(st, &i, sizeof i, -1) == i * 2;
+				ok = ok && swisstable_int64_get(st, &i, sizeof i - 1, 1) == -i;
+			}
+			ok = ok && !swisstable_int64_contains(st, &n, sizeof n);
+			ok = ok && st->count == 2 * (size_t)n;
+			status = ok ? status : EXIT_FAILURE;
+			printf("(swisstable_int64) growth - %s\n", ok ? "OK" : "FAILED");
+		}
+		arena_reset(&a);
+
+		st = swisstable_int64_new(&a);
+		{ /* test reserve */
+			swisstable_int64_reserve(st, n);
+			const uint8_t* ctrl = st->ctrl;
+			bool ok = true;
+			for (int64_t i = 0; i < n; i++) {
+				*swisstable_int64_insert(st, &i, sizeof i) = i;
+			}
+			for (int64_t i = 0; i < n; i++) {
+				ok = ok && swisstable_int64_get(st, &i, sizeof i, -1) == i;
+			}
+			ok = ok && st->ctrl == ctrl;
+			status = ok ? status : EXIT_FAILURE;
+			printf("(swisstable_int64) reserve - %s\n", ok ? "OK" : "FAILED");
+		}
+		arena_reset(&a);
+	}
+
+	bench_maps(&a);
+
 #if 1
     /* benchmark hash functions */
     for (size_t i = 0; i < sizeof hashes / sizeof *hashes; i++) {